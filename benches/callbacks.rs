@@ -0,0 +1,101 @@
+//! Measures the overhead the wrapper adds to each plugin callback.
+//!
+//! Run with:
+//!
+//! ```text
+//! cargo bench --features host --bench callbacks -- [--save-baseline] [--check]
+//! ```
+//!
+//! The plugin does no work of its own, so the reported times are the cost of
+//! the `extern "C"` trampolines, the page data handling and the calls back
+//! into the host. Each sample is the mean over a batch of calls.
+
+mod support;
+
+use {
+    std::{collections::BTreeMap, env, process, sync::atomic::Ordering, time::Instant},
+    support::{baseline::Gate, Plugin, Samples, Short, PAGE_COUNT},
+    zathura_plugin::host::Document,
+};
+
+const PAGES: u32 = 1000;
+const SAMPLES: usize = 200;
+
+/// Measures the mean time per call of `f`, which makes `calls` calls.
+fn measure(calls: u32, mut f: impl FnMut()) -> Samples {
+    let mut samples = Samples::new();
+    f();
+    for _ in 0..SAMPLES {
+        let start = Instant::now();
+        f();
+        samples.push(start.elapsed() / calls);
+    }
+    samples
+}
+
+fn page_lifecycle<D: Default>() -> Samples {
+    let path = env::current_exe().unwrap();
+    let mut doc = Document::open::<Plugin<D>>(path).unwrap();
+    doc.clear_pages().unwrap();
+    measure(PAGES, || {
+        doc.init_pages().unwrap();
+        doc.clear_pages().unwrap();
+    })
+}
+
+fn run() -> Result<(), String> {
+    let mut args = support::args();
+    let gate = Gate::from_args("callbacks", &mut args)?;
+    if let Some(arg) = args.first() {
+        return Err(format!("unexpected argument `{}`", arg));
+    }
+
+    PAGE_COUNT.store(PAGES, Ordering::Relaxed);
+    let path = env::current_exe().unwrap();
+    let mut metrics = BTreeMap::new();
+
+    metrics.insert(
+        "document_open+free",
+        measure(1, || {
+            // Also initializes and clears all pages.
+            drop(Document::open::<Plugin<()>>(&path).unwrap());
+        }),
+    );
+    metrics.insert("page_init+clear/0B", page_lifecycle::<()>());
+    metrics.insert("page_init+clear/64B", page_lifecycle::<[u64; 8]>());
+
+    let mut doc = Document::open::<Plugin<[u64; 8]>>(&path).unwrap();
+    let surface = cairo::ImageSurface::create(cairo::Format::ARgb32, 1, 1)
+        .map_err(|e| format!("failed to create surface: {:?}", e))?;
+    let cairo = cairo::Context::new(&surface);
+    metrics.insert(
+        "page_render",
+        measure(PAGES, || {
+            for page in 0..PAGES as usize {
+                doc.render(page, &cairo, false).unwrap();
+            }
+        }),
+    );
+
+    println!(
+        "{:<24} {:>12} {:>12} {:>12}",
+        "callback", "p50", "p95", "p99"
+    );
+    for (name, samples) in &metrics {
+        println!(
+            "{:<24} {:>12} {:>12} {:>12}",
+            name,
+            Short(samples.percentile(0.50)),
+            Short(samples.percentile(0.95)),
+            Short(samples.percentile(0.99)),
+        );
+    }
+    gate.finish(&metrics)
+}
+
+fn main() {
+    if let Err(e) = run() {
+        eprintln!("error: {}", e);
+        process::exit(1);
+    }
+}
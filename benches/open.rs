@@ -0,0 +1,222 @@
+//! Measures how the cost of opening a document scales with its page count.
+//!
+//! Run with:
+//!
+//! ```text
+//! cargo bench --features host --bench open -- [--max-memory MIB] [--csv FILE]
+//! ```
+//!
+//! Documents with 10 to 1,000,000 pages are opened with a plugin that does no
+//! work of its own, for `PageData` of 0, 64 and 4096 bytes. Opening includes
+//! `document_open` and `page_init` for every page, like in Zathura. For each
+//! combination, the time and heap memory per page are reported, followed by
+//! a plot of the time per page against the page count.
+//!
+//! The memory includes the host's own per-page data, which stands in for
+//! Zathura's; the 0 byte column shows that baseline. Combinations expected to
+//! need more than `--max-memory` (1024 MiB by default) are skipped. `--csv`
+//! additionally writes the results to a CSV file.
+
+mod support;
+
+use {
+    std::{
+        alloc::{GlobalAlloc, Layout, System},
+        collections::BTreeMap,
+        env, fs, process,
+        sync::atomic::{AtomicUsize, Ordering},
+        time::{Duration, Instant},
+    },
+    support::{baseline::Gate, Plugin, Samples, Short, PAGE_COUNT},
+    zathura_plugin::host::Document,
+};
+
+/// Tracks the number of live heap bytes.
+struct CountingAllocator;
+
+static LIVE_BYTES: AtomicUsize = AtomicUsize::new(0);
+
+unsafe impl GlobalAlloc for CountingAllocator {
+    unsafe fn alloc(&self, layout: Layout) -> *mut u8 {
+        LIVE_BYTES.fetch_add(layout.size(), Ordering::Relaxed);
+        System.alloc(layout)
+    }
+
+    unsafe fn alloc_zeroed(&self, layout: Layout) -> *mut u8 {
+        LIVE_BYTES.fetch_add(layout.size(), Ordering::Relaxed);
+        System.alloc_zeroed(layout)
+    }
+
+    unsafe fn realloc(&self, ptr: *mut u8, layout: Layout, new_size: usize) -> *mut u8 {
+        LIVE_BYTES.fetch_add(new_size, Ordering::Relaxed);
+        LIVE_BYTES.fetch_sub(layout.size(), Ordering::Relaxed);
+        System.realloc(ptr, layout, new_size)
+    }
+
+    unsafe fn dealloc(&self, ptr: *mut u8, layout: Layout) {
+        LIVE_BYTES.fetch_sub(layout.size(), Ordering::Relaxed);
+        System.dealloc(ptr, layout)
+    }
+}
+
+#[global_allocator]
+static ALLOCATOR: CountingAllocator = CountingAllocator;
+
+const PAGE_COUNTS: &[u32] = &[10, 100, 1_000, 10_000, 100_000, 1_000_000];
+
+/// Each combination is opened repeatedly for at least this long...
+const MIN_TIME: Duration = Duration::from_millis(200);
+/// ...and at least this many times.
+const MIN_RUNS: usize = 5;
+
+/// 4096 bytes of page data.
+#[allow(dead_code)]
+struct Large([u64; 512]);
+
+impl Default for Large {
+    fn default() -> Self {
+        Large([0; 512])
+    }
+}
+
+/// Results for one page count and `PageData` size.
+struct Point {
+    size: usize,
+    pages: u32,
+    /// Time per page.
+    samples: Samples,
+    /// Heap bytes per page.
+    bytes: f64,
+}
+
+fn measure<D: Default>(pages: u32) -> Point {
+    let path = env::current_exe().unwrap();
+    PAGE_COUNT.store(pages, Ordering::Relaxed);
+
+    let mut samples = Samples::new();
+    let mut bytes = 0.0;
+    let start = Instant::now();
+    while samples.len() < MIN_RUNS || start.elapsed() < MIN_TIME {
+        let before = LIVE_BYTES.load(Ordering::Relaxed);
+        let open = Instant::now();
+        let doc = Document::open::<Plugin<D>>(&path).unwrap();
+        samples.push(open.elapsed() / pages);
+        bytes = (LIVE_BYTES.load(Ordering::Relaxed) - before) as f64 / pages as f64;
+        drop(doc);
+    }
+
+    Point {
+        size: std::mem::size_of::<D>(),
+        pages,
+        samples,
+        bytes,
+    }
+}
+
+fn plot(points: &[Point]) {
+    const WIDTH: f64 = 50.0;
+    let max = points
+        .iter()
+        .map(|point| point.samples.median())
+        .fold(1.0, f64::max);
+
+    println!();
+    println!("time per page (median):");
+    for point in points {
+        let ns = point.samples.median();
+        let bar = "#".repeat((ns / max * WIDTH).round().max(1.0) as usize);
+        println!(
+            "{:>5} B {:>9} pages |{:<50}| {}",
+            point.size,
+            point.pages,
+            bar,
+            Short(Duration::from_nanos(ns as u64))
+        );
+    }
+}
+
+fn run() -> Result<(), String> {
+    let mut args = support::args();
+    let gate = Gate::from_args("open", &mut args)?;
+    let mut max_memory = 1024 * 1024 * 1024;
+    let mut csv = None;
+    let mut args = args.into_iter();
+    while let Some(arg) = args.next() {
+        match &*arg {
+            "--max-memory" => {
+                let mib: usize = args
+                    .next()
+                    .and_then(|arg| arg.parse().ok())
+                    .ok_or("expected a size in MiB after --max-memory")?;
+                max_memory = mib * 1024 * 1024;
+            }
+            "--csv" => csv = Some(args.next().ok_or("missing --csv argument")?),
+            _ => return Err(format!("unexpected argument `{}`", arg)),
+        }
+    }
+
+    let sizes: [(usize, fn(u32) -> Point); 3] = [
+        (0, measure::<()>),
+        (64, measure::<[u64; 8]>),
+        (4096, measure::<Large>),
+    ];
+
+    println!(
+        "{:>7} {:>9} {:>12} {:>12} {:>12}",
+        "size", "pages", "ns/page", "p95", "bytes/page"
+    );
+    let mut points = Vec::new();
+    for &(size, measure) in &sizes {
+        for &pages in PAGE_COUNTS {
+            // Rough estimate, including the host's and wrapper's page data.
+            if pages as usize * (size + 256) > max_memory {
+                println!("{:>5} B {:>9} {:>12}", size, pages, "skipped");
+                continue;
+            }
+            let point = measure(pages);
+            println!(
+                "{:>5} B {:>9} {:>12.1} {:>12} {:>12.1}",
+                size,
+                pages,
+                point.samples.median(),
+                Short(point.samples.percentile(0.95)),
+                point.bytes
+            );
+            points.push(point);
+        }
+    }
+
+    plot(&points);
+
+    if let Some(path) = csv {
+        let mut text =
+            String::from("page_data_bytes,pages,ns_per_page,p95_ns_per_page,bytes_per_page\n");
+        for point in &points {
+            text += &format!(
+                "{},{},{:.1},{},{:.1}\n",
+                point.size,
+                point.pages,
+                point.samples.median(),
+                point.samples.percentile(0.95).as_nanos(),
+                point.bytes
+            );
+        }
+        fs::write(&path, text).map_err(|e| format!("{}: {}", path, e))?;
+    }
+
+    let metrics: BTreeMap<String, &Samples> = points
+        .iter()
+        .map(|point| {
+            let name = format!("open/{}B/{}", point.size, point.pages);
+            (name, &point.samples)
+        })
+        .collect();
+    gate.finish(metrics.iter().map(|(name, samples)| (name, *samples)))
+}
+
+fn main() {
+    if let Err(e) = run() {
+        eprintln!("error: {}", e);
+        process::exit(1);
+    }
+}
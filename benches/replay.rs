@@ -0,0 +1,340 @@
+//! Replays recorded navigation traces against the reference plugin.
+//!
+//! Run with:
+//!
+//! ```text
+//! cargo bench --features host,testplugin --bench replay -- [--corpus DIR] [TRACE...]
+//! ```
+//!
+//! The `--save-baseline` and `--check` flags store and compare the latencies
+//! per operation (see `support::baseline`).
+//!
+//! Document paths in traces are relative to the corpus directory, which
+//! defaults to `benches/corpus`. The files there are fixed, so that the page
+//! counts and latencies of a replay only change with the code being measured.
+//! Without trace arguments, all traces in `benches/traces` are replayed.
+//!
+//! # Trace formats
+//!
+//! Traces with the `.ztrace` extension are binary traces recorded from a real
+//! Zathura session with `ZATHURA_PLUGIN_TRACE` (see the `trace` module).
+//! Their documents are opened by basename from the corpus directory, and
+//! their successful renders are replayed with the recorded zoom level,
+//! render scale, rotation and scaling factors.
+//!
+//! All other traces are text files with one command per line. Empty lines
+//! and lines starting with `#` are ignored.
+//!
+//! * `open <path>`: opens a document (closing the previous one).
+//! * `close`: closes the document.
+//! * `zoom <zoom> [<scale>]`: sets the zoom level and render scale. The scale
+//!   defaults to the zoom level at 96 PPI.
+//! * `rotate <degrees>`: sets the rotation.
+//! * `hidpi <x> [<y>]`: sets the device scaling factors. `y` defaults to
+//!   `x`.
+//! * `goto <page>`: sets the current page.
+//! * `render <pages>...`: renders pages, given as indices or inclusive
+//!   ranges (`3-7`). Indices past the end of the document are clamped.
+//! * `search <text>`: searches the current page (the page last rendered or
+//!   gone to) for text.
+//!
+//! The report lists p50/p95/p99 latencies per operation type and the peak
+//! resident set size of the process.
+
+mod support;
+
+use {
+    std::{
+        collections::BTreeMap,
+        fs,
+        path::{Path, PathBuf},
+        process,
+        time::Instant,
+    },
+    support::{baseline::Gate, Samples, Short},
+    zathura_plugin::{
+        host::Document,
+        testplugin::TestPlugin,
+        trace::{Callback, TraceReader},
+    },
+};
+
+#[derive(Debug)]
+enum Command {
+    Open(String),
+    Close,
+    Zoom(f64, f64),
+    Rotate(u32),
+    HiDpi(f64, f64),
+    Goto(u32),
+    Render(Vec<(usize, usize)>),
+    Search(String),
+}
+
+fn parse(trace: &str) -> Result<Vec<Command>, String> {
+    let mut commands = Vec::new();
+    for (number, line) in trace.lines().enumerate() {
+        let line = line.trim();
+        if line.is_empty() || line.starts_with('#') {
+            continue;
+        }
+
+        let err = |msg: &str| format!("line {}: {}", number + 1, msg);
+        let mut words = line.splitn(2, char::is_whitespace);
+        let command = words.next().unwrap();
+        let rest = words.next().unwrap_or("").trim();
+        let numbers = || -> Result<Vec<f64>, String> {
+            rest.split_whitespace()
+                .map(|word| word.parse().map_err(|_| err("invalid number")))
+                .collect()
+        };
+
+        commands.push(match command {
+            "open" if !rest.is_empty() => Command::Open(rest.to_string()),
+            "close" => Command::Close,
+            "zoom" => match numbers()?[..] {
+                [zoom] => Command::Zoom(zoom, zoom * 96.0 / 72.0),
+                [zoom, scale] => Command::Zoom(zoom, scale),
+                _ => return Err(err("expected `zoom <zoom> [<scale>]`")),
+            },
+            "rotate" => match numbers()?[..] {
+                [degrees] => Command::Rotate(degrees as u32),
+                _ => return Err(err("expected `rotate <degrees>`")),
+            },
+            "hidpi" => match numbers()?[..] {
+                [x] => Command::HiDpi(x, x),
+                [x, y] => Command::HiDpi(x, y),
+                _ => return Err(err("expected `hidpi <x> [<y>]`")),
+            },
+            "goto" => match numbers()?[..] {
+                [page] => Command::Goto(page as u32),
+                _ => return Err(err("expected `goto <page>`")),
+            },
+            "render" => {
+                let mut ranges = Vec::new();
+                for word in rest.split_whitespace() {
+                    let mut bounds = word.splitn(2, '-').map(str::parse::<usize>);
+                    let start = bounds.next().unwrap().map_err(|_| err("invalid page"))?;
+                    let end = match bounds.next() {
+                        Some(end) => end.map_err(|_| err("invalid page range"))?,
+                        None => start,
+                    };
+                    ranges.push((start, end));
+                }
+                Command::Render(ranges)
+            }
+            "search" if !rest.is_empty() => Command::Search(rest.to_string()),
+            _ => return Err(err(&format!("unknown command `{}`", line))),
+        });
+    }
+    Ok(commands)
+}
+
+/// Reads a binary trace, and turns it into the commands that reproduce its
+/// session.
+fn read_binary(path: &Path) -> Result<Vec<Command>, String> {
+    let reader = TraceReader::open(path).map_err(|e| e.to_string())?;
+    let mut commands = Vec::new();
+    // The recorded document that is open, and the view state last set.
+    let mut open = None;
+    let mut view = None;
+    for record in reader {
+        let record = record.map_err(|e| e.to_string())?;
+        match record.callback {
+            Callback::DocumentOpen if record.result.is_ok() => {
+                let name = record.basename.unwrap_or_default();
+                let name = String::from_utf8(name).map_err(|_| "basename is not UTF-8")?;
+                commands.push(Command::Open(name));
+                open = Some(record.document);
+                view = None;
+            }
+            Callback::DocumentFree if open == Some(record.document) => {
+                commands.push(Command::Close);
+                open = None;
+            }
+            Callback::PageRender
+                if open == Some(record.document) && !record.printing && record.result.is_ok() =>
+            {
+                let page = match record.page {
+                    Some(page) => page as usize,
+                    None => continue,
+                };
+                let state = (
+                    record.zoom,
+                    record.scale,
+                    record.rotation,
+                    record.scaling_factors,
+                );
+                if view != Some(state) {
+                    let (x, y) = record.scaling_factors;
+                    commands.push(Command::Zoom(record.zoom, record.scale));
+                    commands.push(Command::Rotate(record.rotation));
+                    commands.push(Command::HiDpi(x, y));
+                    view = Some(state);
+                }
+                commands.push(Command::Render(vec![(page, page)]));
+            }
+            _ => {}
+        }
+    }
+    Ok(commands)
+}
+
+#[derive(Default)]
+struct Report {
+    samples: BTreeMap<&'static str, Samples>,
+}
+
+impl Report {
+    fn time<T>(&mut self, operation: &'static str, f: impl FnOnce() -> T) -> T {
+        let start = Instant::now();
+        let result = f();
+        self.samples
+            .entry(operation)
+            .or_default()
+            .push(start.elapsed());
+        result
+    }
+}
+
+fn replay(commands: &[Command], corpus: &Path, report: &mut Report) -> Result<(), String> {
+    let mut document: Option<Document> = None;
+    // The current page of the open document.
+    let mut current = 0;
+    for command in commands {
+        match command {
+            Command::Open(path) => {
+                if let Some(doc) = document.take() {
+                    report.time("close", || drop(doc));
+                }
+                let path = corpus.join(path);
+                let doc = report
+                    .time("open", || Document::open::<TestPlugin>(&path))
+                    .map_err(|e| format!("failed to open {}: {:?}", path.display(), e))?;
+                document = Some(doc);
+                current = 0;
+            }
+            Command::Close => {
+                if let Some(doc) = document.take() {
+                    report.time("close", || drop(doc));
+                }
+            }
+            command => {
+                let doc = document
+                    .as_mut()
+                    .ok_or_else(|| format!("`{:?}` without an open document", command))?;
+                match command {
+                    Command::Zoom(zoom, scale) => doc.set_scale(*zoom, *scale),
+                    Command::Rotate(degrees) => doc.set_rotation(*degrees),
+                    Command::HiDpi(x, y) => doc.set_scaling_factors(*x, *y),
+                    Command::Goto(page) => {
+                        doc.set_current_page(*page);
+                        current = *page as usize;
+                    }
+                    Command::Render(ranges) => {
+                        let last = match doc.page_count() {
+                            0 => continue,
+                            count => count - 1,
+                        };
+                        for &(start, end) in ranges {
+                            for page in start.min(last)..=end.min(last) {
+                                doc.set_current_page(page as u32);
+                                current = page;
+                                report
+                                    .time("render", || doc.render_page(page))
+                                    .map_err(|e| {
+                                        format!("failed to render page {}: {:?}", page, e)
+                                    })?;
+                            }
+                        }
+                    }
+                    Command::Search(text) => {
+                        let page = match doc.page_count() {
+                            0 => continue,
+                            count => current.min(count - 1),
+                        };
+                        report
+                            .time("search", || doc.search(page, text))
+                            .map_err(|e| format!("failed to search page {}: {:?}", page, e))?;
+                    }
+                    Command::Open(_) | Command::Close => unreachable!(),
+                }
+            }
+        }
+    }
+
+    if let Some(doc) = document {
+        report.time("close", || drop(doc));
+    }
+    Ok(())
+}
+
+fn run() -> Result<(), String> {
+    let mut corpus = Path::new(env!("CARGO_MANIFEST_DIR")).join("benches/corpus");
+    let mut traces = Vec::new();
+    let mut args = support::args();
+    let gate = Gate::from_args("replay", &mut args)?;
+    let mut args = args.into_iter();
+    while let Some(arg) = args.next() {
+        match &*arg {
+            "--corpus" => corpus = args.next().ok_or("missing --corpus argument")?.into(),
+            _ => traces.push(PathBuf::from(arg)),
+        }
+    }
+
+    if traces.is_empty() {
+        let dir = Path::new(env!("CARGO_MANIFEST_DIR")).join("benches/traces");
+        for entry in fs::read_dir(&dir).map_err(|e| format!("{}: {}", dir.display(), e))? {
+            let path = entry.map_err(|e| e.to_string())?.path();
+            if path
+                .extension()
+                .map_or(false, |ext| ext == "trace" || ext == "ztrace")
+            {
+                traces.push(path);
+            }
+        }
+        traces.sort();
+    }
+
+    let mut report = Report::default();
+    for trace in &traces {
+        let commands = if trace.extension().map_or(false, |ext| ext == "ztrace") {
+            read_binary(trace)
+        } else {
+            fs::read_to_string(trace)
+                .map_err(|e| e.to_string())
+                .and_then(|text| parse(&text))
+        };
+        let commands = commands.map_err(|e| format!("{}: {}", trace.display(), e))?;
+        println!("replaying {}", trace.display());
+        replay(&commands, &corpus, &mut report)?;
+    }
+
+    println!();
+    println!(
+        "{:<10} {:>8} {:>12} {:>12} {:>12}",
+        "operation", "count", "p50", "p95", "p99"
+    );
+    for (operation, samples) in &report.samples {
+        println!(
+            "{:<10} {:>8} {:>12} {:>12} {:>12}",
+            operation,
+            samples.len(),
+            Short(samples.percentile(0.50)),
+            Short(samples.percentile(0.95)),
+            Short(samples.percentile(0.99)),
+        );
+    }
+    match support::peak_rss() {
+        Some(bytes) => println!("peak RSS: {:.1} MiB", bytes as f64 / (1024.0 * 1024.0)),
+        None => println!("peak RSS: unknown"),
+    }
+    gate.finish(&report.samples)
+}
+
+fn main() {
+    if let Err(e) = run() {
+        eprintln!("error: {}", e);
+        process::exit(1);
+    }
+}
@@ -0,0 +1,245 @@
+//! Measures what loading a plugin library costs Zathura at startup.
+//!
+//! Run with:
+//!
+//! ```text
+//! cargo bench --features host,testplugin --bench startup -- [PLUGIN...]
+//! ```
+//!
+//! Zathura loads every library in its plugin directory when it starts, even
+//! if no document of the plugin's type is ever opened, so this cost adds to
+//! every launch for every installed plugin. Each sample loads the library the
+//! way Zathura does (`dlopen` resolving all symbols immediately), looks up
+//! and checks the `zathura_plugin_3_4` definition, and unloads the library
+//! again.
+//!
+//! By default, the crate's own plugin library is measured, built like a
+//! plugin that is loaded into Zathura: with the `testplugin` feature but
+//! without `host`, into `target/startup`. (The library the benchmark itself
+//! is built with also exports the `host` module's stand-ins for Zathura's
+//! functions, which makes it more expensive to load than a real plugin.)
+//! Other plugin libraries can be given as arguments instead.
+//!
+//! Plugins call functions of the Zathura executable, which have to be
+//! resolved when loading them. The `host` build of the library provides
+//! these, so it is loaded into the global scope once before measuring.
+//!
+//! Besides the load and lookup times, the report lists how many threads were
+//! started by loading the library, which should be none: the library's
+//! global state is only created once a document is opened.
+
+mod support;
+
+use {
+    std::{
+        collections::BTreeMap,
+        env,
+        ffi::{CStr, CString},
+        fs,
+        os::raw::{c_char, c_int, c_void},
+        path::{Path, PathBuf},
+        process::{self, Command},
+        time::{Duration, Instant},
+    },
+    support::{baseline::Gate, Samples, Short},
+    zathura_plugin::sys::zathura_plugin_definition_t,
+};
+
+extern "C" {
+    fn dlopen(filename: *const c_char, flags: c_int) -> *mut c_void;
+    fn dlsym(handle: *mut c_void, symbol: *const c_char) -> *mut c_void;
+    fn dlclose(handle: *mut c_void) -> c_int;
+    fn dlerror() -> *const c_char;
+}
+
+/// Zathura loads plugins with `RTLD_NOW` (via GModule).
+const RTLD_NOW: c_int = 2;
+const RTLD_NOLOAD: c_int = 4;
+const RTLD_GLOBAL: c_int = 0x100;
+
+/// Each library is loaded repeatedly for at least this long...
+const MIN_TIME: Duration = Duration::from_millis(500);
+/// ...and at least this many times.
+const MIN_RUNS: usize = 50;
+
+struct Results {
+    /// Time of the very first load, before the library was ever mapped.
+    first: Duration,
+    open: Samples,
+    lookup: Samples,
+    /// Threads started while loading the library.
+    threads: usize,
+    /// Whether `dlclose` actually unloaded the library. If not, all loads
+    /// after the first only increment a reference count.
+    unloads: bool,
+}
+
+fn error() -> String {
+    unsafe {
+        let error = dlerror();
+        if error.is_null() {
+            "unknown error".to_string()
+        } else {
+            CStr::from_ptr(error).to_string_lossy().into_owned()
+        }
+    }
+}
+
+fn thread_count() -> usize {
+    fs::read_dir("/proc/self/task").map_or(0, |dir| dir.count())
+}
+
+/// Loads the library and looks up its plugin definition, returning the
+/// library handle and the time both steps took.
+unsafe fn load(path: &CStr) -> Result<(*mut c_void, Duration, Duration), String> {
+    let start = Instant::now();
+    let handle = dlopen(path.as_ptr(), RTLD_NOW);
+    let open = start.elapsed();
+    if handle.is_null() {
+        return Err(error());
+    }
+
+    let start = Instant::now();
+    let definition = dlsym(handle, b"zathura_plugin_3_4\0".as_ptr() as *const c_char)
+        as *const zathura_plugin_definition_t;
+    let lookup = start.elapsed();
+    if definition.is_null() {
+        dlclose(handle);
+        return Err("no `zathura_plugin_3_4` definition".to_string());
+    }
+    // Zathura rejects definitions without a name or MIME types.
+    if (*definition).name.is_null() || (*definition).mime_types_size == 0 {
+        dlclose(handle);
+        return Err("invalid plugin definition".to_string());
+    }
+    Ok((handle, open, lookup))
+}
+
+fn measure(path: &Path) -> Result<Results, String> {
+    let c_path = CString::new(path.to_string_lossy().as_bytes()).unwrap();
+    unsafe {
+        let threads = thread_count();
+        let (handle, first, _) = load(&c_path)?;
+        let threads = thread_count().saturating_sub(threads);
+        dlclose(handle);
+
+        let loaded = dlopen(c_path.as_ptr(), RTLD_NOW | RTLD_NOLOAD);
+        let unloads = loaded.is_null();
+        if !unloads {
+            dlclose(loaded);
+        }
+
+        let mut open = Samples::new();
+        let mut lookup = Samples::new();
+        let start = Instant::now();
+        while open.len() < MIN_RUNS || start.elapsed() < MIN_TIME {
+            let (handle, open_time, lookup_time) = load(&c_path)?;
+            dlclose(handle);
+            open.push(open_time);
+            lookup.push(lookup_time);
+        }
+
+        Ok(Results {
+            first,
+            open,
+            lookup,
+            threads,
+            unloads,
+        })
+    }
+}
+
+/// File name of the crate's plugin library.
+fn library_name() -> String {
+    format!(
+        "{}zathura_plugin{}",
+        env::consts::DLL_PREFIX,
+        env::consts::DLL_SUFFIX
+    )
+}
+
+/// Loads the crate's plugin library the benchmark is built with into the
+/// global scope, where it provides Zathura's functions to the plugins.
+///
+/// The library is never unloaded.
+fn load_host() -> Result<(), String> {
+    let exe = env::current_exe().unwrap();
+    let deps = exe.parent().unwrap();
+    let path = match deps.join(library_name()) {
+        path if path.exists() => path,
+        _ => deps.parent().unwrap().join(library_name()),
+    };
+    let c_path = CString::new(path.to_string_lossy().as_bytes()).unwrap();
+    let handle = unsafe { dlopen(c_path.as_ptr(), RTLD_NOW | RTLD_GLOBAL) };
+    if handle.is_null() {
+        return Err(format!("{}: {}", path.display(), error()));
+    }
+    Ok(())
+}
+
+/// Builds the crate's plugin library without the `host` feature and returns
+/// its path.
+fn own_plugin() -> Result<PathBuf, String> {
+    let exe = env::current_exe().unwrap();
+    // `target/<profile>/deps/<bench>`
+    let target = exe.ancestors().nth(3).unwrap().join("startup");
+    let status = Command::new(env!("CARGO"))
+        .args(&["build", "--release", "--lib", "--features", "testplugin"])
+        .arg("--target-dir")
+        .arg(&target)
+        .current_dir(env!("CARGO_MANIFEST_DIR"))
+        .status()
+        .map_err(|e| format!("failed to run cargo: {}", e))?;
+    if !status.success() {
+        return Err("failed to build the plugin library".to_string());
+    }
+    Ok(target.join("release").join(library_name()))
+}
+
+fn run() -> Result<(), String> {
+    let mut args = support::args();
+    let gate = Gate::from_args("startup", &mut args)?;
+    if let Some(arg) = args.iter().find(|arg| arg.starts_with("--")) {
+        return Err(format!("unexpected argument `{}`", arg));
+    }
+    let plugins = match args.is_empty() {
+        true => vec![own_plugin()?],
+        false => args.into_iter().map(PathBuf::from).collect(),
+    };
+    load_host()?;
+
+    println!(
+        "{:<28} {:>10} {:>10} {:>10} {:>10} {:>8}",
+        "plugin", "first", "dlopen", "p95", "dlsym", "threads"
+    );
+    let mut metrics = BTreeMap::new();
+    for path in &plugins {
+        let name = path.file_name().map_or_else(
+            || path.display().to_string(),
+            |name| name.to_string_lossy().into_owned(),
+        );
+        let results = measure(path).map_err(|e| format!("{}: {}", path.display(), e))?;
+        println!(
+            "{:<28} {:>10} {:>10} {:>10} {:>10} {:>8}",
+            name,
+            Short(results.first),
+            Short(results.open.percentile(0.5)),
+            Short(results.open.percentile(0.95)),
+            Short(results.lookup.percentile(0.5)),
+            results.threads
+        );
+        if !results.unloads {
+            println!("  (not unloaded by dlclose, later loads only reuse it)");
+        }
+        metrics.insert(format!("{}/dlopen", name), results.open);
+        metrics.insert(format!("{}/dlsym", name), results.lookup);
+    }
+    gate.finish(&metrics)
+}
+
+fn main() {
+    if let Err(e) = run() {
+        eprintln!("error: {}", e);
+        process::exit(1);
+    }
+}
@@ -0,0 +1,260 @@
+//! Comparison of benchmark results against a stored baseline.
+//!
+//! Benchmarks report their results as named metrics, each with its samples.
+//! The flags handled here are accepted by every benchmark:
+//!
+//! * `--save-baseline`: stores the median and median absolute deviation
+//!   (MAD) of each metric in `benches/baselines/<bench>.txt`.
+//! * `--check`: compares the run against that file, prints a report and
+//!   fails if any metric regressed. Without a baseline, there is nothing to
+//!   compare against, so the check only says so and passes.
+//! * `--baseline FILE`: uses `FILE` instead of the default baseline path.
+//! * `--threshold PCT`: the relative slowdown tolerated by `--check`
+//!   (default 10).
+//!
+//! A metric only counts as regressed if its median grew by more than the
+//! relative threshold *and* by more than three times the noise of both runs,
+//! estimated from their MADs. Noisy metrics therefore need a larger change to
+//! fail the check than stable ones.
+//!
+//! Timings depend on the machine, so a baseline should only be compared
+//! against runs on the machine that recorded it. The baselines committed in
+//! `benches/baselines` are recorded on the release machine when a release is
+//! made (see `RELEASE_PROCESS.md`).
+
+use {
+    super::{Samples, Short},
+    std::{
+        collections::BTreeMap,
+        fs, io,
+        path::{Path, PathBuf},
+        time::Duration,
+    },
+};
+
+/// First line of every baseline file. Bump the format number when changing
+/// the layout.
+const HEADER: &str = "# zathura-plugin benchmark baseline, format 1";
+
+/// Scales a MAD to the standard deviation of a normal distribution.
+const MAD_TO_SIGMA: f64 = 1.4826;
+
+/// How many standard deviations a change must exceed to be significant.
+const SIGNIFICANCE: f64 = 3.0;
+
+/// Summary of one metric, as stored in a baseline file.
+#[derive(Debug, Copy, Clone)]
+struct Summary {
+    median: f64,
+    mad: f64,
+    count: usize,
+}
+
+impl Summary {
+    fn of(samples: &Samples) -> Self {
+        Summary {
+            median: samples.median(),
+            mad: samples.mad(),
+            count: samples.len(),
+        }
+    }
+}
+
+/// What the command line asked to do with a benchmark's results.
+#[derive(Debug)]
+pub struct Gate {
+    path: PathBuf,
+    save: bool,
+    check: bool,
+    threshold: f64,
+}
+
+impl Gate {
+    /// Parses and removes the baseline flags from `args`.
+    ///
+    /// `bench` is the name of the benchmark, used for the default baseline
+    /// path.
+    pub fn from_args(bench: &str, args: &mut Vec<String>) -> Result<Self, String> {
+        let mut gate = Gate {
+            path: Path::new(env!("CARGO_MANIFEST_DIR"))
+                .join("benches/baselines")
+                .join(format!("{}.txt", bench)),
+            save: false,
+            check: false,
+            threshold: 0.10,
+        };
+
+        let mut rest = Vec::new();
+        let mut iter = args.drain(..);
+        while let Some(arg) = iter.next() {
+            match &*arg {
+                "--save-baseline" => gate.save = true,
+                "--check" => gate.check = true,
+                "--baseline" => {
+                    gate.path = iter.next().ok_or("missing --baseline argument")?.into();
+                }
+                "--threshold" => {
+                    let pct: f64 = iter
+                        .next()
+                        .and_then(|arg| arg.parse().ok())
+                        .ok_or("expected a percentage after --threshold")?;
+                    gate.threshold = pct / 100.0;
+                }
+                _ => rest.push(arg),
+            }
+        }
+        drop(iter);
+        *args = rest;
+        Ok(gate)
+    }
+
+    /// Checks and/or saves `metrics`, as requested on the command line.
+    ///
+    /// Returns an error if `--check` found a regression.
+    pub fn finish<'a, K: AsRef<str> + 'a>(
+        &self,
+        metrics: impl IntoIterator<Item = (&'a K, &'a Samples)>,
+    ) -> Result<(), String> {
+        let current: BTreeMap<String, Summary> = metrics
+            .into_iter()
+            .map(|(name, samples)| (name.as_ref().to_string(), Summary::of(samples)))
+            .collect();
+
+        let mut result = Ok(());
+        if self.check {
+            match load(&self.path)? {
+                Some(baseline) => result = self.compare(&baseline, &current),
+                None => println!(
+                    "no baseline at {}, nothing to check against; record one with --save-baseline",
+                    self.path.display()
+                ),
+            }
+        }
+        if self.save {
+            save(&self.path, &current)?;
+            println!("baseline saved to {}", self.path.display());
+        }
+        result
+    }
+
+    fn compare(
+        &self,
+        baseline: &BTreeMap<String, Summary>,
+        current: &BTreeMap<String, Summary>,
+    ) -> Result<(), String> {
+        let ns = |ns: f64| Short(Duration::from_nanos(ns as u64));
+        let mut regressions = 0;
+
+        println!();
+        println!("compared against {}:", self.path.display());
+        println!(
+            "{:<28} {:>12} {:>12} {:>9}  verdict",
+            "metric", "baseline", "current", "change"
+        );
+        for (name, now) in current {
+            let before = match baseline.get(name) {
+                Some(before) => before,
+                None => {
+                    println!(
+                        "{:<28} {:>12} {:>12} {:>9}  new",
+                        name,
+                        "-",
+                        ns(now.median),
+                        "-"
+                    );
+                    continue;
+                }
+            };
+
+            let delta = now.median - before.median;
+            let noise = MAD_TO_SIGMA * (before.mad.powi(2) + now.mad.powi(2)).sqrt();
+            let limit = (self.threshold * before.median).max(SIGNIFICANCE * noise);
+            let verdict = if delta > limit {
+                regressions += 1;
+                "REGRESSED"
+            } else if -delta > limit {
+                "faster"
+            } else {
+                "ok"
+            };
+            let change = if before.median > 0.0 {
+                format!("{:+.1}%", delta / before.median * 100.0)
+            } else {
+                "-".to_string()
+            };
+            println!(
+                "{:<28} {:>12} {:>12} {:>9}  {}",
+                name,
+                ns(before.median),
+                ns(now.median),
+                change,
+                verdict
+            );
+        }
+        for name in baseline.keys().filter(|name| !current.contains_key(*name)) {
+            println!("{:<28} {:>12} {:>12} {:>9}  missing", name, "", "-", "-");
+        }
+
+        match regressions {
+            0 => Ok(()),
+            n => Err(format!(
+                "{} metric(s) regressed by more than {}% and the measurement noise",
+                n,
+                self.threshold * 100.0
+            )),
+        }
+    }
+}
+
+/// Loads the baseline at `path`, or returns `None` if there is none.
+fn load(path: &Path) -> Result<Option<BTreeMap<String, Summary>>, String> {
+    let text = match fs::read_to_string(path) {
+        Ok(text) => text,
+        Err(e) if e.kind() == io::ErrorKind::NotFound => return Ok(None),
+        Err(e) => return Err(format!("{}: {}", path.display(), e)),
+    };
+
+    let mut lines = text.lines().enumerate();
+    if lines.next().map(|(_, line)| line) != Some(HEADER) {
+        return Err(format!(
+            "{}: not a baseline file, or an unsupported format",
+            path.display()
+        ));
+    }
+
+    let mut summaries = BTreeMap::new();
+    for (number, line) in lines {
+        if line.trim().is_empty() || line.starts_with('#') {
+            continue;
+        }
+        let err = || format!("{}:{}: invalid line", path.display(), number + 1);
+        let fields: Vec<&str> = line.split_whitespace().collect();
+        let (name, median, mad, count) = match fields[..] {
+            [name, median, mad, count] => (name, median, mad, count),
+            _ => return Err(err()),
+        };
+        let summary = Summary {
+            median: median.parse().map_err(|_| err())?,
+            mad: mad.parse().map_err(|_| err())?,
+            count: count.parse().map_err(|_| err())?,
+        };
+        summaries.insert(name.to_string(), summary);
+    }
+    Ok(Some(summaries))
+}
+
+fn save(path: &Path, summaries: &BTreeMap<String, Summary>) -> Result<(), String> {
+    let mut text = format!("{}\n# metric median_ns mad_ns samples\n", HEADER);
+    for (name, summary) in summaries {
+        text += &format!(
+            "{} {:.1} {:.1} {}\n",
+            name, summary.median, summary.mad, summary.count
+        );
+    }
+
+    let err = |e: io::Error| format!("{}: {}", path.display(), e);
+    if let Some(dir) = path.parent() {
+        fs::create_dir_all(dir).map_err(err)?;
+    }
+    fs::write(path, text).map_err(err)
+}
@@ -0,0 +1,137 @@
+//! Helpers shared by the benchmarks.
+
+#![allow(dead_code)]
+
+pub mod baseline;
+
+use {
+    std::{
+        fs,
+        marker::PhantomData,
+        sync::atomic::{AtomicU32, Ordering},
+        time::Duration,
+    },
+    zathura_plugin::{DocumentInfo, DocumentRef, PageInfo, PageRef, PluginError, ZathuraPlugin},
+};
+
+pub use zathura_plugin::profile::Short;
+
+/// Page count of the documents `Plugin` opens.
+pub static PAGE_COUNT: AtomicU32 = AtomicU32::new(0);
+
+/// A plugin that does no work of its own, with `PageData` of type `D`.
+///
+/// Every document has `PAGE_COUNT` pages, whatever file is opened.
+pub struct Plugin<D>(PhantomData<D>);
+
+impl<D: Default> ZathuraPlugin for Plugin<D> {
+    type DocumentData = ();
+    type PageData = D;
+
+    fn document_open(_doc: DocumentRef<'_>) -> Result<DocumentInfo<Self>, PluginError> {
+        Ok(DocumentInfo {
+            page_count: PAGE_COUNT.load(Ordering::Relaxed),
+            plugin_data: (),
+        })
+    }
+
+    fn page_init(_page: PageRef<'_>, _doc_data: &mut ()) -> Result<PageInfo<Self>, PluginError> {
+        Ok(PageInfo {
+            width: 595.0,
+            height: 842.0,
+            plugin_data: D::default(),
+        })
+    }
+
+    fn page_render(
+        _page: PageRef<'_>,
+        _doc_data: &mut (),
+        _page_data: &mut D,
+        _cairo: &mut cairo::Context,
+        _printing: bool,
+    ) -> Result<(), PluginError> {
+        Ok(())
+    }
+}
+
+/// Durations measured for one kind of operation.
+#[derive(Debug, Clone, Default)]
+pub struct Samples {
+    durations: Vec<Duration>,
+}
+
+impl Samples {
+    pub fn new() -> Self {
+        Self::default()
+    }
+
+    pub fn push(&mut self, duration: Duration) {
+        self.durations.push(duration);
+    }
+
+    pub fn len(&self) -> usize {
+        self.durations.len()
+    }
+
+    /// Returns the `p`th percentile (`0.0..=1.0`), using the nearest-rank
+    /// method.
+    pub fn percentile(&self, p: f64) -> Duration {
+        let mut sorted = self.durations.clone();
+        sorted.sort();
+        if sorted.is_empty() {
+            return Duration::default();
+        }
+        let rank = (p * sorted.len() as f64).ceil() as usize;
+        sorted[rank.max(1) - 1]
+    }
+
+    /// Returns the median in nanoseconds.
+    pub fn median(&self) -> f64 {
+        let ns: Vec<f64> = self.durations.iter().map(|d| d.as_nanos() as f64).collect();
+        median(ns)
+    }
+
+    /// Returns the median absolute deviation from the median in nanoseconds.
+    pub fn mad(&self) -> f64 {
+        let median = self.median();
+        let deviations = self
+            .durations
+            .iter()
+            .map(|d| (d.as_nanos() as f64 - median).abs())
+            .collect();
+        self::median(deviations)
+    }
+}
+
+fn median(mut values: Vec<f64>) -> f64 {
+    if values.is_empty() {
+        return 0.0;
+    }
+    values.sort_by(|a, b| a.partial_cmp(b).unwrap());
+    let mid = values.len() / 2;
+    if values.len() % 2 == 0 {
+        (values[mid - 1] + values[mid]) / 2.0
+    } else {
+        values[mid]
+    }
+}
+
+/// Returns the peak resident set size of this process in bytes.
+///
+/// Only supported on Linux; returns `None` elsewhere.
+pub fn peak_rss() -> Option<u64> {
+    let status = fs::read_to_string("/proc/self/status").ok()?;
+    let line = status.lines().find(|line| line.starts_with("VmHWM:"))?;
+    let kib: u64 = line.split_whitespace().nth(1)?.parse().ok()?;
+    Some(kib * 1024)
+}
+
+/// Returns the command line arguments meant for the benchmark.
+///
+/// `cargo bench` passes `--bench` to every benchmark, which is dropped here.
+pub fn args() -> Vec<String> {
+    std::env::args()
+        .skip(1)
+        .filter(|arg| arg != "--bench")
+        .collect()
+}
@@ -0,0 +1,13 @@
+//! A caching proxy in front of Zathura's Poppler-based PDF plugin.
+//!
+//! Build with `cargo build --release --example caching_proxy`, then install
+//! `target/release/examples/libcaching_proxy.so` in Zathura's plugin directory
+//! *instead of* `libpdf-poppler.so`, and move the latter to the path below.
+//!
+//! Any other plugin can be proxied by changing the path and MIME types.
+
+zathura_plugin::proxy_entry!(
+    "PDF (cached)",
+    "/usr/lib/zathura-backends/libpdf-poppler.so",
+    ["application/pdf"]
+);
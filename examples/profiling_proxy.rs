@@ -0,0 +1,15 @@
+//! A profiling proxy in front of Zathura's Poppler-based PDF plugin.
+//!
+//! Build with `cargo build --release --example profiling_proxy`, then install
+//! `target/release/examples/libprofiling_proxy.so` in Zathura's plugin
+//! directory *instead of* `libpdf-poppler.so`, and move the latter to the path
+//! below. Run Zathura with `ZATHURA_PLUGIN_PROFILE=/tmp/profile-%p.txt` to
+//! collect the reports in a file instead of on stderr.
+//!
+//! Any other plugin can be profiled by changing the path and MIME types.
+
+zathura_plugin::profiling_proxy_entry!(
+    "PDF (profiled)",
+    "/usr/lib/zathura-backends/libpdf-poppler.so",
+    ["application/pdf"]
+);
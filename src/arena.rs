@@ -0,0 +1,493 @@
+//! Bump allocation of data that lives as long as a document.
+//!
+//! Document parsers often create millions of small objects that are all freed
+//! together when the document is closed. Allocating them from an arena is
+//! faster than allocating each one from the heap, keeps objects created
+//! together close together in memory, and frees them all at once.
+//!
+//! Every document opened through `plugin_entry!` has a [`SyncArena`], which
+//! can be accessed from all callbacks via `DocumentRef::arena` and
+//! `PageRef::arena`. These are unsafe, since they can't check that a document
+//! was opened through the wrapper, which is always the case for documents
+//! passed to callbacks. The arena is created before `ZathuraPlugin::document_open` is
+//! called, and freed in one go after the `DocumentData` was dropped when the
+//! document is freed. An arena doesn't allocate any memory until it is first
+//! used.
+//!
+//! Allocating returns an [`ArenaRef`], a copyable handle that can be stored in
+//! `DocumentData`, `PageData` or other arena values, and that is resolved to
+//! a reference by the arena it came from. Handles remember their arena, so
+//! resolving one with a different arena (eg. one of another document) panics
+//! instead of accessing memory that may already have been freed.
+//!
+//! ```
+//! use zathura_plugin::arena::{ArenaRef, SyncArena};
+//!
+//! #[derive(Copy, Clone)]
+//! struct Node {
+//!     name: ArenaRef<str>,
+//!     children: ArenaRef<[ArenaRef<Node>]>,
+//! }
+//!
+//! let arena = SyncArena::new();
+//! let leaf = arena.alloc(Node {
+//!     name: arena.alloc_str("leaf"),
+//!     children: arena.alloc_slice(&[]),
+//! });
+//! let root = arena.alloc(Node {
+//!     name: arena.alloc_str("root"),
+//!     children: arena.alloc_slice(&[leaf]),
+//! });
+//!
+//! let root = arena.get(root);
+//! let child = arena.get(arena.get(root.children)[0]);
+//! assert_eq!(arena.get(child.name), "leaf");
+//! ```
+//!
+//! Values in an arena are never dropped, so types that need to be dropped
+//! (like `String`, `Vec` or `Box`) can't be allocated in one; `alloc` panics
+//! for them. Text and arrays can be stored with `alloc_str` and
+//! `alloc_slice` instead.
+//!
+//! [`Arena`] is a variant that can only be used by one thread at a time, for
+//! scratch data that doesn't need to be shared, like per-thread parser state.
+//! Allocating from it is a few instructions cheaper than from a `SyncArena`,
+//! which bumps an atomic pointer.
+//!
+//! [`SyncArena`]: struct.SyncArena.html
+//! [`Arena`]: struct.Arena.html
+//! [`ArenaRef`]: struct.ArenaRef.html
+
+use std::{
+    alloc::{self, Layout},
+    cell::{Cell, Ref, RefCell},
+    fmt, mem,
+    ptr::{self, NonNull},
+    slice,
+    sync::{
+        atomic::{AtomicU64, AtomicUsize, Ordering},
+        Mutex, MutexGuard, PoisonError,
+    },
+};
+
+/// Size of the first chunk of an arena. Every further chunk is twice as large
+/// as the previous one, up to `MAX_CHUNK`.
+const FIRST_CHUNK: usize = 16 << 10;
+const MAX_CHUNK: usize = 4 << 20;
+
+/// Values larger than this get a chunk of their own.
+const LARGE: usize = MAX_CHUNK / 4;
+
+/// Alignment of all chunks.
+const CHUNK_ALIGN: usize = 16;
+
+static NEXT_ID: AtomicU64 = AtomicU64::new(1);
+
+fn next_id() -> u64 {
+    NEXT_ID.fetch_add(1, Ordering::Relaxed)
+}
+
+/// The memory owned by an arena.
+struct Chunks {
+    chunks: Vec<(NonNull<u8>, Layout)>,
+    next_size: usize,
+    bytes: usize,
+}
+
+// The chunks are plain memory owned by the arena.
+unsafe impl Send for Chunks {}
+
+impl Chunks {
+    const fn new() -> Self {
+        Self {
+            chunks: Vec::new(),
+            next_size: FIRST_CHUNK,
+            bytes: 0,
+        }
+    }
+
+    fn allocate(&mut self, size: usize) -> *mut u8 {
+        let layout = Layout::from_size_align(size, CHUNK_ALIGN).expect("arena chunk too large");
+        let ptr = match NonNull::new(unsafe { alloc::alloc(layout) }) {
+            Some(ptr) => ptr,
+            None => alloc::handle_alloc_error(layout),
+        };
+        self.chunks.push((ptr, layout));
+        self.bytes += size;
+        ptr.as_ptr()
+    }
+
+    /// Allocates a chunk holding only `layout`.
+    fn dedicated(&mut self, layout: Layout) -> *mut u8 {
+        let size = layout.size() + layout.align().saturating_sub(CHUNK_ALIGN);
+        align_up(self.allocate(size) as usize, layout.align()) as *mut u8
+    }
+
+    /// Allocates the next chunk, which has room for at least `layout`, and
+    /// returns its start and end address.
+    fn grow(&mut self, layout: Layout) -> (usize, usize) {
+        let size = self.next_size.max(layout.size() + layout.align());
+        self.next_size = (self.next_size * 2).min(MAX_CHUNK);
+        let start = self.allocate(size) as usize;
+        (start, start + size)
+    }
+}
+
+impl Drop for Chunks {
+    fn drop(&mut self) {
+        for &(ptr, layout) in &self.chunks {
+            unsafe { alloc::dealloc(ptr.as_ptr(), layout) }
+        }
+    }
+}
+
+fn align_up(address: usize, align: usize) -> usize {
+    (address + align - 1) & !(align - 1)
+}
+
+/// Places `layout` at `cursor` if it fits before `end`, returning its address
+/// and the new cursor.
+fn bump(cursor: usize, end: usize, layout: Layout) -> Option<(usize, usize)> {
+    let start = align_up(cursor, layout.align());
+    let next = start.checked_add(layout.size())?;
+    if next <= end && cursor != 0 {
+        Some((start, next))
+    } else {
+        None
+    }
+}
+
+/// A handle to a value allocated in an [`Arena`] or [`SyncArena`].
+///
+/// Handles are resolved with the `get` method of the arena they were
+/// allocated from, and can be freely copied and stored.
+///
+/// [`Arena`]: struct.Arena.html
+/// [`SyncArena`]: struct.SyncArena.html
+pub struct ArenaRef<T: ?Sized> {
+    ptr: NonNull<T>,
+    arena: u64,
+}
+
+// A handle is like a shared reference to the value.
+unsafe impl<T: ?Sized + Sync> Send for ArenaRef<T> {}
+unsafe impl<T: ?Sized + Sync> Sync for ArenaRef<T> {}
+
+impl<T: ?Sized> Clone for ArenaRef<T> {
+    fn clone(&self) -> Self {
+        *self
+    }
+}
+
+impl<T: ?Sized> Copy for ArenaRef<T> {}
+
+impl<T: ?Sized> fmt::Debug for ArenaRef<T> {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        f.debug_struct("ArenaRef")
+            .field("ptr", &self.ptr.cast::<u8>())
+            .field("arena", &self.arena)
+            .finish()
+    }
+}
+
+/// Defines the allocation methods shared by `Arena` and `SyncArena`, which
+/// differ in the bounds on the allocated types.
+macro_rules! arena_methods {
+    ($($bound:tt)+) => {
+        /// Moves `value` into the arena.
+        ///
+        /// # Panics
+        ///
+        /// Panics if `T` needs to be dropped, since values in an arena are
+        /// never dropped.
+        pub fn alloc<T: $($bound)+ + 'static>(&self, value: T) -> ArenaRef<T> {
+            assert!(
+                !mem::needs_drop::<T>(),
+                "values that need to be dropped can't be allocated in an arena"
+            );
+            let ptr = self.alloc_raw(Layout::new::<T>()) as *mut T;
+            unsafe {
+                ptr::write(ptr, value);
+                self.handle(ptr)
+            }
+        }
+
+        /// Copies `values` into the arena.
+        pub fn alloc_slice<T: Copy + $($bound)+ + 'static>(
+            &self,
+            values: &[T],
+        ) -> ArenaRef<[T]> {
+            let ptr = self.alloc_raw(Layout::for_value(values)) as *mut T;
+            unsafe {
+                ptr::copy_nonoverlapping(values.as_ptr(), ptr, values.len());
+                self.handle(slice::from_raw_parts_mut(ptr, values.len()))
+            }
+        }
+
+        /// Copies `text` into the arena.
+        pub fn alloc_str(&self, text: &str) -> ArenaRef<str> {
+            let bytes = self.alloc_slice(text.as_bytes());
+            ArenaRef {
+                ptr: unsafe { NonNull::new_unchecked(bytes.ptr.as_ptr() as *mut str) },
+                arena: bytes.arena,
+            }
+        }
+
+        /// Returns the value `handle` refers to.
+        ///
+        /// # Panics
+        ///
+        /// Panics if `handle` was allocated from a different arena.
+        pub fn get<'a, T: ?Sized>(&'a self, handle: ArenaRef<T>) -> &'a T {
+            assert_eq!(
+                handle.arena, self.id,
+                "`ArenaRef` used with a different arena"
+            );
+            // The value lives as long as the arena, which outlives `'a`.
+            unsafe { &*handle.ptr.as_ptr() }
+        }
+
+        /// Returns the number of bytes of memory the arena has allocated.
+        pub fn allocated_bytes(&self) -> usize {
+            self.chunks().bytes
+        }
+
+        unsafe fn handle<T: ?Sized>(&self, ptr: *mut T) -> ArenaRef<T> {
+            ArenaRef {
+                ptr: NonNull::new_unchecked(ptr),
+                arena: self.id,
+            }
+        }
+    };
+}
+
+/// An arena for use by a single thread at a time.
+///
+/// See the [module documentation](index.html) for details.
+pub struct Arena {
+    id: u64,
+    cursor: Cell<usize>,
+    end: Cell<usize>,
+    chunks: RefCell<Chunks>,
+}
+
+impl Arena {
+    /// Creates an empty arena, without allocating any memory.
+    pub fn new() -> Self {
+        Self {
+            id: next_id(),
+            cursor: Cell::new(0),
+            end: Cell::new(0),
+            chunks: RefCell::new(Chunks::new()),
+        }
+    }
+
+    arena_methods!(Send);
+
+    fn chunks(&self) -> Ref<'_, Chunks> {
+        self.chunks.borrow()
+    }
+
+    fn alloc_raw(&self, layout: Layout) -> *mut u8 {
+        if layout.size() == 0 {
+            return layout.align() as *mut u8;
+        }
+        if let Some((start, next)) = bump(self.cursor.get(), self.end.get(), layout) {
+            self.cursor.set(next);
+            return start as *mut u8;
+        }
+
+        let mut chunks = self.chunks.borrow_mut();
+        if layout.size() > LARGE {
+            return chunks.dedicated(layout);
+        }
+        let (start, end) = chunks.grow(layout);
+        let (start, next) = bump(start, end, layout).unwrap();
+        self.cursor.set(next);
+        self.end.set(end);
+        start as *mut u8
+    }
+}
+
+impl Default for Arena {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+impl fmt::Debug for Arena {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        f.debug_struct("Arena")
+            .field("id", &self.id)
+            .field("allocated_bytes", &self.allocated_bytes())
+            .finish()
+    }
+}
+
+/// An arena that can be allocated from by several threads at once.
+///
+/// Allocation bumps an atomic pointer into the current chunk, and only takes
+/// a lock when a new chunk is needed. See the
+/// [module documentation](index.html) for details.
+pub struct SyncArena {
+    id: u64,
+    /// Address of the next free byte in the current chunk, or 0.
+    cursor: AtomicUsize,
+    /// End address of the current chunk, or 0 while it is being replaced.
+    end: AtomicUsize,
+    chunks: Mutex<Chunks>,
+}
+
+impl SyncArena {
+    /// Creates an empty arena, without allocating any memory.
+    pub fn new() -> Self {
+        Self {
+            id: next_id(),
+            cursor: AtomicUsize::new(0),
+            end: AtomicUsize::new(0),
+            chunks: Mutex::new(Chunks::new()),
+        }
+    }
+
+    arena_methods!(Send + Sync);
+
+    fn chunks(&self) -> MutexGuard<'_, Chunks> {
+        self.chunks.lock().unwrap_or_else(PoisonError::into_inner)
+    }
+
+    /// Bumps the cursor of the current chunk, if `layout` fits into it.
+    fn try_bump(&self, layout: Layout) -> Option<*mut u8> {
+        loop {
+            // Chunks are never freed before the arena, and the cursor only
+            // ever moves forward within a chunk, so a successful exchange
+            // means that `cursor` and `end` belonged to the same chunk.
+            let cursor = self.cursor.load(Ordering::SeqCst);
+            let end = self.end.load(Ordering::SeqCst);
+            let (start, next) = bump(cursor, end, layout)?;
+            let exchanged = self.cursor.compare_exchange_weak(
+                cursor,
+                next,
+                Ordering::SeqCst,
+                Ordering::Relaxed,
+            );
+            if exchanged.is_ok() {
+                return Some(start as *mut u8);
+            }
+        }
+    }
+
+    fn alloc_raw(&self, layout: Layout) -> *mut u8 {
+        if layout.size() == 0 {
+            return layout.align() as *mut u8;
+        }
+        if let Some(ptr) = self.try_bump(layout) {
+            return ptr;
+        }
+
+        let mut chunks = self.chunks();
+        if layout.size() > LARGE {
+            return chunks.dedicated(layout);
+        }
+        // Another thread may have replaced the chunk while this one waited.
+        if let Some(ptr) = self.try_bump(layout) {
+            return ptr;
+        }
+        let (start, end) = chunks.grow(layout);
+        let (start, next) = bump(start, end, layout).unwrap();
+        // Closing the old chunk first makes sure no thread pairs the new
+        // cursor with the old end.
+        self.end.store(0, Ordering::SeqCst);
+        self.cursor.store(next, Ordering::SeqCst);
+        self.end.store(end, Ordering::SeqCst);
+        start as *mut u8
+    }
+}
+
+impl Default for SyncArena {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+impl fmt::Debug for SyncArena {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        f.debug_struct("SyncArena")
+            .field("id", &self.id)
+            .field("allocated_bytes", &self.allocated_bytes())
+            .finish()
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use std::thread;
+
+    const THREADS: usize = 8;
+    const VALUES: usize = 20_000;
+
+    /// The value thread `thread` stores as its `i`th value.
+    fn value(thread: usize, i: usize) -> u64 {
+        (thread as u64) << 32 | i as u64
+    }
+
+    #[test]
+    fn sync_arena_allocations_are_disjoint() {
+        let arena = SyncArena::new();
+        let handles = thread::scope(|scope| {
+            let threads: Vec<_> = (0..THREADS)
+                .map(|thread| {
+                    let arena = &arena;
+                    scope.spawn(move || {
+                        // Mixed sizes and alignments, and the odd value that
+                        // gets a chunk of its own.
+                        (0..VALUES)
+                            .map(|i| {
+                                let single = arena.alloc(value(thread, i));
+                                let bytes = match i % 5000 {
+                                    4999 => LARGE + 1,
+                                    n => n % 23,
+                                };
+                                let slice = arena.alloc_slice(&vec![i as u8; bytes]);
+                                (single, slice)
+                            })
+                            .collect::<Vec<_>>()
+                    })
+                })
+                .collect();
+            threads
+                .into_iter()
+                .map(|thread| thread.join().unwrap())
+                .collect::<Vec<_>>()
+        });
+        // Besides the 4 dedicated chunks per thread, the values filled several
+        // regular chunks.
+        assert!(arena.chunks().chunks.len() > THREADS * 4 + 4);
+
+        let mut ranges = Vec::new();
+        for (thread, handles) in handles.iter().enumerate() {
+            for (i, &(single, slice)) in handles.iter().enumerate() {
+                assert_eq!(*arena.get(single), value(thread, i));
+                let slice = arena.get(slice);
+                assert!(slice.iter().all(|&byte| byte == i as u8));
+
+                let single = arena.get(single) as *const u64 as usize;
+                assert_eq!(single % mem::align_of::<u64>(), 0);
+                ranges.push((single, single + mem::size_of::<u64>()));
+                if !slice.is_empty() {
+                    let start = slice.as_ptr() as usize;
+                    ranges.push((start, start + slice.len()));
+                }
+            }
+        }
+        ranges.sort_unstable();
+        for pair in ranges.windows(2) {
+            assert!(
+                pair[0].1 <= pair[1].0,
+                "{:x?} overlaps {:x?}",
+                pair[0],
+                pair[1]
+            );
+        }
+    }
+}
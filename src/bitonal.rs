@@ -0,0 +1,319 @@
+//! Scaling of 1-bit images directly to antialiased gray.
+//!
+//! Scanned documents (eg. CCITT fax images) are usually bitonal and are
+//! almost always displayed scaled down. Expanding them to 8-bit gray or ARGB
+//! before scaling touches 8 to 32 times as much memory as necessary. Instead,
+//! [`scale`] computes each output pixel's coverage by counting the set bits
+//! in the corresponding block of the source bitmap, a byte (or word) at a
+//! time.
+//!
+//! [`scale`]: fn.scale.html
+
+use {
+    crate::PluginError,
+    cairo::{Format, ImageSurface},
+};
+
+/// A packed 1-bit image.
+///
+/// Rows start on byte boundaries, and the most significant bit of each byte
+/// is the leftmost pixel (as in PBM, CCITT and PDF image data).
+#[derive(Debug, Copy, Clone)]
+pub struct Bitmap<'a> {
+    /// The packed pixel data.
+    pub data: &'a [u8],
+    /// Width in pixels.
+    pub width: usize,
+    /// Height in pixels.
+    pub height: usize,
+    /// Offset between the start of two rows in bytes.
+    pub stride: usize,
+    /// Whether set bits are black (ink) and cleared bits white. PDF's
+    /// `CCITTFaxDecode` defaults to `false`, PBM uses `true`.
+    pub black_is_one: bool,
+}
+
+impl Bitmap<'_> {
+    /// Counts the set bits in the bit range `start..end` of row `y`.
+    fn count_ones(&self, y: usize, start: usize, end: usize) -> u32 {
+        let row = &self.data[y * self.stride..];
+        let (first, last) = (start / 8, (end - 1) / 8);
+        let head_mask = 0xFFu8 >> (start % 8);
+        let tail_mask = 0xFFu8 << (7 - (end - 1) % 8);
+        if first == last {
+            return (row[first] & head_mask & tail_mask).count_ones();
+        }
+
+        let mut count =
+            (row[first] & head_mask).count_ones() + (row[last] & tail_mask).count_ones();
+        let mut middle = &row[first + 1..last];
+        while middle.len() >= 8 {
+            let mut word = [0; 8];
+            word.copy_from_slice(&middle[..8]);
+            count += u64::from_ne_bytes(word).count_ones();
+            middle = &middle[8..];
+        }
+        for byte in middle {
+            count += byte.count_ones();
+        }
+        count
+    }
+}
+
+/// Returns the source range covered by each of `dst_len` output pixels.
+///
+/// Every output pixel covers at least one source pixel, so enlarging an image
+/// replicates pixels.
+fn edges(src_len: usize, dst_len: usize) -> Vec<(usize, usize)> {
+    (0..dst_len)
+        .map(|i| {
+            let start = (i * src_len / dst_len).min(src_len - 1);
+            let end = ((i + 1) * src_len / dst_len).max(start + 1);
+            (start, end)
+        })
+        .collect()
+}
+
+/// Scales `bitmap` to `width` x `height` pixels of ink coverage.
+///
+/// Each output byte in `dst` is the fraction of black pixels in the
+/// corresponding area of the bitmap, from 0 (white) to 255 (black). `stride`
+/// is the offset between two rows of `dst` in bytes.
+///
+/// # Panics
+///
+/// Panics if `bitmap.data` or `dst` is too small for the given dimensions.
+pub fn scale(bitmap: &Bitmap<'_>, dst: &mut [u8], stride: usize, width: usize, height: usize) {
+    if bitmap.width == 0 || bitmap.height == 0 || width == 0 || height == 0 {
+        return;
+    }
+    assert!(bitmap.stride * 8 >= bitmap.width);
+    assert!(bitmap.data.len() >= (bitmap.height - 1) * bitmap.stride + (bitmap.width + 7) / 8);
+    assert!(stride >= width && dst.len() >= (height - 1) * stride + width);
+
+    let columns = edges(bitmap.width, width);
+    let mut counts = vec![0u32; width];
+    for (row, &(y0, y1)) in dst.chunks_mut(stride).zip(&edges(bitmap.height, height)) {
+        for count in &mut counts {
+            *count = 0;
+        }
+        for y in y0..y1 {
+            for (count, &(x0, x1)) in counts.iter_mut().zip(&columns) {
+                *count += bitmap.count_ones(y, x0, x1);
+            }
+        }
+
+        for ((out, &count), &(x0, x1)) in row.iter_mut().zip(&counts).zip(&columns) {
+            let area = ((x1 - x0) * (y1 - y0)) as u32;
+            let ink = if bitmap.black_is_one {
+                count
+            } else {
+                area - count
+            };
+            *out = ((ink * 255 + area / 2) / area) as u8;
+        }
+    }
+}
+
+/// Turns the ink coverage bytes at the start of each row of `data` into
+/// opaque gray 32-bit pixels, with white paper and black ink.
+///
+/// Rows are expanded in place from the right, so that no coverage byte is
+/// overwritten before it has been read.
+fn expand_to_gray(data: &mut [u8], stride: usize, width: usize, height: usize) {
+    for row in data.chunks_mut(stride).take(height) {
+        for x in (0..width).rev() {
+            let gray = u32::from(255 - row[x]);
+            let pixel = 0xFF00_0000 | gray << 16 | gray << 8 | gray;
+            row[x * 4..x * 4 + 4].copy_from_slice(&pixel.to_ne_bytes());
+        }
+    }
+}
+
+/// Scales `bitmap` into the top left `width` x `height` pixels of `dst`.
+///
+/// For an `A8` surface, the output is ink coverage, suitable as a mask for
+/// drawing the page's ink color. For an `ARgb32` or `Rgb24` surface, the
+/// output is opaque gray, with white paper and black ink. Other formats fail
+/// with `PluginError::InvalidArguments`, as does a surface smaller than the
+/// requested size or one whose data is still in use.
+pub fn scale_to_surface(
+    bitmap: &Bitmap<'_>,
+    dst: &mut ImageSurface,
+    width: i32,
+    height: i32,
+) -> Result<(), PluginError> {
+    if width < 0 || height < 0 || width > dst.get_width() || height > dst.get_height() {
+        return Err(PluginError::InvalidArguments);
+    }
+
+    let format = dst.get_format();
+    let stride = dst.get_stride() as usize;
+    let (width, height) = (width as usize, height as usize);
+    dst.flush();
+    {
+        let mut data = dst.get_data().map_err(|_| PluginError::InvalidArguments)?;
+        match format {
+            Format::A8 => scale(bitmap, &mut data, stride, width, height),
+            Format::ARgb32 | Format::Rgb24 => {
+                scale(bitmap, &mut data, stride, width, height);
+                expand_to_gray(&mut data, stride, width, height);
+            }
+            _ => return Err(PluginError::InvalidArguments),
+        }
+    }
+    dst.mark_dirty();
+    Ok(())
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    /// Builds a bitmap with `stride` bytes per row from a predicate, setting
+    /// all padding bits after `width` to garbage.
+    fn pack(
+        width: usize,
+        height: usize,
+        stride: usize,
+        set: impl Fn(usize, usize) -> bool,
+    ) -> Vec<u8> {
+        let mut data = vec![0xA5; stride * height];
+        for y in 0..height {
+            for x in 0..stride * 8 {
+                let bit = if x < width {
+                    set(x, y)
+                } else {
+                    (x + y) % 3 == 0
+                };
+                let byte = &mut data[y * stride + x / 8];
+                if bit {
+                    *byte |= 0x80 >> (x % 8);
+                } else {
+                    *byte &= !(0x80 >> (x % 8));
+                }
+            }
+        }
+        data
+    }
+
+    fn pattern(x: usize, y: usize) -> bool {
+        (x * 7 + y * 13) % 5 < 2
+    }
+
+    /// Scales by looking at every source pixel individually.
+    fn naive(bitmap: &Bitmap<'_>, width: usize, height: usize) -> Vec<u8> {
+        let bit = |x: usize, y: usize| bitmap.data[y * bitmap.stride + x / 8] >> (7 - x % 8) & 1;
+        let (columns, rows) = (edges(bitmap.width, width), edges(bitmap.height, height));
+        let mut out = Vec::new();
+        for &(y0, y1) in &rows {
+            for &(x0, x1) in &columns {
+                let mut ink = 0;
+                for y in y0..y1 {
+                    for x in x0..x1 {
+                        ink += u32::from(bit(x, y) == bitmap.black_is_one as u8);
+                    }
+                }
+                let area = ((x1 - x0) * (y1 - y0)) as u32;
+                out.push(((ink * 255 + area / 2) / area) as u8);
+            }
+        }
+        out
+    }
+
+    #[test]
+    fn count_ones_ignores_padding() {
+        // Widths around byte and word boundaries, with padded strides.
+        for &(width, stride) in &[
+            (1, 1),
+            (7, 2),
+            (8, 1),
+            (9, 2),
+            (63, 8),
+            (64, 9),
+            (70, 12),
+            (131, 17),
+        ] {
+            let data = pack(width, 2, stride, pattern);
+            let bitmap = Bitmap {
+                data: &data,
+                width,
+                height: 2,
+                stride,
+                black_is_one: true,
+            };
+            for start in 0..width {
+                for end in start + 1..=width {
+                    let expected = (start..end).filter(|&x| pattern(x, 1)).count() as u32;
+                    assert_eq!(
+                        bitmap.count_ones(1, start, end),
+                        expected,
+                        "{}..{} of {}",
+                        start,
+                        end,
+                        width
+                    );
+                }
+            }
+        }
+    }
+
+    #[test]
+    fn scale_matches_naive() {
+        let (width, height, stride) = (203, 37, 29);
+        let data = pack(width, height, stride, pattern);
+        for &black_is_one in &[true, false] {
+            let bitmap = Bitmap {
+                data: &data,
+                width,
+                height,
+                stride,
+                black_is_one,
+            };
+            // Downscaling, upscaling and uneven ratios.
+            for &(dst_width, dst_height) in &[(203, 37), (50, 9), (17, 5), (1, 1), (406, 40)] {
+                let dst_stride = dst_width + 3;
+                let mut dst = vec![0; dst_stride * dst_height];
+                scale(&bitmap, &mut dst, dst_stride, dst_width, dst_height);
+                let expected = naive(&bitmap, dst_width, dst_height);
+                for y in 0..dst_height {
+                    assert_eq!(
+                        &dst[y * dst_stride..][..dst_width],
+                        &expected[y * dst_width..][..dst_width],
+                        "row {} at {}x{}",
+                        y,
+                        dst_width,
+                        dst_height
+                    );
+                }
+            }
+        }
+    }
+
+    #[test]
+    fn expands_in_place() {
+        // Rows are exactly as wide as the pixels, so the last pixel of a row
+        // ends at the row's last byte.
+        let (width, height) = (5, 3);
+        let stride = width * 4;
+        let mut data = vec![0xEE; stride * height];
+        for y in 0..height {
+            for x in 0..width {
+                data[y * stride + x] = (y * width + x) as u8 * 17;
+            }
+        }
+        expand_to_gray(&mut data, stride, width, height);
+        for y in 0..height {
+            for x in 0..width {
+                let gray = 255 - (y * width + x) as u32 * 17;
+                let pixel = u32::from_ne_bytes([
+                    data[y * stride + x * 4],
+                    data[y * stride + x * 4 + 1],
+                    data[y * stride + x * 4 + 2],
+                    data[y * stride + x * 4 + 3],
+                ]);
+                assert_eq!(pixel, 0xFF00_0000 | gray << 16 | gray << 8 | gray);
+            }
+        }
+    }
+}
@@ -0,0 +1,294 @@
+//! Combination of several plugins into one.
+//!
+//! Zathura looks up a single plugin definition per shared library, so a crate
+//! can't export several independent plugins. Instead, `plugin_entry!` can
+//! combine several plugin types into a [`Chain`], which registers the union of
+//! their MIME types and hands each document to the first plugin that accepts
+//! it and manages to open it. A plugin accepts a document unless its format
+//! is one that only other plugins are listed with (see [`Filtered`]), and if
+//! its `ZathuraPlugin::probe` agrees. All plugins in the
+//! chain live in the same library, so they share its global infrastructure
+//! (thread pool, caches, allocator) instead of each loading their own copy.
+//!
+//! [`Chain`]: struct.Chain.html
+//! [`Filtered`]: struct.Filtered.html
+
+use {
+    crate::{
+        sys::zathura_rectangle_t, DocumentInfo, DocumentRef, FileHeader, PageInfo, PageRef,
+        PluginError, ZathuraPlugin,
+    },
+    std::{fmt, marker::PhantomData},
+};
+
+/// A plugin that dispatches to either `A` or `B`.
+///
+/// Documents are offered to `A` first. If `A::probe` rejects the document's
+/// header, or `A` fails to open the document, it is offered to `B` instead
+/// (if `B::probe` accepts it). If both plugins fail, the error of `A` is
+/// returned, since it is the one that was offered the document first. Longer
+/// chains are built by nesting, which is done automatically by
+/// `plugin_entry!`.
+pub struct Chain<A, B> {
+    _p: PhantomData<(A, B)>,
+}
+
+impl<A, B> fmt::Debug for Chain<A, B> {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        f.write_str("Chain")
+    }
+}
+
+/// Plugin data belonging to either the first or the second plugin of a
+/// [`Chain`].
+///
+/// [`Chain`]: struct.Chain.html
+#[derive(Debug)]
+pub enum Either<L, R> {
+    Left(L),
+    Right(R),
+}
+
+impl<A: ZathuraPlugin, B: ZathuraPlugin> ZathuraPlugin for Chain<A, B> {
+    type DocumentData = Either<A::DocumentData, B::DocumentData>;
+    type PageData = Either<A::PageData, B::PageData>;
+
+    fn probe(header: &FileHeader) -> bool {
+        A::probe(header) || B::probe(header)
+    }
+
+    fn document_open(mut doc: DocumentRef<'_>) -> Result<DocumentInfo<Self>, PluginError> {
+        // If the header can't be read, let the plugins try to open the
+        // document anyways and report the error themselves.
+        let header = doc.file_header().ok();
+        let accepts = |probe: fn(&FileHeader) -> bool| header.as_ref().map_or(true, probe);
+
+        let error_a = if accepts(A::probe) {
+            match A::document_open(doc.reborrow()) {
+                Ok(info) => {
+                    return Ok(DocumentInfo {
+                        page_count: info.page_count,
+                        plugin_data: Either::Left(info.plugin_data),
+                    })
+                }
+                // `A` recognized the document, but it is encrypted. Let Zathura
+                // ask for the password instead of trying other plugins.
+                Err(PluginError::InvalidPassword) => return Err(PluginError::InvalidPassword),
+                Err(e) => Some(e),
+            }
+        } else {
+            None
+        };
+
+        let result_b = if accepts(B::probe) {
+            B::document_open(doc)
+        } else {
+            Err(PluginError::NotImplemented)
+        };
+        match result_b {
+            Ok(info) => Ok(DocumentInfo {
+                page_count: info.page_count,
+                plugin_data: Either::Right(info.plugin_data),
+            }),
+            Err(e) => Err(error_a.unwrap_or(e)),
+        }
+    }
+
+    fn document_free(
+        doc: DocumentRef<'_>,
+        doc_data: &mut Self::DocumentData,
+    ) -> Result<(), PluginError> {
+        match doc_data {
+            Either::Left(data) => A::document_free(doc, data),
+            Either::Right(data) => B::document_free(doc, data),
+        }
+    }
+
+    fn page_init(
+        page: PageRef<'_>,
+        doc_data: &mut Self::DocumentData,
+    ) -> Result<PageInfo<Self>, PluginError> {
+        Ok(match doc_data {
+            Either::Left(data) => {
+                let info = A::page_init(page, data)?;
+                PageInfo {
+                    width: info.width,
+                    height: info.height,
+                    plugin_data: Either::Left(info.plugin_data),
+                }
+            }
+            Either::Right(data) => {
+                let info = B::page_init(page, data)?;
+                PageInfo {
+                    width: info.width,
+                    height: info.height,
+                    plugin_data: Either::Right(info.plugin_data),
+                }
+            }
+        })
+    }
+
+    fn page_free(
+        page: PageRef<'_>,
+        doc_data: &mut Self::DocumentData,
+        page_data: &mut Self::PageData,
+    ) -> Result<(), PluginError> {
+        match (doc_data, page_data) {
+            (Either::Left(doc_data), Either::Left(page_data)) => {
+                A::page_free(page, doc_data, page_data)
+            }
+            (Either::Right(doc_data), Either::Right(page_data)) => {
+                B::page_free(page, doc_data, page_data)
+            }
+            _ => unreachable!("page data belongs to a different plugin than its document"),
+        }
+    }
+
+    fn page_render(
+        page: PageRef<'_>,
+        doc_data: &mut Self::DocumentData,
+        page_data: &mut Self::PageData,
+        cairo: &mut cairo::Context,
+        printing: bool,
+    ) -> Result<(), PluginError> {
+        match (doc_data, page_data) {
+            (Either::Left(doc_data), Either::Left(page_data)) => {
+                A::page_render(page, doc_data, page_data, cairo, printing)
+            }
+            (Either::Right(doc_data), Either::Right(page_data)) => {
+                B::page_render(page, doc_data, page_data, cairo, printing)
+            }
+            _ => unreachable!("page data belongs to a different plugin than its document"),
+        }
+    }
+
+    const SEARCH_TEXT: bool = A::SEARCH_TEXT || B::SEARCH_TEXT;
+
+    fn page_search_text(
+        page: PageRef<'_>,
+        doc_data: &mut Self::DocumentData,
+        page_data: &mut Self::PageData,
+        text: &str,
+    ) -> Result<Vec<zathura_rectangle_t>, PluginError> {
+        match (doc_data, page_data) {
+            (Either::Left(doc_data), Either::Left(page_data)) => {
+                A::page_search_text(page, doc_data, page_data, text)
+            }
+            (Either::Right(doc_data), Either::Right(page_data)) => {
+                B::page_search_text(page, doc_data, page_data, text)
+            }
+            _ => unreachable!("page data belongs to a different plugin than its document"),
+        }
+    }
+}
+
+/// The MIME types a plugin of type `P` is listed with in `plugin_entry!`.
+///
+/// Implemented by `plugin_entry!` for a type of its own, once per listed
+/// plugin.
+pub trait MimeTypes<P> {
+    /// The MIME types listed for `P`.
+    const MIME_TYPES: &'static [&'static str];
+    /// The MIME types listed for all plugins of the library.
+    const LIBRARY_MIME_TYPES: &'static [&'static str];
+}
+
+/// A plugin `P` that leaves the documents listed for other plugins to them.
+///
+/// `plugin_entry!` wraps every plugin of a list in a `Filtered`, so that
+/// documents are offered to the plugin they were listed for. A document is
+/// rejected if the header identifies its format for certain, and that format
+/// is listed for another plugin of the library but not for `P`. Everything
+/// else is accepted if `P::probe` accepts it: formats that aren't listed at
+/// all (eg. because a plugin lists an alias like `application/x-gzip`),
+/// containers like ZIP (which CBZ and EPUB files are as well) and magic
+/// numbers that plain text may start with (like `BM` for BMP).
+pub struct Filtered<P, M> {
+    _p: PhantomData<(P, M)>,
+}
+
+impl<P, M> fmt::Debug for Filtered<P, M> {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        f.write_str("Filtered")
+    }
+}
+
+impl<P: ZathuraPlugin, M: MimeTypes<P>> ZathuraPlugin for Filtered<P, M> {
+    type DocumentData = P::DocumentData;
+    type PageData = P::PageData;
+
+    fn probe(header: &FileHeader) -> bool {
+        let for_others = header.conclusive_mime_type().map_or(false, |mime| {
+            !M::MIME_TYPES.contains(&mime) && M::LIBRARY_MIME_TYPES.contains(&mime)
+        });
+        !for_others && P::probe(header)
+    }
+
+    fn document_open(doc: DocumentRef<'_>) -> Result<DocumentInfo<Self>, PluginError> {
+        let info = P::document_open(doc)?;
+        Ok(DocumentInfo {
+            page_count: info.page_count,
+            plugin_data: info.plugin_data,
+        })
+    }
+
+    fn document_free(
+        doc: DocumentRef<'_>,
+        doc_data: &mut Self::DocumentData,
+    ) -> Result<(), PluginError> {
+        P::document_free(doc, doc_data)
+    }
+
+    fn page_init(
+        page: PageRef<'_>,
+        doc_data: &mut Self::DocumentData,
+    ) -> Result<PageInfo<Self>, PluginError> {
+        let info = P::page_init(page, doc_data)?;
+        Ok(PageInfo {
+            width: info.width,
+            height: info.height,
+            plugin_data: info.plugin_data,
+        })
+    }
+
+    fn page_free(
+        page: PageRef<'_>,
+        doc_data: &mut Self::DocumentData,
+        page_data: &mut Self::PageData,
+    ) -> Result<(), PluginError> {
+        P::page_free(page, doc_data, page_data)
+    }
+
+    fn page_render(
+        page: PageRef<'_>,
+        doc_data: &mut Self::DocumentData,
+        page_data: &mut Self::PageData,
+        cairo: &mut cairo::Context,
+        printing: bool,
+    ) -> Result<(), PluginError> {
+        P::page_render(page, doc_data, page_data, cairo, printing)
+    }
+
+    const SEARCH_TEXT: bool = P::SEARCH_TEXT;
+
+    fn page_search_text(
+        page: PageRef<'_>,
+        doc_data: &mut Self::DocumentData,
+        page_data: &mut Self::PageData,
+        text: &str,
+    ) -> Result<Vec<zathura_rectangle_t>, PluginError> {
+        P::page_search_text(page, doc_data, page_data, text)
+    }
+}
+
+/// Builds a nested `Chain` type from a list of plugin types.
+#[doc(hidden)]
+#[macro_export]
+macro_rules! __plugin_chain {
+    ($plugin_ty:ty) => {
+        $plugin_ty
+    };
+    ($plugin_ty:ty, $($rest:ty),+) => {
+        $crate::Chain<$plugin_ty, $crate::__plugin_chain!($($rest),+)>
+    };
+}
@@ -0,0 +1,557 @@
+//! Conversion of CMYK and Lab rasters to Cairo's RGB pixel format.
+//!
+//! Evaluating a color profile for every pixel of a raster is slow. Instead, a
+//! [`Transform`] samples the profile once on a regular grid (17 points per
+//! input channel) and converts pixels by tetrahedral interpolation in that
+//! lookup table, which only takes a few integer operations per pixel.
+//! Building the table is comparatively expensive, so [`transform`] caches
+//! the most recently used transforms for the whole process, shared by all
+//! documents using the same [`Profile`].
+//!
+//! Output pixels are in Cairo's `ARgb32` format (native-endian `0xAARRGGBB`,
+//! premultiplied alpha) in the sRGB color space.
+//!
+//! [`Transform`]: struct.Transform.html
+//! [`transform`]: fn.transform.html
+//! [`Profile`]: struct.Profile.html
+
+use std::{
+    fmt,
+    sync::{Arc, Mutex, OnceLock},
+};
+
+/// Number of grid points per input channel.
+const GRID: usize = 17;
+
+/// Color space of source pixels.
+#[derive(Debug, Copy, Clone, PartialEq, Eq, Hash)]
+pub enum ColorSpace {
+    /// 3 channels per pixel, eg. Lab or device RGB.
+    ThreeChannel,
+    /// 4 channels per pixel, eg. CMYK.
+    FourChannel,
+}
+
+impl ColorSpace {
+    /// Returns the number of bytes per source pixel.
+    pub fn channels(self) -> usize {
+        match self {
+            ColorSpace::ThreeChannel => 3,
+            ColorSpace::FourChannel => 4,
+        }
+    }
+}
+
+/// A conversion from a source color space to sRGB.
+///
+/// Profiles are identified by their `id`: two profiles with the same ID are
+/// assumed to perform the same conversion, and share a cached `Transform`.
+/// Plugins with embedded color profiles should derive the ID from the
+/// profile's contents (eg. by hashing it).
+#[derive(Clone)]
+pub struct Profile {
+    id: u64,
+    space: ColorSpace,
+    to_srgb: Arc<dyn Fn(&[f64]) -> [f64; 3] + Send + Sync>,
+}
+
+/// IDs of the built-in profiles. Custom profile IDs must not collide with
+/// these.
+const NAIVE_CMYK_ID: u64 = 0x7a61_7468_0000_0001;
+const LAB_D50_ID: u64 = 0x7a61_7468_0000_0002;
+
+impl Profile {
+    /// Creates a profile from a conversion function.
+    ///
+    /// `to_srgb` is called with one value per channel, each in the range
+    /// `0.0..=1.0` (the source byte divided by 255), and must return the
+    /// gamma-encoded sRGB color, with components in the range `0.0..=1.0`.
+    /// It is only called while building a `Transform`.
+    pub fn new<F>(id: u64, space: ColorSpace, to_srgb: F) -> Self
+    where
+        F: Fn(&[f64]) -> [f64; 3] + Send + Sync + 'static,
+    {
+        Profile {
+            id,
+            space,
+            to_srgb: Arc::new(to_srgb),
+        }
+    }
+
+    /// Returns a device CMYK profile using the naive conversion
+    /// `R = (1 - C) * (1 - K)` (and likewise for G and B).
+    ///
+    /// This is what most viewers use when a document doesn't specify a
+    /// profile.
+    pub fn naive_cmyk() -> Self {
+        Self::new(NAIVE_CMYK_ID, ColorSpace::FourChannel, |cmyk| {
+            let k = 1.0 - cmyk[3];
+            [
+                (1.0 - cmyk[0]) * k,
+                (1.0 - cmyk[1]) * k,
+                (1.0 - cmyk[2]) * k,
+            ]
+        })
+    }
+
+    /// Returns a CIE L\*a\*b\* profile with a D50 white point.
+    ///
+    /// Source pixels use the common 8-bit encoding: `L* = byte * 100 / 255`,
+    /// and `a*` and `b*` are offset by 128.
+    pub fn lab_d50() -> Self {
+        Self::new(LAB_D50_ID, ColorSpace::ThreeChannel, |lab| {
+            lab_to_srgb(
+                lab[0] * 100.0,
+                lab[1] * 255.0 - 128.0,
+                lab[2] * 255.0 - 128.0,
+            )
+        })
+    }
+
+    /// Returns the profile's ID.
+    pub fn id(&self) -> u64 {
+        self.id
+    }
+
+    /// Returns the color space of source pixels.
+    pub fn space(&self) -> ColorSpace {
+        self.space
+    }
+}
+
+impl fmt::Debug for Profile {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        f.debug_struct("Profile")
+            .field("id", &self.id)
+            .field("space", &self.space)
+            .finish()
+    }
+}
+
+/// Converts a D50 Lab color to gamma-encoded sRGB.
+fn lab_to_srgb(l: f64, a: f64, b: f64) -> [f64; 3] {
+    const WHITE: [f64; 3] = [0.9642, 1.0, 0.8249];
+    const EPSILON: f64 = 216.0 / 24389.0;
+    const KAPPA: f64 = 24389.0 / 27.0;
+
+    let fy = (l + 16.0) / 116.0;
+    let fx = fy + a / 500.0;
+    let fz = fy - b / 200.0;
+    let inverse = |f: f64| {
+        if f * f * f > EPSILON {
+            f * f * f
+        } else {
+            (116.0 * f - 16.0) / KAPPA
+        }
+    };
+    let (x, y, z) = (
+        inverse(fx) * WHITE[0],
+        inverse(fy) * WHITE[1],
+        inverse(fz) * WHITE[2],
+    );
+
+    // Bradford-adapted XYZ (D50) to linear sRGB.
+    let linear = [
+        3.1338561 * x - 1.6168667 * y - 0.4906146 * z,
+        -0.9787684 * x + 1.9161415 * y + 0.0334540 * z,
+        0.0719453 * x - 0.2289914 * y + 1.4052427 * z,
+    ];
+    let encode = |c: f64| {
+        let c = c.max(0.0).min(1.0);
+        if c <= 0.003_130_8 {
+            12.92 * c
+        } else {
+            1.055 * c.powf(1.0 / 2.4) - 0.055
+        }
+    };
+    [encode(linear[0]), encode(linear[1]), encode(linear[2])]
+}
+
+/// Splits an input byte into a grid cell index and the position within the
+/// cell (`0..=256`).
+fn grid_position(value: u8) -> (usize, i32) {
+    let position = i32::from(value) * (GRID as i32 - 1) * 256 / 255;
+    let index = (position >> 8) as usize;
+    if index == GRID - 1 {
+        (GRID - 2, 256)
+    } else {
+        (index, position & 255)
+    }
+}
+
+/// A precomputed conversion from a source color space to sRGB.
+pub struct Transform {
+    space: ColorSpace,
+    /// Grid of output colors. The index is `((c0 * GRID + c1) * GRID + c2)`,
+    /// plus `c3 * GRID³` for 4 channel color spaces, so that each value of the
+    /// fourth channel selects a contiguous 3D grid. Components are stored as
+    /// `value * 255 * 256`.
+    lut: Vec<[u16; 3]>,
+}
+
+impl Transform {
+    /// Samples `profile` into a new lookup table.
+    ///
+    /// Prefer [`transform`](fn.transform.html), which caches the result.
+    pub fn new(profile: &Profile) -> Self {
+        let channels = profile.space.channels();
+        let len = GRID.pow(channels as u32);
+        let mut lut = Vec::with_capacity(len);
+        let mut input = [0.0; 4];
+        for index in 0..len {
+            let mut rest = index;
+            for &channel in &[2, 1, 0, 3][..channels] {
+                input[channel] = (rest % GRID) as f64 / (GRID - 1) as f64;
+                rest /= GRID;
+            }
+
+            let rgb = (profile.to_srgb)(&input[..channels]);
+            let quantize = |c: f64| (c.max(0.0).min(1.0) * 65280.0).round() as u16;
+            lut.push([quantize(rgb[0]), quantize(rgb[1]), quantize(rgb[2])]);
+        }
+
+        Transform {
+            space: profile.space,
+            lut,
+        }
+    }
+
+    /// Returns the color space of source pixels.
+    pub fn space(&self) -> ColorSpace {
+        self.space
+    }
+
+    /// Interpolates the color at the given position in the 3D grid starting
+    /// at `base`. Returns components scaled by `255 * 256 * 256`.
+    fn tetrahedral(&self, base: usize, pixel: [u8; 3]) -> [i32; 3] {
+        let (x, fx) = grid_position(pixel[0]);
+        let (y, fy) = grid_position(pixel[1]);
+        let (z, fz) = grid_position(pixel[2]);
+
+        let origin = base + (x * GRID + y) * GRID + z;
+        let (dx, dy, dz) = (GRID * GRID, GRID, 1);
+        let at = |offset: usize| self.lut[origin + offset];
+
+        // Pick the tetrahedron containing the point and the order in which
+        // its corners are visited from the origin to the opposite corner.
+        let (first, second, f1, f2, f3) = if fx >= fy {
+            if fy >= fz {
+                (dx, dx + dy, fx, fy, fz)
+            } else if fx >= fz {
+                (dx, dx + dz, fx, fz, fy)
+            } else {
+                (dz, dx + dz, fz, fx, fy)
+            }
+        } else if fz >= fy {
+            (dz, dy + dz, fz, fy, fx)
+        } else if fz >= fx {
+            (dy, dy + dz, fy, fz, fx)
+        } else {
+            (dy, dx + dy, fy, fx, fz)
+        };
+
+        let (c0, c1, c2, c3) = (at(0), at(first), at(second), at(dx + dy + dz));
+        let mut out = [0; 3];
+        for i in 0..3 {
+            let (c0, c1, c2, c3) = (
+                i32::from(c0[i]),
+                i32::from(c1[i]),
+                i32::from(c2[i]),
+                i32::from(c3[i]),
+            );
+            out[i] = c0 * 256 + f1 * (c1 - c0) + f2 * (c2 - c1) + f3 * (c3 - c2);
+        }
+        out
+    }
+
+    /// Converts a single source pixel to 8-bit sRGB.
+    fn convert_pixel(&self, pixel: &[u8]) -> [u8; 3] {
+        let rgb = match self.space {
+            ColorSpace::ThreeChannel => self.tetrahedral(0, [pixel[0], pixel[1], pixel[2]]),
+            ColorSpace::FourChannel => {
+                // Interpolate linearly between the two 3D grids enclosing K.
+                let (k, fk) = grid_position(pixel[3]);
+                let stride = GRID * GRID * GRID;
+                let cmy = [pixel[0], pixel[1], pixel[2]];
+                let lower = self.tetrahedral(k * stride, cmy);
+                let upper = self.tetrahedral((k + 1) * stride, cmy);
+                let mut rgb = [0; 3];
+                for i in 0..3 {
+                    rgb[i] = lower[i] + ((upper[i] - lower[i]) >> 8) * fk;
+                }
+                rgb
+            }
+        };
+
+        let round = |c: i32| ((c + (1 << 15)) >> 16).max(0).min(255) as u8;
+        [round(rgb[0]), round(rgb[1]), round(rgb[2])]
+    }
+
+    /// Converts a row of opaque source pixels to `ARgb32` pixels.
+    ///
+    /// `src` contains `space().channels()` bytes per pixel. Converts as many
+    /// pixels as fit into both `src` and `dst`.
+    pub fn convert(&self, src: &[u8], dst: &mut [u32]) {
+        let channels = self.space.channels();
+        for (pixel, out) in src.chunks_exact(channels).zip(dst) {
+            let [r, g, b] = self.convert_pixel(pixel);
+            *out = 0xFF00_0000 | u32::from(r) << 16 | u32::from(g) << 8 | u32::from(b);
+        }
+    }
+
+    /// Converts a row of source pixels with separate (straight) alpha values
+    /// to premultiplied `ARgb32` pixels.
+    pub fn convert_with_alpha(&self, src: &[u8], alpha: &[u8], dst: &mut [u32]) {
+        let channels = self.space.channels();
+        let premultiply = |c: u8, a: u32| {
+            let x = u32::from(c) * a + 128;
+            (x + (x >> 8)) >> 8
+        };
+        for ((pixel, &a), out) in src.chunks_exact(channels).zip(alpha).zip(dst) {
+            let [r, g, b] = self.convert_pixel(pixel);
+            let a = u32::from(a);
+            *out = a << 24 | premultiply(r, a) << 16 | premultiply(g, a) << 8 | premultiply(b, a);
+        }
+    }
+}
+
+impl fmt::Debug for Transform {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        f.debug_struct("Transform")
+            .field("space", &self.space)
+            .field("grid", &GRID)
+            .finish()
+    }
+}
+
+/// Maximum number of transforms kept in the cache.
+///
+/// A 4 channel table takes about 500 KB, and documents rarely use more than a
+/// couple of profiles.
+pub const CACHE_CAPACITY: usize = 8;
+
+/// Identifies a cached transform.
+///
+/// Transforms always produce sRGB, so the color space in the key is the
+/// space of source pixels. It keeps profiles that share an ID but not a space
+/// from getting a table of the wrong size.
+type Key = (u64, ColorSpace);
+
+/// Cached transforms, least recently used first.
+static CACHE: OnceLock<Mutex<Vec<(Key, Arc<Transform>)>>> = OnceLock::new();
+
+/// Returns the transform for `profile`, building it if it is not cached yet.
+///
+/// Transforms are shared by all documents in the process. At most
+/// [`CACHE_CAPACITY`] transforms are cached; the least recently used ones are
+/// evicted beyond that.
+///
+/// [`CACHE_CAPACITY`]: constant.CACHE_CAPACITY.html
+pub fn transform(profile: &Profile) -> Arc<Transform> {
+    let key = (profile.id, profile.space);
+    let cache = CACHE.get_or_init(Default::default);
+    {
+        let mut cache = cache.lock().unwrap();
+        if let Some(index) = cache.iter().position(|(k, _)| *k == key) {
+            let entry = cache.remove(index);
+            let transform = entry.1.clone();
+            cache.push(entry);
+            return transform;
+        }
+    }
+
+    // Build the table without holding the lock, so that other threads can
+    // use already cached transforms in the meantime.
+    let transform = Arc::new(Transform::new(profile));
+    let mut cache = cache.lock().unwrap();
+    if let Some((_, cached)) = cache.iter().find(|(k, _)| *k == key) {
+        return cached.clone();
+    }
+    if cache.len() >= CACHE_CAPACITY {
+        cache.remove(0);
+    }
+    cache.push((key, transform.clone()));
+    transform
+}
+
+/// Removes all transforms from the cache.
+///
+/// Transforms still in use stay alive until they are dropped.
+pub fn clear_cache() {
+    if let Some(cache) = CACHE.get() {
+        cache.lock().unwrap().clear();
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    /// Maximum difference to the float reference, in 8-bit levels: rounding
+    /// the result contributes half a level, the fixed-point table and
+    /// fractions the rest.
+    const TOLERANCE: f64 = 1.5;
+
+    /// Interpolates `profile` like `Transform` does, but in floating point and
+    /// without quantizing the table.
+    fn reference(profile: &Profile, pixel: &[u8]) -> [f64; 3] {
+        let cells = (GRID - 1) as f64;
+        let split = |value: u8| {
+            let position = f64::from(value) / 255.0 * cells;
+            let index = position.floor().min(cells - 1.0);
+            (index, position - index)
+        };
+        let sample = |point: &[f64]| {
+            let input: Vec<f64> = point.iter().map(|p| p / cells).collect();
+            (profile.to_srgb)(&input)
+        };
+        let tetrahedral = |k: Option<f64>| {
+            let mut axes: Vec<(f64, f64, usize)> = (0..3)
+                .map(|i| {
+                    let (index, fraction) = split(pixel[i]);
+                    (index, fraction, i)
+                })
+                .collect();
+            let mut corner: Vec<f64> = axes.iter().map(|a| a.0).collect();
+            corner.extend(k);
+            // Visit the corners from the origin along the largest fractions
+            // first.
+            axes.sort_by(|a, b| b.1.partial_cmp(&a.1).unwrap().then(a.2.cmp(&b.2)));
+            let mut previous = sample(&corner);
+            let mut out = previous;
+            for &(_, fraction, axis) in &axes {
+                corner[axis] += 1.0;
+                let next = sample(&corner);
+                for c in 0..3 {
+                    out[c] += fraction * (next[c] - previous[c]);
+                }
+                previous = next;
+            }
+            out
+        };
+        match profile.space() {
+            ColorSpace::ThreeChannel => tetrahedral(None),
+            ColorSpace::FourChannel => {
+                let (k, fk) = split(pixel[3]);
+                let (lower, upper) = (tetrahedral(Some(k)), tetrahedral(Some(k + 1.0)));
+                let mut out = [0.0; 3];
+                for c in 0..3 {
+                    out[c] = lower[c] + fk * (upper[c] - lower[c]);
+                }
+                out
+            }
+        }
+    }
+
+    /// Returns a pseudo-random sequence of pixels, including all corners of
+    /// the grid.
+    fn pixels(channels: usize) -> Vec<Vec<u8>> {
+        let mut pixels: Vec<Vec<u8>> = (0..1 << channels)
+            .map(|corner| {
+                (0..channels)
+                    .map(|i| (corner >> i & 1) as u8 * 255)
+                    .collect()
+            })
+            .collect();
+        let mut state = 0x2545_f491_4f6c_dd1d_u64;
+        for _ in 0..20_000 {
+            let pixel = (0..channels)
+                .map(|_| {
+                    state ^= state << 13;
+                    state ^= state >> 7;
+                    state ^= state << 17;
+                    state as u8
+                })
+                .collect();
+            pixels.push(pixel);
+        }
+        pixels
+    }
+
+    /// Returns the largest difference between `Transform` and the float
+    /// reference, in 8-bit levels.
+    fn max_error(profile: &Profile) -> f64 {
+        let transform = Transform::new(profile);
+        let mut max = 0.0f64;
+        for pixel in pixels(profile.space().channels()) {
+            let mut out = [0];
+            transform.convert(&pixel, &mut out);
+            let actual = [out[0] >> 16 & 0xFF, out[0] >> 8 & 0xFF, out[0] & 0xFF];
+            let expected = reference(profile, &pixel);
+            for c in 0..3 {
+                let expected = expected[c].max(0.0).min(1.0) * 255.0;
+                max = max.max((f64::from(actual[c]) - expected).abs());
+            }
+        }
+        max
+    }
+
+    #[test]
+    fn grid_position_covers_all_bytes() {
+        assert_eq!(grid_position(0), (0, 0));
+        assert_eq!(grid_position(255), (GRID - 2, 256));
+        let mut last = 0;
+        for value in 0..=255 {
+            let (index, fraction) = grid_position(value);
+            assert!(index < GRID - 1 && fraction <= 256);
+            let position = index * 256 + fraction as usize;
+            assert!(position >= last, "not monotonic at {}", value);
+            last = position;
+        }
+    }
+
+    #[test]
+    fn three_channels_match_float_reference() {
+        let identity = Profile::new(1, ColorSpace::ThreeChannel, |c| [c[0], c[1], c[2]]);
+        assert!(max_error(&identity) <= TOLERANCE);
+        // Uses all tetrahedra differently for every output channel.
+        let mixed = Profile::new(2, ColorSpace::ThreeChannel, |c| {
+            [c[2] * c[1], (c[0] + c[1] * c[1]) / 2.0, 1.0 - c[0] * c[2]]
+        });
+        assert!(max_error(&mixed) <= TOLERANCE);
+        assert!(max_error(&Profile::lab_d50()) <= TOLERANCE);
+    }
+
+    #[test]
+    fn four_channels_match_float_reference() {
+        assert!(max_error(&Profile::naive_cmyk()) <= TOLERANCE);
+    }
+
+    #[test]
+    fn corners_are_exact() {
+        let transform = Transform::new(&Profile::naive_cmyk());
+        let mut out = [0; 3];
+        transform.convert(&[0, 0, 0, 0, 255, 255, 255, 0, 0, 0, 0, 255], &mut out);
+        assert_eq!(out, [0xFFFF_FFFF, 0xFF00_0000, 0xFF00_0000]);
+
+        let mut out = [0];
+        transform.convert_with_alpha(&[0, 0, 0, 0], &[128], &mut out);
+        assert_eq!(out, [0x8080_8080]);
+    }
+
+    #[test]
+    fn cache_evicts_least_recently_used_transforms() {
+        clear_cache();
+        let gray = |id| Profile::new(id, ColorSpace::ThreeChannel, |c| [c[0], c[0], c[0]]);
+        let first = transform(&gray(0));
+        assert!(Arc::ptr_eq(&first, &transform(&gray(0))));
+
+        // Profiles are told apart by their space as well as their ID.
+        let cmyk = transform(&Profile::new(0, ColorSpace::FourChannel, |_| [0.0; 3]));
+        assert_eq!(cmyk.space(), ColorSpace::FourChannel);
+        assert!(Arc::ptr_eq(&first, &transform(&gray(0))));
+
+        // Profile 0 was used more recently than the CMYK one, so filling the
+        // cache evicts the latter.
+        for id in 1..CACHE_CAPACITY as u64 - 1 {
+            transform(&gray(id));
+        }
+        transform(&gray(0));
+        transform(&gray(100));
+        assert_eq!(CACHE.get().unwrap().lock().unwrap().len(), CACHE_CAPACITY);
+        assert!(Arc::ptr_eq(&first, &transform(&gray(0))));
+        let rebuilt = transform(&Profile::new(0, ColorSpace::FourChannel, |_| [0.0; 3]));
+        assert!(!Arc::ptr_eq(&cmyk, &rebuilt));
+        clear_cache();
+    }
+}
@@ -0,0 +1,999 @@
+//! Recording and replaying of vector drawing operations.
+//!
+//! Vector formats are usually expensive to parse, but cheap to draw once
+//! parsed. A [`DisplayList`] stores the drawing operations of a page in a
+//! compact form, so that the source document only needs to be interpreted once
+//! per page. Afterwards, every call to `page_render` (for example after the
+//! user changed the zoom level or rotated the document) is a plain replay of
+//! the recorded operations.
+//!
+//! Operations are recorded in user space. Zathura already sets up the Cairo
+//! context passed to `page_render` to account for zoom and device scale, so
+//! the same display list can be replayed at any scale. The context is never
+//! rotated: Zathura rotates the rendered page when displaying it.
+//!
+//! Every recorded operation also stores a conservative bounding box. Large
+//! lists are indexed by a uniform grid over these boxes, so that replaying
+//! only touches the operations that intersect the context's clip region. When
+//! zoomed in on a dense drawing, rendering cost is thus proportional to the
+//! visible part of the page rather than the whole page.
+//!
+//! # Examples
+//!
+//! ```no_run
+//! # fn page_render(cairo: &cairo::Context) {
+//! use zathura_plugin::display_list::DisplayListBuilder;
+//!
+//! let mut builder = DisplayListBuilder::new();
+//! builder.set_source_rgb(1.0, 0.0, 0.0);
+//! builder.rectangle(10.0, 10.0, 50.0, 20.0);
+//! builder.fill();
+//! let list = builder.finish();
+//!
+//! // In `page_render`:
+//! list.replay(cairo);
+//! # }
+//! ```
+//!
+//! [`DisplayList`]: struct.DisplayList.html
+
+use {
+    cairo::{FillRule, FontSlant, FontWeight, ImageSurface, LineCap, LineJoin},
+    std::{f64::consts::SQRT_2, fmt, ops::Range},
+};
+
+/// Path construction verbs.
+///
+/// The coordinates of all verbs are stored in a separate array: `MoveTo` and
+/// `LineTo` use 2, `CurveTo` uses 6 and `ClosePath` uses none.
+#[derive(Debug, Copy, Clone, PartialEq, Eq)]
+enum Verb {
+    MoveTo,
+    LineTo,
+    CurveTo,
+    ClosePath,
+}
+
+/// Location of a path in the verb and coordinate arenas.
+#[derive(Debug, Copy, Clone)]
+struct PathRef {
+    verbs: (u32, u32),
+    coords: u32,
+}
+
+#[derive(Debug, Copy, Clone, PartialEq)]
+struct StrokeStyle {
+    width: f64,
+    cap: LineCap,
+    join: LineJoin,
+    miter_limit: f64,
+}
+
+#[derive(Debug, Copy, Clone, PartialEq)]
+struct Font {
+    /// Range of the family name in the text arena.
+    family: (u32, u32),
+    slant: FontSlant,
+    weight: FontWeight,
+    size: f64,
+}
+
+#[derive(Debug, Copy, Clone)]
+enum Primitive {
+    Fill {
+        path: PathRef,
+        rule: FillRule,
+    },
+    Stroke {
+        path: PathRef,
+        style: u32,
+    },
+    Text {
+        font: u32,
+        x: f64,
+        y: f64,
+        text: (u32, u32),
+    },
+    Image {
+        image: u32,
+        x: f64,
+        y: f64,
+        width: f64,
+        height: f64,
+    },
+}
+
+/// An axis-aligned rectangle in user space.
+#[derive(Debug, Copy, Clone, PartialEq)]
+struct Rect {
+    x0: f64,
+    y0: f64,
+    x1: f64,
+    y1: f64,
+}
+
+impl Rect {
+    /// A rectangle that intersects nothing and is the identity for `union`.
+    const EMPTY: Self = Rect {
+        x0: f64::INFINITY,
+        y0: f64::INFINITY,
+        x1: f64::NEG_INFINITY,
+        y1: f64::NEG_INFINITY,
+    };
+
+    fn union(&self, other: &Rect) -> Rect {
+        Rect {
+            x0: self.x0.min(other.x0),
+            y0: self.y0.min(other.y0),
+            x1: self.x1.max(other.x1),
+            y1: self.y1.max(other.y1),
+        }
+    }
+
+    fn add_point(&mut self, x: f64, y: f64) {
+        *self = self.union(&Rect {
+            x0: x,
+            y0: y,
+            x1: x,
+            y1: y,
+        });
+    }
+
+    fn inflate(&self, by: f64) -> Rect {
+        Rect {
+            x0: self.x0 - by,
+            y0: self.y0 - by,
+            x1: self.x1 + by,
+            y1: self.y1 + by,
+        }
+    }
+
+    fn intersects(&self, other: &Rect) -> bool {
+        self.x0 <= other.x1 && other.x0 <= self.x1 && self.y0 <= other.y1 && other.y0 <= self.y1
+    }
+
+    fn contains(&self, other: &Rect) -> bool {
+        self.x0 <= other.x0 && self.y0 <= other.y0 && other.x1 <= self.x1 && other.y1 <= self.y1
+    }
+}
+
+/// A single self-contained drawing operation.
+///
+/// Every item carries all the state needed to draw it, so that items can be
+/// replayed in isolation.
+#[derive(Debug, Copy, Clone)]
+struct Item {
+    /// Conservative bounds of the pixels touched by this item.
+    bounds: Rect,
+    color: [f32; 4],
+    primitive: Primitive,
+}
+
+/// A uniform grid over the bounding boxes of a display list's items.
+///
+/// Cell contents are stored in a compressed layout: the items of cell `i` are
+/// `cell_items[cell_start[i]..cell_start[i + 1]]`. Items covering a large part
+/// of the grid are kept in a separate list instead of being added to every
+/// cell they touch.
+#[derive(Debug, Clone)]
+struct GridIndex {
+    bounds: Rect,
+    cols: usize,
+    rows: usize,
+    cell_start: Vec<u32>,
+    cell_items: Vec<u32>,
+    large: Vec<u32>,
+}
+
+impl GridIndex {
+    /// Lists with fewer items are not indexed, since testing every item's
+    /// bounds is cheap enough.
+    const MIN_ITEMS: usize = 256;
+
+    /// Targeted average number of items per cell.
+    const ITEMS_PER_CELL: usize = 8;
+
+    const MAX_DIM: usize = 512;
+
+    fn build(items: &[Item], bounds: Rect) -> Option<Self> {
+        if items.len() < Self::MIN_ITEMS || !(bounds.x0 < bounds.x1 && bounds.y0 < bounds.y1) {
+            return None;
+        }
+
+        let dim = ((items.len() / Self::ITEMS_PER_CELL) as f64).sqrt().ceil() as usize;
+        let dim = dim.max(1).min(Self::MAX_DIM);
+        let mut index = GridIndex {
+            bounds,
+            cols: dim,
+            rows: dim,
+            cell_start: vec![0; dim * dim + 1],
+            cell_items: Vec::new(),
+            large: Vec::new(),
+        };
+
+        // Count items per cell, then fill in the items.
+        let large_cells = dim * dim / 4;
+        let mut counts = vec![0u32; dim * dim];
+        for item in items {
+            let (cols, rows) = index.cell_range(&item.bounds);
+            if cols.len() * rows.len() <= large_cells {
+                for row in rows {
+                    for col in cols.clone() {
+                        counts[row * dim + col] += 1;
+                    }
+                }
+            }
+        }
+        let mut total = 0;
+        for (start, count) in index.cell_start.iter_mut().zip(&counts) {
+            *start = total;
+            total += count;
+        }
+        index.cell_start[dim * dim] = total;
+
+        let mut fill = index.cell_start[..dim * dim].to_vec();
+        index.cell_items = vec![0; total as usize];
+        for (i, item) in items.iter().enumerate() {
+            let (cols, rows) = index.cell_range(&item.bounds);
+            if cols.len() * rows.len() <= large_cells {
+                for row in rows {
+                    for col in cols.clone() {
+                        let slot = &mut fill[row * dim + col];
+                        index.cell_items[*slot as usize] = i as u32;
+                        *slot += 1;
+                    }
+                }
+            } else {
+                index.large.push(i as u32);
+            }
+        }
+
+        Some(index)
+    }
+
+    /// Returns the range of columns and rows overlapped by `rect`.
+    fn cell_range(&self, rect: &Rect) -> (Range<usize>, Range<usize>) {
+        fn axis(lo: f64, hi: f64, min: f64, max: f64, n: usize) -> Range<usize> {
+            if hi < min || lo > max {
+                return 0..0;
+            }
+            let cell = (max - min) / n as f64;
+            let first = ((lo - min) / cell).floor().max(0.0) as usize;
+            let last = ((hi - min) / cell).floor().max(0.0) as usize;
+            first.min(n - 1)..last.min(n - 1) + 1
+        }
+
+        let b = &self.bounds;
+        (
+            axis(rect.x0, rect.x1, b.x0, b.x1, self.cols),
+            axis(rect.y0, rect.y1, b.y0, b.y1, self.rows),
+        )
+    }
+
+    /// Returns the indices of all items intersecting `clip`, in paint order.
+    fn query(&self, clip: &Rect, items: &[Item]) -> Vec<u32> {
+        let (cols, rows) = self.cell_range(clip);
+        let mut result = Vec::new();
+        for row in rows {
+            let cells = row * self.cols + cols.start..row * self.cols + cols.end;
+            let (start, end) = (self.cell_start[cells.start], self.cell_start[cells.end]);
+            result.extend(
+                self.cell_items[start as usize..end as usize]
+                    .iter()
+                    .filter(|&&i| items[i as usize].bounds.intersects(clip)),
+            );
+        }
+        result.extend(
+            self.large
+                .iter()
+                .filter(|&&i| items[i as usize].bounds.intersects(clip)),
+        );
+
+        // Items spanning several cells are found more than once.
+        result.sort_unstable();
+        result.dedup();
+        result
+    }
+}
+
+/// An immutable list of recorded drawing operations.
+///
+/// Created by a [`DisplayListBuilder`].
+///
+/// [`DisplayListBuilder`]: struct.DisplayListBuilder.html
+#[derive(Clone)]
+pub struct DisplayList {
+    items: Vec<Item>,
+    verbs: Vec<Verb>,
+    coords: Vec<f64>,
+    text: String,
+    stroke_styles: Vec<StrokeStyle>,
+    fonts: Vec<Font>,
+    images: Vec<ImageSurface>,
+    bounds: Rect,
+    index: Option<GridIndex>,
+}
+
+impl DisplayList {
+    /// Returns the number of recorded drawing operations.
+    pub fn len(&self) -> usize {
+        self.items.len()
+    }
+
+    /// Returns whether the list contains no drawing operations.
+    pub fn is_empty(&self) -> bool {
+        self.items.is_empty()
+    }
+
+    /// Returns the bounding box of all recorded operations as
+    /// `(x0, y0, x1, y1)` in user space.
+    ///
+    /// Returns `None` if nothing was recorded.
+    pub fn extents(&self) -> Option<(f64, f64, f64, f64)> {
+        let b = self.bounds;
+        if b == Rect::EMPTY {
+            None
+        } else {
+            Some((b.x0, b.y0, b.x1, b.y1))
+        }
+    }
+
+    /// Returns the approximate heap memory used by the list, in bytes.
+    ///
+    /// Image data is not included.
+    pub fn heap_size(&self) -> usize {
+        use std::mem::size_of;
+
+        self.items.capacity() * size_of::<Item>()
+            + self.verbs.capacity() * size_of::<Verb>()
+            + self.coords.capacity() * size_of::<f64>()
+            + self.text.capacity()
+            + self.stroke_styles.capacity() * size_of::<StrokeStyle>()
+            + self.fonts.capacity() * size_of::<Font>()
+            + self.images.capacity() * size_of::<ImageSurface>()
+            + self.index.as_ref().map_or(0, |index| {
+                (index.cell_start.capacity() + index.cell_items.capacity() + index.large.capacity())
+                    * size_of::<u32>()
+            })
+    }
+
+    /// Draws all recorded operations to `cairo`.
+    ///
+    /// The operations are drawn using the context's current transformation
+    /// matrix and clip. Operations lying entirely outside of the clip region
+    /// are skipped. The context's state is saved and restored around the
+    /// replay.
+    pub fn replay(&self, cairo: &cairo::Context) {
+        let (x0, y0, x1, y1) = cairo.clip_extents();
+        let clip = Rect { x0, y0, x1, y1 };
+
+        if clip.contains(&self.bounds) {
+            self.replay_items(cairo, 0..self.items.len());
+        } else if let Some(index) = &self.index {
+            let items = index.query(&clip, &self.items);
+            self.replay_items(cairo, items.into_iter().map(|i| i as usize));
+        } else {
+            let items = &self.items;
+            let visible = (0..items.len()).filter(|&i| items[i].bounds.intersects(&clip));
+            self.replay_items(cairo, visible);
+        }
+    }
+
+    fn replay_items(&self, cairo: &cairo::Context, items: impl Iterator<Item = usize>) {
+        cairo.save();
+        cairo.new_path();
+
+        let mut replayer = Replayer {
+            list: self,
+            cairo,
+            color: None,
+            stroke_style: None,
+            font: None,
+        };
+        for index in items {
+            replayer.draw(&self.items[index]);
+        }
+
+        cairo.restore();
+    }
+
+    fn str(&self, (start, end): (u32, u32)) -> &str {
+        &self.text[start as usize..end as usize]
+    }
+}
+
+impl fmt::Debug for DisplayList {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        f.debug_struct("DisplayList")
+            .field("items", &self.items.len())
+            .field("verbs", &self.verbs.len())
+            .field("images", &self.images.len())
+            .field("indexed", &self.index.is_some())
+            .finish()
+    }
+}
+
+/// Replay state, used to skip redundant Cairo state changes.
+struct Replayer<'a> {
+    list: &'a DisplayList,
+    cairo: &'a cairo::Context,
+    color: Option<[f32; 4]>,
+    stroke_style: Option<u32>,
+    font: Option<u32>,
+}
+
+impl Replayer<'_> {
+    fn draw(&mut self, item: &Item) {
+        let cairo = self.cairo;
+
+        if let Primitive::Image { .. } = item.primitive {
+            // Images are drawn as sources and don't use the color.
+        } else if self.color != Some(item.color) {
+            let [r, g, b, a] = item.color;
+            cairo.set_source_rgba(r.into(), g.into(), b.into(), a.into());
+            self.color = Some(item.color);
+        }
+
+        match item.primitive {
+            Primitive::Fill { path, rule } => {
+                self.path(path);
+                cairo.set_fill_rule(rule);
+                cairo.fill();
+            }
+            Primitive::Stroke { path, style } => {
+                if self.stroke_style != Some(style) {
+                    let style = &self.list.stroke_styles[style as usize];
+                    cairo.set_line_width(style.width);
+                    cairo.set_line_cap(style.cap);
+                    cairo.set_line_join(style.join);
+                    cairo.set_miter_limit(style.miter_limit);
+                }
+                self.stroke_style = Some(style);
+                self.path(path);
+                cairo.stroke();
+            }
+            Primitive::Text { font, x, y, text } => {
+                if self.font != Some(font) {
+                    let f = &self.list.fonts[font as usize];
+                    cairo.select_font_face(self.list.str(f.family), f.slant, f.weight);
+                    cairo.set_font_size(f.size);
+                }
+                self.font = Some(font);
+                cairo.move_to(x, y);
+                cairo.show_text(self.list.str(text));
+                cairo.new_path();
+            }
+            Primitive::Image {
+                image,
+                x,
+                y,
+                width,
+                height,
+            } => {
+                let image = &self.list.images[image as usize];
+                cairo.save();
+                cairo.translate(x, y);
+                cairo.scale(
+                    width / f64::from(image.get_width()),
+                    height / f64::from(image.get_height()),
+                );
+                cairo.set_source_surface(image, 0.0, 0.0);
+                cairo.paint();
+                cairo.restore();
+                // The source was replaced by the image.
+                self.color = None;
+            }
+        }
+    }
+
+    fn path(&self, path: PathRef) {
+        let cairo = self.cairo;
+        let verbs = &self.list.verbs[path.verbs.0 as usize..path.verbs.1 as usize];
+        let mut c = &self.list.coords[path.coords as usize..];
+
+        for verb in verbs {
+            match verb {
+                Verb::MoveTo => {
+                    cairo.move_to(c[0], c[1]);
+                    c = &c[2..];
+                }
+                Verb::LineTo => {
+                    cairo.line_to(c[0], c[1]);
+                    c = &c[2..];
+                }
+                Verb::CurveTo => {
+                    cairo.curve_to(c[0], c[1], c[2], c[3], c[4], c[5]);
+                    c = &c[6..];
+                }
+                Verb::ClosePath => cairo.close_path(),
+            }
+        }
+    }
+}
+
+/// Records drawing operations into a [`DisplayList`].
+///
+/// The methods mirror the corresponding methods of `cairo::Context`. Like in
+/// Cairo, `fill` and `stroke` consume the current path.
+///
+/// [`DisplayList`]: struct.DisplayList.html
+pub struct DisplayListBuilder {
+    list: DisplayList,
+    color: [f32; 4],
+    fill_rule: FillRule,
+    stroke_style: StrokeStyle,
+    font: Font,
+    /// Index of the current stroke style in `list.stroke_styles`, if recorded.
+    stroke_index: Option<u32>,
+    /// Index of the current font in `list.fonts`, if recorded.
+    font_index: Option<u32>,
+    /// Start of the current path in the verb and coordinate arenas.
+    path_start: (usize, usize),
+}
+
+impl DisplayListBuilder {
+    /// Creates a builder with Cairo's default drawing state.
+    pub fn new() -> Self {
+        let mut list = DisplayList {
+            items: Vec::new(),
+            verbs: Vec::new(),
+            coords: Vec::new(),
+            text: String::new(),
+            stroke_styles: Vec::new(),
+            fonts: Vec::new(),
+            images: Vec::new(),
+            bounds: Rect::EMPTY,
+            index: None,
+        };
+        list.text.push_str("sans-serif");
+
+        Self {
+            list,
+            color: [0.0, 0.0, 0.0, 1.0],
+            fill_rule: FillRule::Winding,
+            stroke_style: StrokeStyle {
+                width: 2.0,
+                cap: LineCap::Butt,
+                join: LineJoin::Miter,
+                miter_limit: 10.0,
+            },
+            font: Font {
+                family: (0, 10),
+                slant: FontSlant::Normal,
+                weight: FontWeight::Normal,
+                size: 10.0,
+            },
+            stroke_index: None,
+            font_index: None,
+            path_start: (0, 0),
+        }
+    }
+
+    /// Sets the color used by subsequent drawing operations.
+    pub fn set_source_rgba(&mut self, red: f64, green: f64, blue: f64, alpha: f64) {
+        self.color = [red as f32, green as f32, blue as f32, alpha as f32];
+    }
+
+    /// Sets an opaque color used by subsequent drawing operations.
+    pub fn set_source_rgb(&mut self, red: f64, green: f64, blue: f64) {
+        self.set_source_rgba(red, green, blue, 1.0);
+    }
+
+    pub fn set_fill_rule(&mut self, rule: FillRule) {
+        self.fill_rule = rule;
+    }
+
+    pub fn set_line_width(&mut self, width: f64) {
+        self.set_stroke_style(StrokeStyle {
+            width,
+            ..self.stroke_style
+        });
+    }
+
+    pub fn set_line_cap(&mut self, cap: LineCap) {
+        self.set_stroke_style(StrokeStyle {
+            cap,
+            ..self.stroke_style
+        });
+    }
+
+    pub fn set_line_join(&mut self, join: LineJoin) {
+        self.set_stroke_style(StrokeStyle {
+            join,
+            ..self.stroke_style
+        });
+    }
+
+    pub fn set_miter_limit(&mut self, limit: f64) {
+        self.set_stroke_style(StrokeStyle {
+            miter_limit: limit,
+            ..self.stroke_style
+        });
+    }
+
+    fn set_stroke_style(&mut self, style: StrokeStyle) {
+        if style != self.stroke_style {
+            self.stroke_style = style;
+            self.stroke_index = None;
+        }
+    }
+
+    /// Selects the font used by subsequent `show_text` calls.
+    ///
+    /// This corresponds to Cairo's "toy" font API, taking a font family name
+    /// that is resolved by Cairo at replay time.
+    pub fn select_font_face(&mut self, family: &str, slant: FontSlant, weight: FontWeight) {
+        let family = if self.list.str(self.font.family) == family {
+            self.font.family
+        } else {
+            self.push_str(family)
+        };
+        self.font = Font {
+            family,
+            slant,
+            weight,
+            ..self.font
+        };
+        self.font_index = None;
+    }
+
+    pub fn set_font_size(&mut self, size: f64) {
+        if size != self.font.size {
+            self.font.size = size;
+            self.font_index = None;
+        }
+    }
+
+    pub fn move_to(&mut self, x: f64, y: f64) {
+        self.list.verbs.push(Verb::MoveTo);
+        self.list.coords.extend_from_slice(&[x, y]);
+    }
+
+    pub fn line_to(&mut self, x: f64, y: f64) {
+        self.list.verbs.push(Verb::LineTo);
+        self.list.coords.extend_from_slice(&[x, y]);
+    }
+
+    pub fn curve_to(&mut self, x1: f64, y1: f64, x2: f64, y2: f64, x3: f64, y3: f64) {
+        self.list.verbs.push(Verb::CurveTo);
+        self.list
+            .coords
+            .extend_from_slice(&[x1, y1, x2, y2, x3, y3]);
+    }
+
+    pub fn close_path(&mut self) {
+        self.list.verbs.push(Verb::ClosePath);
+    }
+
+    /// Adds a closed rectangle sub-path to the current path.
+    pub fn rectangle(&mut self, x: f64, y: f64, width: f64, height: f64) {
+        self.move_to(x, y);
+        self.line_to(x + width, y);
+        self.line_to(x + width, y + height);
+        self.line_to(x, y + height);
+        self.close_path();
+    }
+
+    /// Records a fill of the current path and starts a new path.
+    pub fn fill(&mut self) {
+        if let Some((path, bounds)) = self.take_path() {
+            let rule = self.fill_rule;
+            self.push_item(Primitive::Fill { path, rule }, bounds);
+        }
+    }
+
+    /// Records a stroke of the current path and starts a new path.
+    pub fn stroke(&mut self) {
+        if let Some((path, bounds)) = self.take_path() {
+            let style = match self.stroke_index {
+                Some(index) => index,
+                None => {
+                    self.list.stroke_styles.push(self.stroke_style);
+                    let index = self.list.stroke_styles.len() as u32 - 1;
+                    self.stroke_index = Some(index);
+                    index
+                }
+            };
+            // Miter joins can extend up to half the miter limit times the
+            // line width beyond the path.
+            let half_width = self.stroke_style.width / 2.0;
+            let pad = match self.stroke_style.join {
+                LineJoin::Miter => half_width * self.stroke_style.miter_limit.max(SQRT_2),
+                _ => half_width * SQRT_2,
+            };
+            self.push_item(Primitive::Stroke { path, style }, bounds.inflate(pad));
+        }
+    }
+
+    /// Records drawing `text` with its baseline origin at `(x, y)`.
+    pub fn show_text(&mut self, x: f64, y: f64, text: &str) {
+        let font = match self.font_index {
+            Some(index) => index,
+            None => {
+                self.list.fonts.push(self.font);
+                let index = self.list.fonts.len() as u32 - 1;
+                self.font_index = Some(index);
+                index
+            }
+        };
+        // Glyph extents are only known to Cairo, so estimate generously: no
+        // glyph is assumed to be wider than twice the font size.
+        let size = self.font.size;
+        let chars = text.chars().count() as f64;
+        let bounds = Rect {
+            x0: x - size,
+            y0: y - 2.0 * size,
+            x1: x + (2.0 * chars + 1.0) * size,
+            y1: y + size,
+        };
+        let text = self.push_str(text);
+        self.push_item(Primitive::Text { font, x, y, text }, bounds);
+    }
+
+    /// Records drawing `image` scaled to fill the given rectangle.
+    pub fn draw_image(&mut self, image: &ImageSurface, x: f64, y: f64, width: f64, height: f64) {
+        self.list.images.push(image.clone());
+        let image = self.list.images.len() as u32 - 1;
+        let mut bounds = Rect::EMPTY;
+        bounds.add_point(x, y);
+        bounds.add_point(x + width, y + height);
+        self.push_item(
+            Primitive::Image {
+                image,
+                x,
+                y,
+                width,
+                height,
+            },
+            bounds,
+        );
+    }
+
+    /// Finishes recording and returns the display list.
+    ///
+    /// A path that was started but never filled or stroked is discarded.
+    pub fn finish(mut self) -> DisplayList {
+        self.take_path();
+        self.list.items.shrink_to_fit();
+        self.list.verbs.shrink_to_fit();
+        self.list.coords.shrink_to_fit();
+        self.list.text.shrink_to_fit();
+        self.list.index = GridIndex::build(&self.list.items, self.list.bounds);
+        self.list
+    }
+
+    /// Ends the current path and returns its location in the arenas and its
+    /// bounds.
+    ///
+    /// The bounds contain all points including curve control points, which
+    /// conservatively contains the curves.
+    fn take_path(&mut self) -> Option<(PathRef, Rect)> {
+        let (verb_start, coord_start) = self.path_start;
+        let (verb_end, coord_end) = (self.list.verbs.len(), self.list.coords.len());
+        self.path_start = (verb_end, coord_end);
+
+        if verb_start == verb_end {
+            None
+        } else {
+            let mut bounds = Rect::EMPTY;
+            for point in self.list.coords[coord_start..coord_end].chunks(2) {
+                bounds.add_point(point[0], point[1]);
+            }
+
+            let path = PathRef {
+                verbs: (verb_start as u32, verb_end as u32),
+                coords: coord_start as u32,
+            };
+            Some((path, bounds))
+        }
+    }
+
+    fn push_str(&mut self, s: &str) -> (u32, u32) {
+        let start = self.list.text.len();
+        self.list.text.push_str(s);
+        (start as u32, self.list.text.len() as u32)
+    }
+
+    fn push_item(&mut self, primitive: Primitive, bounds: Rect) {
+        self.list.bounds = self.list.bounds.union(&bounds);
+        self.list.items.push(Item {
+            bounds,
+            color: self.color,
+            primitive,
+        });
+    }
+}
+
+impl Default for DisplayListBuilder {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+impl fmt::Debug for DisplayListBuilder {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        f.debug_struct("DisplayListBuilder")
+            .field("list", &self.list)
+            .finish()
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    /// An item covering `bounds`. Its primitive doesn't matter to the index.
+    fn item(x0: f64, y0: f64, x1: f64, y1: f64) -> Item {
+        Item {
+            bounds: Rect { x0, y0, x1, y1 },
+            color: [0.0; 4],
+            primitive: Primitive::Fill {
+                path: PathRef {
+                    verbs: (0, 0),
+                    coords: 0,
+                },
+                rule: FillRule::Winding,
+            },
+        }
+    }
+
+    /// Small items scattered over `1000 x 1000` units, with a few items
+    /// covering most of that area in between.
+    fn scattered(count: usize) -> Vec<Item> {
+        // A fixed linear congruential generator, so failures are reproducible.
+        let mut seed = 0x2545_f491_u32;
+        let mut next = move |range: f64| {
+            seed = seed.wrapping_mul(1_103_515_245).wrapping_add(12345);
+            f64::from(seed >> 8) / f64::from(1 << 24) * range
+        };
+        (0..count)
+            .map(|i| {
+                if i % 100 == 50 {
+                    item(-10.0, 20.0, 990.0, 1010.0)
+                } else {
+                    let (x, y) = (next(980.0), next(980.0));
+                    item(x, y, x + next(40.0), y + next(40.0))
+                }
+            })
+            .collect()
+    }
+
+    fn bounds(items: &[Item]) -> Rect {
+        items
+            .iter()
+            .fold(Rect::EMPTY, |bounds, item| bounds.union(&item.bounds))
+    }
+
+    /// The items intersecting `clip`, found by testing every item.
+    fn intersecting(clip: &Rect, items: &[Item]) -> Vec<u32> {
+        (0..items.len() as u32)
+            .filter(|&i| items[i as usize].bounds.intersects(clip))
+            .collect()
+    }
+
+    #[test]
+    fn query_finds_exactly_the_intersecting_items_in_order() {
+        let items = scattered(2000);
+        let index = GridIndex::build(&items, bounds(&items)).unwrap();
+        assert!(!index.large.is_empty());
+
+        let clips = [
+            // Inside the grid, spanning several cells.
+            Rect {
+                x0: 100.0,
+                y0: 200.0,
+                x1: 350.0,
+                y1: 300.0,
+            },
+            // A single point, and a line along cell borders.
+            Rect {
+                x0: 500.0,
+                y0: 500.0,
+                x1: 500.0,
+                y1: 500.0,
+            },
+            Rect {
+                x0: 0.0,
+                y0: 250.0,
+                x1: 1000.0,
+                y1: 250.0,
+            },
+            // Partly outside of the grid on every side.
+            Rect {
+                x0: -500.0,
+                y0: -500.0,
+                x1: 100.0,
+                y1: 100.0,
+            },
+            Rect {
+                x0: 900.0,
+                y0: 900.0,
+                x1: 2000.0,
+                y1: 2000.0,
+            },
+            Rect {
+                x0: -100.0,
+                y0: 400.0,
+                x1: 1100.0,
+                y1: 450.0,
+            },
+            // Covering everything, and nothing.
+            Rect {
+                x0: -1e6,
+                y0: -1e6,
+                x1: 1e6,
+                y1: 1e6,
+            },
+            Rect {
+                x0: 2000.0,
+                y0: 0.0,
+                x1: 3000.0,
+                y1: 1000.0,
+            },
+        ];
+        for clip in &clips {
+            // Sorted and without duplicates, like the brute-force result.
+            assert_eq!(
+                index.query(clip, &items),
+                intersecting(clip, &items),
+                "{:?}",
+                clip
+            );
+        }
+    }
+
+    #[test]
+    fn large_items_are_not_added_to_cells() {
+        let items = scattered(1000);
+        let index = GridIndex::build(&items, bounds(&items)).unwrap();
+        let large: Vec<u32> = (50..1000).step_by(100).collect();
+        assert_eq!(index.large, large);
+        assert!(large.iter().all(|i| !index.cell_items.contains(i)));
+
+        // Left of all small items, only the large ones are found.
+        let clip = Rect {
+            x0: -10.0,
+            y0: 500.0,
+            x1: -5.0,
+            y1: 510.0,
+        };
+        assert_eq!(index.query(&clip, &items), large);
+    }
+
+    #[test]
+    fn small_lists_are_not_indexed() {
+        let items = scattered(GridIndex::MIN_ITEMS - 1);
+        assert!(GridIndex::build(&items, bounds(&items)).is_none());
+        let items = scattered(GridIndex::MIN_ITEMS);
+        assert!(GridIndex::build(&items, bounds(&items)).is_some());
+
+        // Nor are lists without area.
+        let line = vec![item(0.0, 5.0, 10.0, 5.0); GridIndex::MIN_ITEMS];
+        assert!(GridIndex::build(&line, bounds(&line)).is_none());
+
+        let mut builder = DisplayListBuilder::new();
+        for i in 0..GridIndex::MIN_ITEMS - 1 {
+            builder.rectangle(i as f64, 0.0, 1.0, 1.0);
+            builder.fill();
+        }
+        assert!(builder.finish().index.is_none());
+    }
+
+    #[test]
+    fn strokes_are_recorded_with_their_miter_limit() {
+        let mut builder = DisplayListBuilder::new();
+        builder.set_line_width(2.0);
+        builder.rectangle(0.0, 0.0, 10.0, 10.0);
+        builder.stroke();
+        builder.set_miter_limit(3.0);
+        builder.rectangle(0.0, 0.0, 10.0, 10.0);
+        builder.stroke();
+        let list = builder.finish();
+
+        let limits: Vec<f64> = list.stroke_styles.iter().map(|s| s.miter_limit).collect();
+        assert_eq!(limits, [10.0, 3.0]);
+        // Miters extend up to half the limit times the line width.
+        assert_eq!(list.items[0].bounds.x0, -10.0);
+        assert_eq!(list.items[1].bounds.x0, -3.0);
+    }
+}
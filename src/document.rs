@@ -1,8 +1,8 @@
 //! Wrapper around `document.h` functions acting on `zathura_document_t`.
 
 use {
-    crate::{sys, PageRef},
-    std::{ffi::CStr, marker::PhantomData, str::Utf8Error},
+    crate::{arena::SyncArena, header, sys, wrapper::DocSlot, FileHeader, PageRef},
+    std::{ffi::CStr, io, marker::PhantomData, str::Utf8Error},
 };
 
 /// A mutable reference to a Zathura document.
@@ -32,6 +32,17 @@ impl DocumentRef<'_> {
         }
     }
 
+    /// Creates a shorter-lived `DocumentRef` to the same document.
+    ///
+    /// This allows passing the reference to a function taking `DocumentRef` by
+    /// value while keeping it usable afterwards.
+    pub fn reborrow(&mut self) -> DocumentRef<'_> {
+        DocumentRef {
+            ptr: self.ptr,
+            _p: PhantomData,
+        }
+    }
+
     /// Returns the file path as a raw C string.
     ///
     /// If the document was loaded from a URI, this will return a temporary file
@@ -82,6 +93,20 @@ impl DocumentRef<'_> {
         self.uri_raw().map(CStr::to_str)
     }
 
+    /// Reads the first bytes of the document's file.
+    ///
+    /// This can be used to determine the file format (see
+    /// `FileHeader::mime_type`) and dispatch to a format-specific decoder, and
+    /// to parse the format's header without reading it again.
+    ///
+    /// While a document is being opened, the header is only read once and then
+    /// cached, so calling this repeatedly in `document_open` (or from several
+    /// plugins combined by `plugin_entry!`) is cheap. In other callbacks, the
+    /// file is read on every call.
+    pub fn file_header(&self) -> io::Result<FileHeader> {
+        header::cached(self.ptr as usize, self.path_raw().to_bytes())
+    }
+
     /// Returns the raw basename of the document's path.
     ///
     /// If the document was loaded from a URI, this will return the URI's
@@ -220,7 +245,9 @@ impl DocumentRef<'_> {
     /// Returns the plugin-controlled pointer associated with the document.
     ///
     /// This is mostly for internal use by this library and is usually unsafe
-    /// to dereference.
+    /// to dereference. For documents opened by this library, it points to the
+    /// library's own document data, which holds the document's arena and the
+    /// plugin's `DocumentData`, rather than to the `DocumentData` itself.
     pub fn plugin_data(&self) -> *mut () {
         unsafe { sys::zathura_document_get_data(self.ptr) as *mut () }
     }
@@ -233,10 +260,35 @@ impl DocumentRef<'_> {
     /// `ZathuraPlugin` trait already provides an associated `DocumentData`
     /// type, which can be used instead.
     ///
-    /// This library will assume that the plugin data is a
-    /// `*mut Plugin::DocumentData` obtained using `Box::into_raw`, and will
-    /// free the data automatically.
+    /// This library will assume that the plugin data points to its own
+    /// per-document data, which holds the document's arena and
+    /// `Plugin::DocumentData`, and will free the data automatically.
     pub unsafe fn set_plugin_data(&mut self, data: *mut ()) {
         sys::zathura_document_set_data(self.ptr, data as *mut _)
     }
 }
+
+impl<'a> DocumentRef<'a> {
+    /// Returns the document's arena, for data that lives until the document
+    /// is freed.
+    ///
+    /// See the `arena` module for details.
+    ///
+    /// # Safety
+    ///
+    /// The document must have been opened through this library's
+    /// `ZathuraPlugin` wrapper, like all documents passed to `ZathuraPlugin`
+    /// callbacks. For other documents, the plugin data isn't the wrapper's
+    /// and is misinterpreted.
+    pub unsafe fn arena(&self) -> &'a SyncArena {
+        arena(self.ptr)
+    }
+}
+
+/// Returns the arena of a document opened by the wrapper.
+pub(crate) unsafe fn arena<'a>(document: *mut sys::zathura_document_t) -> &'a SyncArena {
+    let slot = sys::zathura_document_get_data(document) as *const DocSlot<()>;
+    assert!(!slot.is_null(), "document has no plugin data");
+    // The arena is at the start of every `DocSlot`.
+    &(*slot).arena
+}
@@ -0,0 +1,624 @@
+//! A process-wide cache of rasterized glyphs.
+//!
+//! Text-heavy documents draw the same few hundred glyphs over and over, on
+//! every page and in every open document. Instead of letting Cairo rasterize
+//! each glyph again for every text run, [`show_glyph`] rasterizes a glyph once
+//! per font, glyph ID and (quantized) scale into a shared alpha atlas, and
+//! afterwards composites the cached mask directly onto the target surface.
+//!
+//! Glyphs are identified by plugin-chosen IDs: `font` should uniquely identify
+//! a font face and size within the plugin, and `glyph` a glyph within that
+//! font. Since the cache is shared by all plugins in the process, plugins
+//! should derive font IDs from something unique to them (such as a hash of the
+//! font file) rather than counting from 0.
+//!
+//! The cache only handles image surfaces being rendered for display, with a
+//! transformation that is an unrotated, uniform scale. Glyphs drawn with any
+//! other transformation (eg. when the document is rotated), onto vector
+//! surfaces, or for printing are rendered directly without caching, so that
+//! they stay outlines: Zathura prints to PDF or PostScript surfaces at 72
+//! units per inch, where cached glyphs would be printed as low-resolution
+//! bitmaps.
+//!
+//! [`show_glyph`]: fn.show_glyph.html
+
+use {
+    cairo::{Format, ImageSurface, SurfaceType},
+    std::{
+        collections::HashMap,
+        fmt, mem,
+        sync::{Mutex, MutexGuard, OnceLock, PoisonError},
+    },
+};
+
+/// Width and height of an atlas surface in pixels.
+const ATLAS_SIZE: i32 = 1024;
+
+/// Maximum number of atlas surfaces. When all atlases are full, the cache is
+/// cleared.
+const MAX_ATLASES: usize = 8;
+
+/// Number of horizontal subpixel positions glyphs are rasterized at.
+const SUBPIXEL_STEPS: f64 = 4.0;
+
+/// Scales are quantized to steps of roughly 0.5%, so glyphs are cached per
+/// zoom level without visible size differences.
+const SCALE_STEPS_PER_UNIT: f64 = 200.0;
+
+/// Bounding box of a glyph's ink relative to its origin, in font user units.
+///
+/// Like in Cairo, the Y axis points down, so the ascent of a glyph usually has
+/// a negative `y0`.
+#[derive(Debug, Copy, Clone, PartialEq)]
+pub struct GlyphBounds {
+    pub x0: f64,
+    pub y0: f64,
+    pub x1: f64,
+    pub y1: f64,
+}
+
+#[derive(Debug, Copy, Clone, PartialEq, Eq, Hash)]
+struct Key {
+    font: u64,
+    glyph: u32,
+    /// Logarithmically quantized pixel scale.
+    scale: i32,
+    /// Horizontal subpixel offset, in `1 / SUBPIXEL_STEPS` pixels.
+    subpixel: u8,
+}
+
+/// Location of a rasterized glyph in the atlases.
+#[derive(Debug, Copy, Clone)]
+struct Entry {
+    atlas: u16,
+    x: i32,
+    y: i32,
+    width: i32,
+    height: i32,
+    /// Offset of the glyph's raster from its (pixel-aligned) origin.
+    left: i32,
+    top: i32,
+}
+
+/// An A8 atlas surface, filled row by row ("shelf packing").
+///
+/// Glyphs are only added to the last atlas. Once a glyph doesn't fit into it
+/// anymore, a new atlas is started and the previous one is *sealed*: it is
+/// never written to again.
+struct Atlas {
+    surface: ImageSurface,
+    shelf_y: i32,
+    shelf_height: i32,
+    cursor_x: i32,
+}
+
+/// Statistics about the glyph cache.
+#[derive(Debug, Copy, Clone, Default, PartialEq, Eq)]
+pub struct GlyphCacheStats {
+    /// Number of cached glyph rasters.
+    pub glyphs: usize,
+    /// Number of allocated atlas surfaces.
+    pub atlases: usize,
+    /// Number of glyphs drawn from the cache.
+    pub hits: u64,
+    /// Number of glyphs that had to be rasterized.
+    pub misses: u64,
+}
+
+struct GlyphCache {
+    entries: HashMap<Key, Entry>,
+    atlases: Vec<Atlas>,
+    stats: GlyphCacheStats,
+}
+
+// Cairo surfaces are reference counted atomically and not bound to a thread,
+// but a surface must not be used as a source while it is being drawn to. The
+// last atlas is only drawn to and composited from while holding the cache's
+// mutex. Sealed atlases are never drawn to again, so they are composited
+// from outside of the lock, by any number of threads at once.
+unsafe impl Send for GlyphCache {}
+
+static CACHE: OnceLock<Mutex<GlyphCache>> = OnceLock::new();
+
+fn cache() -> MutexGuard<'static, GlyphCache> {
+    CACHE
+        .get_or_init(|| {
+            Mutex::new(GlyphCache {
+                entries: HashMap::new(),
+                atlases: Vec::new(),
+                stats: GlyphCacheStats::default(),
+            })
+        })
+        .lock()
+        // The cache is consistent whenever the lock is released, no code
+        // that can panic runs while it is held in an inconsistent state.
+        .unwrap_or_else(PoisonError::into_inner)
+}
+
+/// Returns the position and size of a glyph's raster rasterized at `scale`,
+/// as an entry that isn't placed in an atlas yet.
+fn extents(scale: f64, subpixel: f64, bounds: &GlyphBounds) -> Entry {
+    // Leave a 1 pixel margin for antialiasing.
+    let left = (bounds.x0 * scale + subpixel).floor() as i32 - 1;
+    let top = (bounds.y0 * scale).floor() as i32 - 1;
+    let right = (bounds.x1 * scale + subpixel).ceil() as i32 + 1;
+    let bottom = (bounds.y1 * scale).ceil() as i32 + 1;
+    Entry {
+        atlas: 0,
+        x: 0,
+        y: 0,
+        width: right - left,
+        height: bottom - top,
+        left,
+        top,
+    }
+}
+
+impl GlyphCache {
+    /// Returns whether the atlas at `index` is sealed.
+    fn is_sealed(&self, index: u16) -> bool {
+        usize::from(index) + 1 < self.atlases.len()
+    }
+
+    /// Reserves a `width` x `height` area in the last atlas, or in a new one
+    /// if it doesn't fit.
+    ///
+    /// Returns `None` if the area is larger than an atlas, or if all atlases
+    /// are full.
+    fn allocate(&mut self, width: i32, height: i32) -> Option<(u16, i32, i32)> {
+        if width > ATLAS_SIZE || height > ATLAS_SIZE {
+            return None;
+        }
+
+        let index = self.atlases.len().wrapping_sub(1) as u16;
+        if let Some(atlas) = self.atlases.last_mut() {
+            if atlas.cursor_x + width > ATLAS_SIZE {
+                // Start a new shelf below the current one.
+                atlas.shelf_y += atlas.shelf_height;
+                atlas.shelf_height = 0;
+                atlas.cursor_x = 0;
+            }
+            if atlas.shelf_y + height.max(atlas.shelf_height) <= ATLAS_SIZE {
+                let pos = (index, atlas.cursor_x, atlas.shelf_y);
+                atlas.cursor_x += width;
+                atlas.shelf_height = atlas.shelf_height.max(height);
+                return Some(pos);
+            }
+        }
+
+        if self.atlases.len() == MAX_ATLASES {
+            return None;
+        }
+        let surface = ImageSurface::create(Format::A8, ATLAS_SIZE, ATLAS_SIZE).ok()?;
+        self.atlases.push(Atlas {
+            surface,
+            shelf_y: 0,
+            shelf_height: height,
+            cursor_x: width,
+        });
+        Some((self.atlases.len() as u16 - 1, 0, 0))
+    }
+
+    /// Copies a rasterized glyph into an atlas and publishes its entry.
+    ///
+    /// When all atlases are full, the cache is cleared first; the atlases it
+    /// held are returned, so they can be freed after the lock was released.
+    /// Returns `None` if the glyph couldn't be stored.
+    fn insert(
+        &mut self,
+        key: Key,
+        raster: &Entry,
+        surface: &ImageSurface,
+    ) -> (Option<Entry>, Vec<Atlas>) {
+        // Another thread may have rasterized the same glyph in the meantime.
+        if let Some(entry) = self.entries.get(&key).copied() {
+            return (Some(entry), Vec::new());
+        }
+
+        let mut evicted = Vec::new();
+        let mut allocation = self.allocate(raster.width, raster.height);
+        if allocation.is_none() && self.atlases.len() == MAX_ATLASES {
+            evicted = self.clear();
+            allocation = self.allocate(raster.width, raster.height);
+        }
+        let (atlas, x, y) = match allocation {
+            Some(allocation) => allocation,
+            None => return (None, evicted),
+        };
+
+        let entry = Entry {
+            atlas,
+            x,
+            y,
+            ..*raster
+        };
+        let target = &self.atlases[atlas as usize].surface;
+        let cr = cairo::Context::new(target);
+        cr.set_operator(cairo::Operator::Source);
+        cr.set_source_surface(surface, x.into(), y.into());
+        cr.rectangle(
+            x.into(),
+            y.into(),
+            raster.width.into(),
+            raster.height.into(),
+        );
+        cr.fill();
+        target.flush();
+
+        self.stats.misses += 1;
+        self.entries.insert(key, entry);
+        (Some(entry), evicted)
+    }
+
+    /// Removes all glyphs and returns the atlases they were stored in.
+    ///
+    /// Atlases are replaced rather than reused, since other threads may still
+    /// be compositing from sealed ones.
+    fn clear(&mut self) -> Vec<Atlas> {
+        self.entries.clear();
+        mem::take(&mut self.atlases)
+    }
+}
+
+/// Rasterizes a glyph into a new surface of the size given by `raster`.
+///
+/// Returns `Err(draw)` if the surface couldn't be created.
+fn rasterize<F>(raster: &Entry, scale: f64, subpixel: f64, draw: F) -> Result<ImageSurface, F>
+where
+    F: FnOnce(&cairo::Context),
+{
+    let surface = match ImageSurface::create(Format::A8, raster.width, raster.height) {
+        Ok(surface) => surface,
+        Err(_) => return Err(draw),
+    };
+    let cr = cairo::Context::new(&surface);
+    cr.translate(f64::from(-raster.left) + subpixel, f64::from(-raster.top));
+    cr.scale(scale, scale);
+    draw(&cr);
+    drop(cr);
+    surface.flush();
+    Ok(surface)
+}
+
+/// Draws a glyph with its origin at `(x, y)` in user space, using the
+/// context's current source.
+///
+/// If the glyph is not cached at the current scale, `draw` is called to
+/// rasterize it into the cache. It must draw the glyph with its origin at
+/// `(0, 0)` in font user units, and must not draw outside of `bounds`. The
+/// Cairo context passed to `draw` should only be used for filling paths (or
+/// other operations that generate coverage); its source color is ignored.
+/// The cache isn't locked while `draw` runs, so it may draw other glyphs
+/// with `show_glyph` itself.
+///
+/// `printing` is the flag passed to the plugin's `page_render`. When
+/// printing, if the target isn't an image surface, if the context is rotated
+/// or scaled non-uniformly, or if the glyph can't be cached, `draw` is called
+/// on `cairo` directly, translated to `(x, y)`.
+pub fn show_glyph<F>(
+    cairo: &cairo::Context,
+    font: u64,
+    glyph: u32,
+    x: f64,
+    y: f64,
+    bounds: &GlyphBounds,
+    printing: bool,
+    draw: F,
+) where
+    F: FnOnce(&cairo::Context),
+{
+    let target = cairo.get_target();
+    if printing || target.get_type() != SurfaceType::Image {
+        draw_uncached(cairo, x, y, draw);
+        return;
+    }
+
+    let matrix = cairo.get_matrix();
+    let (device_x, device_y) = target.get_device_scale();
+    let scale = matrix.xx * device_x;
+
+    let cacheable = matrix.xy == 0.0
+        && matrix.yx == 0.0
+        && matrix.xx > 0.0
+        && matrix.yy * device_y == scale
+        && bounds.x0 < bounds.x1
+        && bounds.y0 < bounds.y1;
+    if !cacheable {
+        draw_uncached(cairo, x, y, draw);
+        return;
+    }
+
+    // Origin of the glyph in device pixels.
+    let (origin_x, origin_y) = cairo.user_to_device(x, y);
+    let (origin_x, origin_y) = (origin_x * device_x, (origin_y * device_y).round());
+    let mut pixel_x = origin_x.floor();
+    let mut subpixel = ((origin_x - pixel_x) * SUBPIXEL_STEPS).round();
+    if subpixel == SUBPIXEL_STEPS {
+        pixel_x += 1.0;
+        subpixel = 0.0;
+    }
+
+    let quantized = (scale.ln() * SCALE_STEPS_PER_UNIT).round();
+    let key = Key {
+        font,
+        glyph,
+        scale: quantized as i32,
+        subpixel: subpixel as u8,
+    };
+
+    let mut cache = cache();
+    let mut evicted = Vec::new();
+    let entry = match cache.entries.get(&key).copied() {
+        Some(entry) => {
+            cache.stats.hits += 1;
+            entry
+        }
+        None => {
+            drop(cache);
+            let scale = (quantized / SCALE_STEPS_PER_UNIT).exp();
+            let subpixel = subpixel / SUBPIXEL_STEPS;
+            let raster = extents(scale, subpixel, bounds);
+            // Glyphs larger than an atlas are not cached.
+            if raster.width > ATLAS_SIZE || raster.height > ATLAS_SIZE {
+                draw_uncached(cairo, x, y, draw);
+                return;
+            }
+            let surface = match rasterize(&raster, scale, subpixel, draw) {
+                Ok(surface) => surface,
+                Err(draw) => {
+                    draw_uncached(cairo, x, y, draw);
+                    return;
+                }
+            };
+
+            cache = self::cache();
+            let (published, cleared) = cache.insert(key, &raster, &surface);
+            evicted = cleared;
+            match published {
+                Some(entry) => entry,
+                None => {
+                    // The glyph couldn't be stored, so it is drawn from its
+                    // raster.
+                    drop(cache);
+                    let origin = (pixel_x as i32, origin_y as i32);
+                    composite(cairo, &surface, &raster, origin, (device_x, device_y));
+                    return;
+                }
+            }
+        }
+    };
+
+    let origin = (pixel_x as i32, origin_y as i32);
+    let atlas = &cache.atlases[entry.atlas as usize].surface;
+    if cache.is_sealed(entry.atlas) {
+        let atlas = atlas.clone();
+        drop(cache);
+        composite(cairo, &atlas, &entry, origin, (device_x, device_y));
+    } else {
+        // The last atlas may be drawn to by other threads as soon as the
+        // lock is released.
+        composite(cairo, atlas, &entry, origin, (device_x, device_y));
+        drop(cache);
+    }
+    drop(evicted);
+}
+
+/// Masks the current source of `cairo` with the glyph `entry` of `source`,
+/// placed at the glyph origin `origin` in device pixels.
+fn composite(
+    cairo: &cairo::Context,
+    source: &ImageSurface,
+    entry: &Entry,
+    origin: (i32, i32),
+    (device_x, device_y): (f64, f64),
+) {
+    let (dest_x, dest_y) = (origin.0 + entry.left, origin.1 + entry.top);
+    cairo.save();
+    cairo.identity_matrix();
+    cairo.scale(1.0 / device_x, 1.0 / device_y);
+    cairo.rectangle(
+        dest_x.into(),
+        dest_y.into(),
+        entry.width.into(),
+        entry.height.into(),
+    );
+    cairo.clip();
+    cairo.mask_surface(
+        source,
+        f64::from(dest_x - entry.x),
+        f64::from(dest_y - entry.y),
+    );
+    cairo.restore();
+}
+
+fn draw_uncached(cairo: &cairo::Context, x: f64, y: f64, draw: impl FnOnce(&cairo::Context)) {
+    cairo.save();
+    cairo.translate(x, y);
+    draw(cairo);
+    cairo.restore();
+}
+
+/// Returns statistics about the glyph cache.
+pub fn stats() -> GlyphCacheStats {
+    let cache = cache();
+    GlyphCacheStats {
+        glyphs: cache.entries.len(),
+        atlases: cache.atlases.len(),
+        ..cache.stats
+    }
+}
+
+/// Removes all glyphs from the cache and frees the atlas memory.
+pub fn clear() {
+    let evicted = cache().clear();
+    drop(evicted);
+}
+
+impl fmt::Debug for GlyphCache {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        f.debug_struct("GlyphCache")
+            .field("glyphs", &self.entries.len())
+            .field("atlases", &self.atlases.len())
+            .finish()
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use {
+        super::*,
+        cairo::{Content, RecordingSurface},
+        std::{cell::Cell, sync::Mutex},
+    };
+
+    /// Serializes the tests that use the process-wide cache, so they can
+    /// check how its statistics changed.
+    static GLOBAL: Mutex<()> = Mutex::new(());
+
+    const BOUNDS: GlyphBounds = GlyphBounds {
+        x0: 0.0,
+        y0: -8.0,
+        x1: 6.0,
+        y1: 2.0,
+    };
+
+    /// How a glyph was drawn.
+    #[derive(Debug, PartialEq)]
+    enum Drawn {
+        /// From the cache.
+        Hit,
+        /// Rasterized into the cache.
+        Miss,
+        /// Directly onto the context, bypassing the cache.
+        Direct,
+    }
+    use self::Drawn::*;
+
+    fn context() -> cairo::Context {
+        let surface = ImageSurface::create(Format::ARgb32, 100, 100).unwrap();
+        cairo::Context::new(&surface)
+    }
+
+    /// Draws glyph 1 of `font` at `(x, 10)`.
+    fn show(cairo: &cairo::Context, font: u64, x: f64, bounds: &GlyphBounds) -> Drawn {
+        let calls = Cell::new(0);
+        let direct = Cell::new(false);
+        let before = stats();
+        show_glyph(cairo, font, 1, x, 10.0, bounds, false, |cr| {
+            calls.set(calls.get() + 1);
+            direct.set(cr.to_raw_none() == cairo.to_raw_none());
+        });
+        let after = stats();
+        let counted = (after.hits - before.hits, after.misses - before.misses);
+        match (calls.get(), direct.get(), counted) {
+            (0, _, (1, 0)) => Hit,
+            (1, false, (0, 1)) => Miss,
+            (1, true, (0, 0)) => Direct,
+            drawn => panic!("unexpected calls, direct and stats: {:?}", drawn),
+        }
+    }
+
+    #[test]
+    fn glyphs_are_rasterized_once_per_scale_and_subpixel_offset() {
+        let _global = GLOBAL.lock().unwrap_or_else(PoisonError::into_inner);
+        let cr = context();
+        let font = 0x5EED_0001;
+
+        assert_eq!(show(&cr, font, 10.0, &BOUNDS), Miss);
+        assert_eq!(show(&cr, font, 10.0, &BOUNDS), Hit);
+        // Another whole pixel position.
+        assert_eq!(show(&cr, font, 30.0, &BOUNDS), Hit);
+        // Another subpixel offset. Offsets are quantized to a quarter pixel.
+        assert_eq!(show(&cr, font, 10.5, &BOUNDS), Miss);
+        assert_eq!(show(&cr, font, 20.49, &BOUNDS), Hit);
+        // Fonts don't share glyphs.
+        assert_eq!(show(&cr, font + 1, 10.0, &BOUNDS), Miss);
+
+        // Another scale...
+        cr.scale(2.0, 2.0);
+        assert_eq!(show(&cr, font, 10.0, &BOUNDS), Miss);
+        // ...but not a visibly different one.
+        cr.scale(1.001, 1.001);
+        assert_eq!(show(&cr, font, 10.0, &BOUNDS), Hit);
+    }
+
+    #[test]
+    fn uncacheable_glyphs_are_drawn_directly() {
+        let _global = GLOBAL.lock().unwrap_or_else(PoisonError::into_inner);
+        let font = 0x5EED_0003;
+
+        let rotated = context();
+        rotated.rotate(0.5);
+        let stretched = context();
+        stretched.scale(1.0, 2.0);
+        let mirrored = context();
+        mirrored.scale(-1.0, 1.0);
+        for cr in &[rotated, stretched, mirrored] {
+            assert_eq!(show(cr, font, 10.0, &BOUNDS), Direct);
+            assert_eq!(show(cr, font, 10.0, &BOUNDS), Direct);
+        }
+
+        // Glyphs without ink, and glyphs larger than an atlas.
+        let empty = GlyphBounds { x1: 0.0, ..BOUNDS };
+        let huge = GlyphBounds {
+            x1: f64::from(ATLAS_SIZE),
+            ..BOUNDS
+        };
+        for bounds in &[empty, huge] {
+            assert_eq!(show(&context(), font, 10.0, bounds), Direct);
+            assert_eq!(show(&context(), font, 10.0, bounds), Direct);
+        }
+    }
+
+    #[test]
+    fn glyphs_are_drawn_as_outlines_when_printing() {
+        let _global = GLOBAL.lock().unwrap_or_else(PoisonError::into_inner);
+        let font = 0x5EED_0004;
+
+        // Zathura prints to vector surfaces at 1 unit per point.
+        let surface = RecordingSurface::create(Content::ColorAlpha, None).unwrap();
+        let vector = cairo::Context::new(&surface);
+        assert_eq!(show(&vector, font, 10.0, &BOUNDS), Direct);
+        assert_eq!(show(&vector, font, 10.0, &BOUNDS), Direct);
+
+        // Image surfaces aren't cached either when printing.
+        let image = context();
+        let printed = |x| {
+            let before = stats();
+            let mut direct = false;
+            show_glyph(&image, font, 1, x, 10.0, &BOUNDS, true, |cr| {
+                direct = cr.to_raw_none() == image.to_raw_none();
+            });
+            assert_eq!(stats(), before);
+            direct
+        };
+        assert!(printed(10.0));
+        assert!(printed(10.0));
+    }
+
+    #[test]
+    fn only_the_last_atlas_is_written_to() {
+        let mut cache = GlyphCache {
+            entries: HashMap::new(),
+            atlases: Vec::new(),
+            stats: GlyphCacheStats::default(),
+        };
+
+        assert_eq!(cache.allocate(600, 600), Some((0, 0, 0)));
+        assert!(!cache.is_sealed(0));
+        // Doesn't fit next to or below the first area.
+        assert_eq!(cache.allocate(600, 600), Some((1, 0, 0)));
+        assert!(cache.is_sealed(0) && !cache.is_sealed(1));
+        // Would fit next to the first area, but the first atlas is sealed.
+        assert_eq!(cache.allocate(10, 10), Some((1, 600, 0)));
+        assert_eq!(cache.allocate(ATLAS_SIZE, 10), Some((1, 0, 600)));
+
+        while cache.atlases.len() < MAX_ATLASES {
+            cache.allocate(ATLAS_SIZE, ATLAS_SIZE).unwrap();
+        }
+        assert_eq!(cache.allocate(1, 1), None);
+        assert_eq!(cache.allocate(ATLAS_SIZE + 1, 1), None);
+        assert_eq!(cache.clear().len(), MAX_ATLASES);
+        assert_eq!(cache.allocate(1, 1), Some((0, 0, 0)));
+    }
+}
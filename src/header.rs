@@ -0,0 +1,311 @@
+//! Sniffing of a document's file format from its first bytes.
+
+use std::{
+    cell::RefCell,
+    ffi::OsStr,
+    fmt,
+    fs::File,
+    io::{self, Read},
+    os::unix::ffi::OsStrExt,
+    path::Path,
+};
+
+/// The first bytes of a document's file.
+///
+/// Obtained from `DocumentRef::file_header`. This contains at most the first
+/// [`FileHeader::SIZE`] bytes of the file, which is enough to identify most
+/// formats by their magic numbers and to parse a format's header without
+/// reading from the file again.
+///
+/// [`FileHeader::SIZE`]: #associatedconstant.SIZE
+#[derive(Clone)]
+pub struct FileHeader {
+    buf: [u8; FileHeader::SIZE],
+    len: usize,
+}
+
+/// How much a magic number says about the format of a file.
+#[derive(Debug, Copy, Clone, PartialEq, Eq)]
+enum Evidence {
+    /// The magic number identifies the format.
+    Conclusive,
+    /// The magic number is short and printable, so plain text files may
+    /// start with it as well.
+    Weak,
+    /// The format is a container (eg. an archive) that many other formats
+    /// are built on, like CBZ on ZIP.
+    Container,
+}
+
+use self::Evidence::*;
+
+/// Known magic numbers: offset, magic bytes, MIME type and what a match says
+/// about the format.
+///
+/// More specific entries must come before less specific ones with the same
+/// prefix.
+const MAGIC: &[(usize, &[u8], &str, Evidence)] = &[
+    (0, b"%PDF-", "application/pdf", Conclusive),
+    (0, b"%!PS", "application/postscript", Conclusive),
+    (0, b"\xC5\xD0\xD3\xC6", "application/postscript", Conclusive), // DOS EPS binary
+    (0, b"AT&TFORM", "image/vnd.djvu", Conclusive),
+    (0, b"\xF7\x02", "application/x-dvi", Conclusive),
+    (0, b"\x89PNG\r\n\x1A\n", "image/png", Conclusive),
+    (0, b"\xFF\xD8\xFF", "image/jpeg", Conclusive),
+    (0, b"GIF87a", "image/gif", Conclusive),
+    (0, b"GIF89a", "image/gif", Conclusive),
+    (0, b"II*\0", "image/tiff", Conclusive),
+    (0, b"MM\0*", "image/tiff", Conclusive),
+    (0, b"BM", "image/bmp", Weak),
+    (
+        30,
+        b"mimetypeapplication/epub+zip",
+        "application/epub+zip",
+        Conclusive,
+    ),
+    (0, b"PK\x03\x04", "application/zip", Container),
+    (0, b"Rar!\x1A\x07", "application/vnd.rar", Container),
+    (
+        0,
+        b"7z\xBC\xAF\x27\x1C",
+        "application/x-7z-compressed",
+        Container,
+    ),
+    (0, b"\x1F\x8B", "application/gzip", Container),
+    (0, b"BZh", "application/x-bzip2", Container),
+    (0, b"\xFD7zXZ\0", "application/x-xz", Container),
+];
+
+impl FileHeader {
+    /// The maximum number of bytes read from the start of the file.
+    pub const SIZE: usize = 4096;
+
+    /// Reads the header of the file at `path`.
+    pub fn read(path: &Path) -> io::Result<Self> {
+        let mut header = FileHeader {
+            buf: [0; Self::SIZE],
+            len: 0,
+        };
+
+        let mut file = File::open(path)?;
+        while header.len < Self::SIZE {
+            match file.read(&mut header.buf[header.len..]) {
+                Ok(0) => break,
+                Ok(n) => header.len += n,
+                Err(ref e) if e.kind() == io::ErrorKind::Interrupted => {}
+                Err(e) => return Err(e),
+            }
+        }
+
+        Ok(header)
+    }
+
+    /// Returns the header bytes.
+    ///
+    /// This is shorter than `FileHeader::SIZE` only if the file itself is
+    /// shorter.
+    pub fn bytes(&self) -> &[u8] {
+        &self.buf[..self.len]
+    }
+
+    /// Returns whether the header contains `magic` at `offset`.
+    pub fn matches(&self, offset: usize, magic: &[u8]) -> bool {
+        let end = match offset.checked_add(magic.len()) {
+            Some(end) => end,
+            None => return false,
+        };
+        self.bytes()
+            .get(offset..end)
+            .map_or(false, |bytes| bytes == magic)
+    }
+
+    /// Determines the MIME type of the file from its magic number.
+    ///
+    /// This recognizes common document, image and archive formats. Returns
+    /// `None` if the format is not recognized.
+    pub fn mime_type(&self) -> Option<&'static str> {
+        self.sniff().map(|(mime, _)| mime)
+    }
+
+    /// Like `mime_type`, but only returns formats that the magic number
+    /// identifies for certain.
+    ///
+    /// Containers (like ZIP, which CBZ and EPUB files are as well) and magic
+    /// numbers that plain text can start with (like `BM` for BMP) are
+    /// reported as `None`, since files of other formats match them too.
+    pub(crate) fn conclusive_mime_type(&self) -> Option<&'static str> {
+        match self.sniff() {
+            Some((mime, Conclusive)) => Some(mime),
+            _ => None,
+        }
+    }
+
+    fn sniff(&self) -> Option<(&'static str, Evidence)> {
+        MAGIC
+            .iter()
+            .find(|(offset, magic, ..)| self.matches(*offset, magic))
+            .map(|&(_, _, mime, evidence)| (mime, evidence))
+    }
+}
+
+impl fmt::Debug for FileHeader {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        f.debug_struct("FileHeader")
+            .field("len", &self.len)
+            .field("mime_type", &self.mime_type())
+            .finish()
+    }
+}
+
+thread_local! {
+    /// Header of the document currently being opened on this thread, if a
+    /// document is being opened.
+    ///
+    /// The header is read at most once per `document_open` call, even if
+    /// several plugins of a `Chain` look at it. Outside of `document_open`,
+    /// nothing is cached: the cache is keyed by the document's address, which
+    /// may be reused by a later document.
+    static CURRENT: RefCell<Option<Option<(usize, FileHeader)>>> = RefCell::new(None);
+}
+
+/// Returns the header of the document with the given address, reading it
+/// from `path` unless it is cached.
+pub(crate) fn cached(document: usize, path: &[u8]) -> io::Result<FileHeader> {
+    CURRENT.with(|current| {
+        let opening = match &*current.borrow() {
+            Some(Some((doc, header))) if *doc == document => return Ok(header.clone()),
+            Some(_) => true,
+            None => false,
+        };
+
+        let header = FileHeader::read(Path::new(OsStr::from_bytes(path)))?;
+        if opening {
+            *current.borrow_mut() = Some(Some((document, header.clone())));
+        }
+        Ok(header)
+    })
+}
+
+/// Enables the header cache on this thread while a document is being opened.
+/// The cache is cleared again when this is dropped.
+pub(crate) struct Opening(());
+
+impl Opening {
+    pub(crate) fn start() -> Self {
+        CURRENT.with(|current| *current.borrow_mut() = Some(None));
+        Opening(())
+    }
+}
+
+impl Drop for Opening {
+    fn drop(&mut self) {
+        CURRENT.with(|current| *current.borrow_mut() = None);
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use {
+        super::*,
+        std::{env, fs, path::PathBuf, process},
+    };
+
+    fn header(bytes: &[u8]) -> FileHeader {
+        let mut header = FileHeader {
+            buf: [0; FileHeader::SIZE],
+            len: bytes.len(),
+        };
+        header.buf[..bytes.len()].copy_from_slice(bytes);
+        header
+    }
+
+    /// Writes `bytes` to a temporary file named after `name`.
+    fn file(name: &str, bytes: &[u8]) -> PathBuf {
+        let path =
+            env::temp_dir().join(format!("zathura-plugin-header-{}-{}", process::id(), name));
+        fs::write(&path, bytes).unwrap();
+        path
+    }
+
+    #[test]
+    fn magic_numbers_are_classified() {
+        let pdf = header(b"%PDF-1.7\n");
+        assert_eq!(pdf.mime_type(), Some("application/pdf"));
+        assert_eq!(pdf.conclusive_mime_type(), Some("application/pdf"));
+
+        // Plain text can start with `BM`.
+        let bmp = header(b"BM6\x0C\0\0");
+        assert_eq!(bmp.mime_type(), Some("image/bmp"));
+        assert_eq!(bmp.conclusive_mime_type(), None);
+
+        // A ZIP file is only known to be an EPUB if it says so.
+        let zip = header(b"PK\x03\x04\x14\0\0\0");
+        assert_eq!(zip.mime_type(), Some("application/zip"));
+        assert_eq!(zip.conclusive_mime_type(), None);
+        let mut epub = b"PK\x03\x04".to_vec();
+        epub.resize(30, 0);
+        epub.extend_from_slice(b"mimetypeapplication/epub+zip");
+        assert_eq!(header(&epub).mime_type(), Some("application/epub+zip"));
+        assert_eq!(
+            header(&epub).conclusive_mime_type(),
+            Some("application/epub+zip")
+        );
+
+        let text = header(b"Hello, world\n");
+        assert_eq!(text.mime_type(), None);
+        assert_eq!(text.conclusive_mime_type(), None);
+    }
+
+    #[test]
+    fn short_headers_match_nothing_beyond_their_end() {
+        let empty = header(b"");
+        assert_eq!(empty.bytes(), b"");
+        assert_eq!(empty.mime_type(), None);
+        assert!(empty.matches(0, b""));
+        assert!(!empty.matches(0, b"%"));
+
+        // A prefix of a magic number is not a match.
+        assert_eq!(header(b"%PD").mime_type(), None);
+        assert_eq!(header(b"\x89PNG").mime_type(), None);
+        assert!(!header(b"%PDF-").matches(3, b"F-1"));
+        assert!(!header(b"%PDF-").matches(usize::MAX, b"x"));
+
+        // Files shorter than `SIZE` are read completely, longer ones are cut
+        // off.
+        let short = file("short", b"%PDF");
+        assert_eq!(FileHeader::read(&short).unwrap().bytes(), b"%PDF");
+        let long = file("long", &[b'x'; FileHeader::SIZE + 1]);
+        assert_eq!(
+            FileHeader::read(&long).unwrap().bytes().len(),
+            FileHeader::SIZE
+        );
+        fs::remove_file(short).unwrap();
+        fs::remove_file(long).unwrap();
+    }
+
+    #[test]
+    fn headers_are_only_cached_while_opening() {
+        let path = file("cache", b"%PDF-1.4");
+        let bytes = path.as_os_str().as_bytes();
+        let document = 0x1000;
+
+        // Outside of `document_open`, the file is read every time.
+        assert_eq!(cached(document, bytes).unwrap().bytes(), b"%PDF-1.4");
+        fs::write(&path, b"%!PS").unwrap();
+        assert_eq!(cached(document, bytes).unwrap().bytes(), b"%!PS");
+
+        {
+            let _opening = Opening::start();
+            assert_eq!(cached(document, bytes).unwrap().bytes(), b"%!PS");
+            fs::write(&path, b"GIF89a").unwrap();
+            assert_eq!(cached(document, bytes).unwrap().bytes(), b"%!PS");
+            // Only for the document being opened.
+            assert_eq!(cached(document + 1, bytes).unwrap().bytes(), b"GIF89a");
+        }
+
+        // The cache is gone with the guard.
+        assert_eq!(cached(document, bytes).unwrap().bytes(), b"GIF89a");
+        fs::remove_file(&path).unwrap();
+        assert!(cached(document, bytes).is_err());
+    }
+}
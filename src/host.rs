@@ -0,0 +1,555 @@
+//! A minimal stand-in for Zathura, for testing and benchmarking plugins.
+//!
+//! This module implements the `zathura_document_*`, `zathura_page_*` and
+//! `girara_list_*` functions used by this library, so that plugins can be
+//! driven through the same `extern "C"` trampolines Zathura calls, without
+//! Zathura. A [`Document`] opens a file with a plugin type, initializes its
+//! pages, and renders or searches them.
+//!
+//! This module is only available with the `host` feature. **Never enable this
+//! feature in a plugin that is loaded into Zathura**: the functions defined
+//! here would take the place of Zathura's own.
+//!
+//! [`Document`]: struct.Document.html
+
+use {
+    crate::{sys, wrapper, PluginError, ZathuraPlugin},
+    cairo::{Format, ImageSurface},
+    std::{
+        ffi::{CString, OsStr},
+        os::{
+            raw::{c_char, c_uint, c_void},
+            unix::ffi::OsStrExt,
+        },
+        path::Path,
+        ptr,
+    },
+};
+
+struct RawDocument {
+    path: CString,
+    basename: CString,
+    page_count: c_uint,
+    current_page: c_uint,
+    zoom: f64,
+    scale: f64,
+    rotation: c_uint,
+    viewport_ppi: f64,
+    device_factors: sys::zathura_device_factors_t,
+    data: *mut c_void,
+    pages: Vec<Box<RawPage>>,
+}
+
+struct RawList {
+    items: Vec<*mut c_void>,
+    free: sys::girara_free_function_t,
+}
+
+impl Drop for RawList {
+    fn drop(&mut self) {
+        if let Some(free) = self.free {
+            for &item in &self.items {
+                unsafe { free(item) }
+            }
+        }
+    }
+}
+
+struct RawPage {
+    document: *mut RawDocument,
+    index: c_uint,
+    width: f64,
+    height: f64,
+    data: *mut c_void,
+}
+
+fn check(error: sys::zathura_error_t) -> Result<(), PluginError> {
+    PluginError::from_raw(error).unwrap_or(Err(PluginError::Unknown))
+}
+
+/// A document opened by a plugin.
+///
+/// The document's view state (scale, rotation, current page, ...) starts out
+/// like in a freshly opened Zathura window on a non-HiDPI screen, and can be
+/// changed with the setters.
+///
+/// When dropped, the pages are cleared and the document is freed, like when
+/// closing it in Zathura.
+pub struct Document {
+    raw: Box<RawDocument>,
+    functions: sys::zathura_plugin_functions_t,
+    /// Number of pages `page_init` has been called for.
+    initialized_pages: usize,
+}
+
+impl Document {
+    /// Opens the file at `path` with plugin `P` and initializes all pages.
+    pub fn open<P: ZathuraPlugin>(path: impl AsRef<Path>) -> Result<Self, PluginError> {
+        unsafe { Self::open_raw(wrapper::functions::<P>(), path) }
+    }
+
+    /// Opens the file at `path` with the plugin implementing `functions`, and
+    /// initializes all pages.
+    ///
+    /// This can drive any plugin, including ones written in C that were loaded
+    /// with `dlopen`.
+    ///
+    /// # Safety
+    ///
+    /// `functions` must be the function table of a Zathura plugin, with at
+    /// least `document_open`, `page_init` and `page_render_cairo` filled in,
+    /// and the plugin must remain loaded until the document is dropped.
+    pub unsafe fn open_raw(
+        functions: sys::zathura_plugin_functions_t,
+        path: impl AsRef<Path>,
+    ) -> Result<Self, PluginError> {
+        let path = path.as_ref();
+        let to_cstring =
+            |s: &OsStr| CString::new(s.as_bytes()).map_err(|_| PluginError::InvalidArguments);
+        let mut document = Document {
+            raw: Box::new(RawDocument {
+                path: to_cstring(path.as_os_str())?,
+                basename: to_cstring(path.file_name().unwrap_or_default())?,
+                page_count: 0,
+                current_page: 0,
+                zoom: 1.0,
+                scale: 1.0,
+                rotation: 0,
+                viewport_ppi: 0.0,
+                device_factors: sys::zathura_device_factors_t { x: 1.0, y: 1.0 },
+                data: ptr::null_mut(),
+                pages: Vec::new(),
+            }),
+            functions,
+            initialized_pages: 0,
+        };
+
+        // If opening fails, dropping `document` calls `document_free` with the
+        // document's data pointer, like Zathura does.
+        check(document.functions.document_open.unwrap()(document.as_ptr()))?;
+
+        let doc_ptr = &mut *document.raw as *mut RawDocument;
+        document.raw.pages = (0..document.raw.page_count)
+            .map(|index| {
+                Box::new(RawPage {
+                    document: doc_ptr,
+                    index,
+                    width: 0.0,
+                    height: 0.0,
+                    data: ptr::null_mut(),
+                })
+            })
+            .collect();
+        document.init_pages()?;
+        Ok(document)
+    }
+
+    fn as_ptr(&mut self) -> *mut sys::zathura_document_t {
+        &mut *self.raw as *mut RawDocument as *mut _
+    }
+
+    fn page_ptr(&mut self, index: usize) -> *mut sys::zathura_page_t {
+        &mut *self.raw.pages[index] as *mut RawPage as *mut _
+    }
+
+    /// Calls the plugin's `page_init` for all pages.
+    ///
+    /// This is done by `open`, and only needs to be called again after
+    /// `clear_pages`.
+    pub fn init_pages(&mut self) -> Result<(), PluginError> {
+        while self.initialized_pages < self.raw.pages.len() {
+            let index = self.initialized_pages;
+            let page = self.page_ptr(index);
+            if let Err(e) = unsafe { check(self.functions.page_init.unwrap()(page)) } {
+                // Like Zathura, free the page that failed to initialize.
+                if let Some(page_clear) = self.functions.page_clear {
+                    let data = self.raw.pages[index].data;
+                    unsafe { page_clear(page, data) };
+                }
+                self.raw.pages[index].data = ptr::null_mut();
+                return Err(e);
+            }
+            self.initialized_pages += 1;
+        }
+        Ok(())
+    }
+
+    /// Calls the plugin's `page_clear` for all pages.
+    pub fn clear_pages(&mut self) -> Result<(), PluginError> {
+        let mut result = Ok(());
+        for index in 0..self.initialized_pages {
+            let page = self.page_ptr(index);
+            let data = self.raw.pages[index].data;
+            let r = match self.functions.page_clear {
+                Some(page_clear) => unsafe { check(page_clear(page, data)) },
+                None => Ok(()),
+            };
+            self.raw.pages[index].data = ptr::null_mut();
+            result = result.and(r);
+        }
+        self.initialized_pages = 0;
+        result
+    }
+
+    /// Renders page `index` to `cairo`.
+    ///
+    /// Like Zathura, this passes `cairo` on unmodified; callers have to set up
+    /// the page's transformation themselves.
+    ///
+    /// # Panics
+    ///
+    /// Panics if page `index` doesn't exist or is not initialized.
+    pub fn render(
+        &mut self,
+        index: usize,
+        cairo: &cairo::Context,
+        printing: bool,
+    ) -> Result<(), PluginError> {
+        assert!(index < self.initialized_pages, "page is not initialized");
+        let page = self.page_ptr(index);
+        let data = self.raw.pages[index].data;
+        unsafe {
+            check(self.functions.page_render_cairo.unwrap()(
+                page,
+                data,
+                cairo.to_raw_none() as *mut _,
+                printing,
+            ))
+        }
+    }
+
+    /// Renders page `index` like Zathura does for display, and returns the
+    /// resulting surface.
+    ///
+    /// Like Zathura, this creates a new surface sized to the page at the
+    /// current scale and scaling factors, fills it with white, and scales the
+    /// context so that the page fills the surface. Rotation is applied by
+    /// Zathura when displaying the surface, so it is not applied here either.
+    pub fn render_page(&mut self, index: usize) -> Result<ImageSurface, PluginError> {
+        let (width, height) = self.page_size(index);
+        if width <= 0.0 || height <= 0.0 {
+            return Err(PluginError::InvalidArguments);
+        }
+
+        let scale = self.raw.scale;
+        let (page_width, page_height) = ((width * scale).ceil(), (height * scale).ceil());
+        let factors = self.raw.device_factors;
+        let surface = ImageSurface::create(
+            Format::ARgb32,
+            (page_width * factors.x) as i32,
+            (page_height * factors.y) as i32,
+        )
+        .map_err(|_| PluginError::OutOfMemory)?;
+        surface.set_device_scale(factors.x, factors.y);
+
+        {
+            let cairo = cairo::Context::new(&surface);
+            cairo.set_source_rgb(1.0, 1.0, 1.0);
+            cairo.paint();
+            let real_scale = page_width / width;
+            cairo.scale(real_scale, real_scale);
+            self.render(index, &cairo, false)?;
+        }
+        surface.flush();
+        Ok(surface)
+    }
+
+    /// Searches page `index` for `text` and returns the rectangles of all
+    /// matches.
+    ///
+    /// Returns `PluginError::NotImplemented` if the plugin doesn't support
+    /// searching.
+    ///
+    /// # Panics
+    ///
+    /// Panics if page `index` doesn't exist or is not initialized.
+    pub fn search(
+        &mut self,
+        index: usize,
+        text: &str,
+    ) -> Result<Vec<sys::zathura_rectangle_t>, PluginError> {
+        assert!(index < self.initialized_pages, "page is not initialized");
+        let search = self
+            .functions
+            .page_search_text
+            .ok_or(PluginError::NotImplemented)?;
+        let text = CString::new(text).map_err(|_| PluginError::InvalidArguments)?;
+        let page = self.page_ptr(index);
+        let data = self.raw.pages[index].data;
+        let mut error = 0;
+        let list = unsafe { search(page, data, text.as_ptr(), &mut error) };
+        if list.is_null() {
+            check(error)?;
+            return Err(PluginError::Unknown);
+        }
+
+        // The list is freed with its free function, like Zathura does.
+        let list = unsafe { Box::from_raw(list as *mut RawList) };
+        Ok(list
+            .items
+            .iter()
+            .map(|&rectangle| unsafe { *(rectangle as *const sys::zathura_rectangle_t) })
+            .collect())
+    }
+
+    /// Returns the number of pages reported by the plugin.
+    pub fn page_count(&self) -> usize {
+        self.raw.pages.len()
+    }
+
+    /// Returns the width and height of page `index` in points, as set by the
+    /// plugin.
+    pub fn page_size(&self, index: usize) -> (f64, f64) {
+        let page = &self.raw.pages[index];
+        (page.width, page.height)
+    }
+
+    /// Sets the index of the page the user is looking at.
+    pub fn set_current_page(&mut self, index: u32) {
+        self.raw.current_page = index;
+    }
+
+    /// Sets the zoom level and render scale.
+    pub fn set_scale(&mut self, zoom: f64, scale: f64) {
+        self.raw.zoom = zoom;
+        self.raw.scale = scale;
+    }
+
+    /// Sets the rotation in degrees (0, 90, 180 or 270).
+    pub fn set_rotation(&mut self, rotation: u32) {
+        self.raw.rotation = rotation;
+    }
+
+    /// Sets the viewport's pixels per inch.
+    pub fn set_viewport_ppi(&mut self, ppi: f64) {
+        self.raw.viewport_ppi = ppi;
+    }
+
+    /// Sets the device scaling factors (eg. `(2.0, 2.0)` for HiDPI screens).
+    pub fn set_scaling_factors(&mut self, x: f64, y: f64) {
+        self.raw.device_factors = sys::zathura_device_factors_t { x, y };
+    }
+}
+
+impl Drop for Document {
+    fn drop(&mut self) {
+        let _ = self.clear_pages();
+        if let Some(document_free) = self.functions.document_free {
+            let data = self.raw.data;
+            unsafe {
+                document_free(self.as_ptr(), data);
+            }
+        }
+    }
+}
+
+impl std::fmt::Debug for Document {
+    fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
+        f.debug_struct("Document")
+            .field("path", &self.raw.path)
+            .field("pages", &self.raw.pages.len())
+            .finish()
+    }
+}
+
+unsafe fn document<'a>(document: *mut sys::zathura_document_t) -> &'a mut RawDocument {
+    &mut *(document as *mut RawDocument)
+}
+
+unsafe fn page<'a>(page: *mut sys::zathura_page_t) -> &'a mut RawPage {
+    &mut *(page as *mut RawPage)
+}
+
+unsafe fn list<'a>(list: *mut sys::girara_list_t) -> &'a mut RawList {
+    &mut *(list as *mut RawList)
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn zathura_document_get_path(
+    doc: *mut sys::zathura_document_t,
+) -> *const c_char {
+    document(doc).path.as_ptr()
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn zathura_document_get_uri(
+    _doc: *mut sys::zathura_document_t,
+) -> *const c_char {
+    ptr::null()
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn zathura_document_get_basename(
+    doc: *mut sys::zathura_document_t,
+) -> *const c_char {
+    document(doc).basename.as_ptr()
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn zathura_document_get_page(
+    doc: *mut sys::zathura_document_t,
+    index: c_uint,
+) -> *mut sys::zathura_page_t {
+    match document(doc).pages.get_mut(index as usize) {
+        Some(page) => &mut **page as *mut RawPage as *mut _,
+        None => ptr::null_mut(),
+    }
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn zathura_document_get_number_of_pages(
+    doc: *mut sys::zathura_document_t,
+) -> c_uint {
+    document(doc).page_count
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn zathura_document_set_number_of_pages(
+    doc: *mut sys::zathura_document_t,
+    number_of_pages: c_uint,
+) {
+    document(doc).page_count = number_of_pages;
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn zathura_document_get_current_page_number(
+    doc: *mut sys::zathura_document_t,
+) -> c_uint {
+    document(doc).current_page
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn zathura_document_get_zoom(doc: *mut sys::zathura_document_t) -> f64 {
+    document(doc).zoom
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn zathura_document_get_scale(doc: *mut sys::zathura_document_t) -> f64 {
+    document(doc).scale
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn zathura_document_get_rotation(
+    doc: *mut sys::zathura_document_t,
+) -> c_uint {
+    document(doc).rotation
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn zathura_document_get_data(
+    doc: *mut sys::zathura_document_t,
+) -> *mut c_void {
+    document(doc).data
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn zathura_document_set_data(
+    doc: *mut sys::zathura_document_t,
+    data: *mut c_void,
+) {
+    document(doc).data = data;
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn zathura_document_get_viewport_ppi(
+    doc: *mut sys::zathura_document_t,
+) -> f64 {
+    document(doc).viewport_ppi
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn zathura_document_get_device_factors(
+    doc: *mut sys::zathura_document_t,
+) -> sys::zathura_device_factors_t {
+    document(doc).device_factors
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn zathura_document_get_cell_size(
+    doc: *mut sys::zathura_document_t,
+    height: *mut c_uint,
+    width: *mut c_uint,
+) {
+    let doc = document(doc);
+    let (mut max_width, mut max_height) = (0.0f64, 0.0f64);
+    for page in &doc.pages {
+        max_width = max_width.max(page.width);
+        max_height = max_height.max(page.height);
+    }
+    let (mut w, mut h) = (
+        (max_width * doc.scale).ceil() as c_uint,
+        (max_height * doc.scale).ceil() as c_uint,
+    );
+    if doc.rotation % 180 == 90 {
+        std::mem::swap(&mut w, &mut h);
+    }
+    *width = w;
+    *height = h;
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn zathura_page_get_document(
+    p: *mut sys::zathura_page_t,
+) -> *mut sys::zathura_document_t {
+    page(p).document as *mut _
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn zathura_page_get_index(p: *mut sys::zathura_page_t) -> c_uint {
+    page(p).index
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn zathura_page_get_width(p: *mut sys::zathura_page_t) -> f64 {
+    page(p).width
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn zathura_page_set_width(p: *mut sys::zathura_page_t, width: f64) {
+    page(p).width = width;
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn zathura_page_get_height(p: *mut sys::zathura_page_t) -> f64 {
+    page(p).height
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn zathura_page_set_height(p: *mut sys::zathura_page_t, height: f64) {
+    page(p).height = height;
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn zathura_page_get_data(p: *mut sys::zathura_page_t) -> *mut c_void {
+    page(p).data
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn zathura_page_set_data(p: *mut sys::zathura_page_t, data: *mut c_void) {
+    page(p).data = data;
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn girara_list_new2(
+    free: sys::girara_free_function_t,
+) -> *mut sys::girara_list_t {
+    Box::into_raw(Box::new(RawList {
+        items: Vec::new(),
+        free,
+    })) as *mut _
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn girara_list_append(l: *mut sys::girara_list_t, data: *mut c_void) {
+    list(l).items.push(data);
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn girara_list_nth(l: *mut sys::girara_list_t, n: usize) -> *mut c_void {
+    list(l).items[n]
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn girara_list_size(l: *mut sys::girara_list_t) -> usize {
+    list(l).items.len()
+}
@@ -44,12 +44,32 @@
 #![doc(html_root_url = "https://docs.rs/zathura-plugin/0.4.0")]
 #![warn(missing_debug_implementations, rust_2018_idioms)]
 
+pub mod arena;
+pub mod bitonal;
+pub mod blit;
+mod chain;
+pub mod color;
+pub mod display_list;
 mod document;
 mod error;
+pub mod glyph_cache;
+mod header;
+#[cfg(feature = "host")]
+pub mod host;
 mod page;
+pub mod pool;
+pub mod profile;
+pub mod proxy;
+pub mod reclaim;
+pub mod render_target;
+pub mod scheduler;
+pub mod surface_pool;
+#[cfg(feature = "testplugin")]
+pub mod testplugin;
+pub mod trace;
 
 pub use {
-    self::{document::*, error::*, page::*},
+    self::{chain::*, document::*, error::*, header::FileHeader, page::*},
     zathura_plugin_sys as sys,
 };
 
@@ -80,7 +100,9 @@ pub trait ZathuraPlugin {
     /// Plugin-specific data attached to Zathura documents.
     ///
     /// If the plugin doesn't need to associate custom data with the document,
-    /// this can be set to `()`.
+    /// this can be set to `()`. Large data can be wrapped in a
+    /// `reclaim::DeferDrop` to free it without blocking Zathura when the
+    /// document is closed.
     type DocumentData;
 
     /// Plugin-specific data attached to every document page.
@@ -89,6 +111,21 @@ pub trait ZathuraPlugin {
     /// this can be set to `()`.
     type PageData;
 
+    /// Checks whether this plugin can handle a document with the given header.
+    ///
+    /// This is only used when several plugins are combined with
+    /// `plugin_entry!`: a document is only offered to plugins whose `probe`
+    /// accepts it (and that are listed with its MIME type), which avoids
+    /// needlessly attempting to parse it. The default implementation accepts
+    /// every document.
+    ///
+    /// The header is also available in `document_open` via
+    /// `DocumentRef::file_header`, without reading the file again.
+    fn probe(header: &FileHeader) -> bool {
+        let _ = header;
+        true
+    }
+
     /// Open a document and read its metadata.
     ///
     /// This function has to determine and return the number of pages in the
@@ -144,6 +181,10 @@ pub trait ZathuraPlugin {
     /// * **`cairo`**: The Cairo context to render to.
     /// * **`printing`**: Whether the page is being rendered for printing
     ///   (`true`) or viewing (`false`).
+    ///
+    /// Plugins that rasterize pages themselves can use
+    /// `render_target::RenderTarget` to render at exactly the resolution of
+    /// the target surface.
     fn page_render(
         page: PageRef<'_>,
         doc_data: &mut Self::DocumentData,
@@ -151,6 +192,27 @@ pub trait ZathuraPlugin {
         cairo: &mut cairo::Context,
         printing: bool,
     ) -> Result<(), PluginError>;
+
+    /// Whether the plugin implements `page_search_text`.
+    ///
+    /// Optional callbacks are only registered with Zathura if their constant
+    /// is `true`. Otherwise, Zathura doesn't call into the library at all for
+    /// the feature, and the library doesn't contain the code to wrap it.
+    const SEARCH_TEXT: bool = false;
+
+    /// Search a page for `text` and return the areas of all matches.
+    ///
+    /// Rectangles are in page coordinates, like everything drawn by
+    /// `page_render`. This is only called if `SEARCH_TEXT` is `true`.
+    fn page_search_text(
+        page: PageRef<'_>,
+        doc_data: &mut Self::DocumentData,
+        page_data: &mut Self::PageData,
+        text: &str,
+    ) -> Result<Vec<sys::zathura_rectangle_t>, PluginError> {
+        let _ = (page, doc_data, page_data, text);
+        Err(PluginError::NotImplemented)
+    }
 }
 
 /// `extern "C"` functions wrapping the Rust `ZathuraPlugin` functions.
@@ -160,14 +222,89 @@ pub trait ZathuraPlugin {
 #[doc(hidden)]
 pub mod wrapper {
     use {
-        crate::{sys::*, *},
+        crate::{arena::SyncArena, sys::*, *},
         cairo,
         std::{
-            ffi::c_void,
+            ffi::{c_void, CStr},
+            mem::{self, MaybeUninit},
+            os::raw::c_char,
             panic::{catch_unwind, AssertUnwindSafe},
+            ptr::{self, NonNull},
+            time::Instant,
         },
     };
 
+    /// Plugin data attached to every document.
+    ///
+    /// The arena comes first and the layout is fixed, so that
+    /// `DocumentRef::arena` can find it without knowing `DocumentData`.
+    #[repr(C)]
+    pub(crate) struct DocSlot<D> {
+        pub(crate) arena: SyncArena,
+        pub(crate) data: D,
+    }
+
+    impl<D> DocSlot<D> {
+        /// Returns the `DocumentData` in the slot a document's data pointer
+        /// points to.
+        unsafe fn data(raw: *mut c_void) -> *mut D {
+            ptr::addr_of_mut!((*(raw as *mut DocSlot<D>)).data)
+        }
+    }
+
+    /// Plugin data attached to every page.
+    ///
+    /// Besides the plugin's `PageData`, this caches a pointer to the
+    /// document's `DocumentData`. Zathura passes the page's data pointer to
+    /// all page callbacks, so both pointers are available without calling back
+    /// into Zathura.
+    ///
+    /// If `PageData` is zero-sized, no `PageSlot` is allocated. Instead, the
+    /// `DocumentData` pointer itself is stored as the page's data pointer.
+    struct PageSlot<P: ZathuraPlugin> {
+        doc_data: *mut P::DocumentData,
+        page_data: P::PageData,
+    }
+
+    impl<P: ZathuraPlugin> PageSlot<P> {
+        const INLINE: bool = mem::size_of::<P::PageData>() == 0;
+
+        /// Creates the page data pointer to store in the page.
+        fn into_raw(doc_data: *mut P::DocumentData, page_data: P::PageData) -> *mut () {
+            if Self::INLINE {
+                // Zero-sized values don't need to be stored anywhere. The value
+                // is recreated and dropped by `drop_raw`.
+                mem::forget(page_data);
+                doc_data as *mut ()
+            } else {
+                Box::into_raw(Box::new(PageSlot::<P> {
+                    doc_data,
+                    page_data,
+                })) as *mut ()
+            }
+        }
+
+        /// Returns the document and page data referenced by a page data
+        /// pointer created by `into_raw`.
+        unsafe fn from_raw(raw: *mut c_void) -> (*mut P::DocumentData, *mut P::PageData) {
+            if Self::INLINE {
+                (raw as *mut _, NonNull::dangling().as_ptr())
+            } else {
+                let slot = raw as *mut PageSlot<P>;
+                ((*slot).doc_data, &mut (*slot).page_data as *mut P::PageData)
+            }
+        }
+
+        /// Drops the `PageData` referenced by a pointer created by `into_raw`.
+        unsafe fn drop_raw(raw: *mut c_void) {
+            if Self::INLINE {
+                drop(ptr::read(NonNull::<P::PageData>::dangling().as_ptr()));
+            } else {
+                drop(Box::from_raw(raw as *mut PageSlot<P>));
+            }
+        }
+    }
+
     trait ResultExt {
         fn to_zathura(self) -> zathura_error_t;
     }
@@ -181,44 +318,143 @@ pub mod wrapper {
         }
     }
 
-    fn wrap(f: impl FnOnce() -> Result<(), PluginError>) -> Result<(), PluginError> {
+    fn wrap<T>(f: impl FnOnce() -> Result<T, PluginError>) -> Result<T, PluginError> {
         match catch_unwind(AssertUnwindSafe(f)) {
             Ok(r) => r,
             Err(_) => Err(PluginError::Unknown),
         }
     }
 
+    /// Runs the callback `f`, and records it if tracing is enabled.
+    ///
+    /// `page` is null for document callbacks, in which case `document` is the
+    /// document the callback was called for. For page callbacks, `document` is
+    /// ignored.
+    unsafe fn traced<T>(
+        callback: trace::Callback,
+        document: *mut zathura_document_t,
+        page: *mut zathura_page_t,
+        printing: bool,
+        f: impl FnOnce() -> Result<T, PluginError>,
+    ) -> Result<T, PluginError> {
+        let recorder = match trace::recorder() {
+            Some(recorder) => recorder,
+            None => return f(),
+        };
+
+        let timestamp = recorder.now();
+        let start = Instant::now();
+        let result = f();
+        let duration = start.elapsed();
+
+        let (document, index) = if page.is_null() {
+            (document, None)
+        } else {
+            let p = PageRef::from_raw(page);
+            (zathura_page_get_document(page), Some(p.index() as u32))
+        };
+        let doc = DocumentRef::from_raw(document);
+        let status = result.as_ref().map(|_| ()).map_err(|e| *e);
+        let page_count = match (callback, status) {
+            (trace::Callback::DocumentOpen, Ok(())) => Some(doc.page_count()),
+            _ => None,
+        };
+        let basename = match callback {
+            trace::Callback::DocumentOpen => Some(doc.basename_raw().to_bytes().to_vec()),
+            _ => None,
+        };
+        recorder.record(&trace::Record {
+            callback,
+            timestamp,
+            duration,
+            result: status,
+            thread: recorder.thread_id(),
+            document: document as usize as u64,
+            basename,
+            page: index,
+            page_count,
+            zoom: doc.zoom(),
+            scale: doc.scale(),
+            rotation: doc.rotation(),
+            scaling_factors: doc.scaling_factors(),
+            cell_size: doc.cell_size(),
+            printing,
+        });
+        result
+    }
+
     /// Open a document and set the number of pages to create in `document`.
     pub unsafe extern "C" fn document_open<P: ZathuraPlugin>(
         document: *mut zathura_document_t,
     ) -> zathura_error_t {
-        wrap(|| {
-            let doc = DocumentRef::from_raw(document);
-            let info = P::document_open(doc)?;
+        // The header is only cached while the document is being opened.
+        let opening = header::Opening::start();
+        let callback = trace::Callback::DocumentOpen;
+        let result = traced(callback, document, ptr::null_mut(), false, || {
+            // The arena is available in `document_open`, so the slot is set
+            // up first and the document data is filled in afterwards.
+            let slot = Box::into_raw(Box::new(DocSlot {
+                arena: SyncArena::new(),
+                data: MaybeUninit::<P::DocumentData>::uninit(),
+            }));
+            DocumentRef::from_raw(document).set_plugin_data(slot as *mut _);
+
+            let info = wrap(|| {
+                let doc = DocumentRef::from_raw(document);
+                let info = P::document_open(doc)?;
+                (*slot).data = MaybeUninit::new(info.plugin_data);
+                Ok(info.page_count)
+            });
             let mut doc = DocumentRef::from_raw(document);
-            doc.set_plugin_data(Box::into_raw(Box::new(info.plugin_data)) as *mut _);
-            doc.set_page_count(info.page_count);
-            Ok(())
-        })
-        .to_zathura()
+            match info {
+                Ok(page_count) => {
+                    doc.set_page_count(page_count);
+                    Ok(())
+                }
+                Err(e) => {
+                    // Zathura still calls `document_free` after a failed open.
+                    // The slot is freed here and the data pointer reset, so
+                    // that `document_free` gets null and does nothing.
+                    doc.set_plugin_data(ptr::null_mut());
+                    drop(Box::from_raw(slot));
+                    Err(e)
+                }
+            }
+        });
+        drop(opening);
+        result.to_zathura()
     }
 
     /// Free plugin-specific data in `document`.
     ///
     /// This is called by `zathura_document_free` and thus must not attempt to
     /// free the document again.
+    ///
+    /// Zathura also calls this after `document_open` failed, with a null
+    /// `data` pointer. There is nothing to free then.
     pub unsafe extern "C" fn document_free<P: ZathuraPlugin>(
         document: *mut zathura_document_t,
-        _data: *mut c_void,
+        data: *mut c_void,
     ) -> zathura_error_t {
-        wrap(|| {
-            let doc = DocumentRef::from_raw(document);
-            let doc_data = &mut *(doc.plugin_data() as *mut P::DocumentData);
-            let result = P::document_free(doc, doc_data);
-            let doc = DocumentRef::from_raw(document);
-            let plugin_data = doc.plugin_data() as *mut P::DocumentData;
-            drop(Box::from_raw(plugin_data));
-            result
+        if data.is_null() {
+            return zathura_plugin_error_e_ZATHURA_ERROR_OK;
+        }
+
+        let callback = trace::Callback::DocumentFree;
+        traced(callback, document, ptr::null_mut(), false, || {
+            wrap(|| {
+                // `data` is the document's plugin data pointer.
+                let doc = DocumentRef::from_raw(document);
+                let doc_data = DocSlot::<P::DocumentData>::data(data);
+                let result = P::document_free(doc, &mut *doc_data);
+
+                // Drop the document data before the arena it may point into.
+                let slot = Box::from_raw(data as *mut DocSlot<P::DocumentData>);
+                let DocSlot { arena, data } = *slot;
+                drop(data);
+                drop(arena);
+                result
+            })
         })
         .to_zathura()
     }
@@ -230,19 +466,22 @@ pub mod wrapper {
     pub unsafe extern "C" fn page_init<P: ZathuraPlugin>(
         page: *mut zathura_page_t,
     ) -> zathura_error_t {
-        wrap(|| {
-            let mut p = PageRef::from_raw(page);
-
-            // Obtaining the document data is safe, since there is no other way to get access to it
-            // while this function executes.
-            let doc_data = p.document().plugin_data() as *mut P::DocumentData;
-
-            let info = P::page_init(p, &mut *doc_data)?;
-            let mut p = PageRef::from_raw(page);
-            p.set_width(info.width);
-            p.set_height(info.height);
-            p.set_plugin_data(Box::into_raw(Box::new(info.plugin_data)) as *mut _);
-            Ok(())
+        let callback = trace::Callback::PageInit;
+        traced(callback, ptr::null_mut(), page, false, || {
+            wrap(|| {
+                let mut p = PageRef::from_raw(page);
+
+                // Obtaining the document data is safe, since there is no other way to get access to it
+                // while this function executes.
+                let doc_data = DocSlot::<P::DocumentData>::data(p.document().plugin_data() as _);
+
+                let info = P::page_init(p, &mut *doc_data)?;
+                let mut p = PageRef::from_raw(page);
+                p.set_width(info.width);
+                p.set_height(info.height);
+                p.set_plugin_data(PageSlot::<P>::into_raw(doc_data, info.plugin_data));
+                Ok(())
+            })
         })
         .to_zathura()
     }
@@ -250,50 +489,174 @@ pub mod wrapper {
     /// Deallocate plugin-specific page data.
     ///
     /// If this function is missing, the *document* will not be freed.
+    ///
+    /// `data` is the page's plugin data pointer, as set by `page_init`. If
+    /// `page_init` failed, Zathura still calls this, with a null `data`
+    /// pointer.
     pub unsafe extern "C" fn page_clear<P: ZathuraPlugin>(
         page: *mut zathura_page_t,
-        _data: *mut c_void,
+        data: *mut c_void,
     ) -> zathura_error_t {
-        wrap(|| {
-            let result = {
-                let mut p = PageRef::from_raw(page);
-                let doc_data = &mut *(p.document().plugin_data() as *mut P::DocumentData);
-                let page_data = &mut *(p.plugin_data() as *mut P::PageData);
-                P::page_free(p, doc_data, page_data)
-            };
+        if data.is_null() {
+            return zathura_plugin_error_e_ZATHURA_ERROR_OK;
+        }
 
-            // Free the `PageData`
-            let p = PageRef::from_raw(page);
-            let plugin_data = p.plugin_data() as *mut P::PageData;
-            drop(Box::from_raw(plugin_data));
+        let callback = trace::Callback::PageClear;
+        traced(callback, ptr::null_mut(), page, false, || {
+            wrap(|| {
+                let result = {
+                    let p = PageRef::from_raw(page);
+                    let (doc_data, page_data) = PageSlot::<P>::from_raw(data);
+                    P::page_free(p, &mut *doc_data, &mut *page_data)
+                };
 
-            result
+                // Free the `PageData`
+                PageSlot::<P>::drop_raw(data);
+
+                result
+            })
         })
         .to_zathura()
     }
 
+    /// Returns the function table for plugin `P`.
+    ///
+    /// This is evaluated at compile time by `plugin_entry!`. Optional
+    /// callbacks are only filled in if `P` enables them with the matching
+    /// `ZathuraPlugin` constant (eg. `SEARCH_TEXT`); all others are `None`, so
+    /// that Zathura doesn't call into the plugin at all for unsupported
+    /// features. Since only the evaluated table ends up in the library, the
+    /// wrappers of disabled callbacks aren't instantiated for `P` either.
+    ///
+    /// `document_free` and `page_clear` are always present, since they free the
+    /// plugin data (and Zathura doesn't free a document whose pages lack
+    /// `page_clear`).
+    pub const fn functions<P: ZathuraPlugin>() -> zathura_plugin_functions_t {
+        zathura_plugin_functions_t {
+            document_open: Some(document_open::<P>),
+            document_free: Some(document_free::<P>),
+            document_index_generate: None,
+            document_save_as: None,
+            document_attachments_get: None,
+            document_attachment_save: None,
+            document_get_information: None,
+            page_init: Some(page_init::<P>),
+            page_clear: Some(page_clear::<P>),
+            page_search_text: if P::SEARCH_TEXT {
+                Some(page_search_text::<P>)
+            } else {
+                None
+            },
+            page_links_get: None,
+            page_form_fields_get: None,
+            page_images_get: None,
+            page_image_get_cairo: None,
+            page_get_text: None,
+            page_render: None, // no longer used?
+            page_render_cairo: Some(page_render_cairo::<P>),
+            page_get_label: None,
+        }
+    }
+
     /// Render a page to a Cairo context.
     pub unsafe extern "C" fn page_render_cairo<P: ZathuraPlugin>(
         page: *mut zathura_page_t,
-        _data: *mut c_void,
+        data: *mut c_void,
         cairo: *mut sys::cairo_t,
         printing: bool,
     ) -> zathura_error_t {
-        wrap(|| {
-            let mut p = PageRef::from_raw(page);
-            let page_data = &mut *(p.plugin_data() as *mut P::PageData);
-            let doc_data = &mut *(p.document().plugin_data() as *mut P::DocumentData);
-            let mut cairo = cairo::Context::from_raw_borrow(cairo as *mut _);
-            P::page_render(p, doc_data, page_data, &mut cairo, printing)
+        let callback = trace::Callback::PageRender;
+        traced(callback, ptr::null_mut(), page, printing, || {
+            wrap(|| {
+                let p = PageRef::from_raw(page);
+                let (doc_data, page_data) = PageSlot::<P>::from_raw(data);
+                let mut cairo = cairo::Context::from_raw_borrow(cairo as *mut _);
+                P::page_render(p, &mut *doc_data, &mut *page_data, &mut cairo, printing)
+            })
         })
         .to_zathura()
     }
+
+    unsafe extern "C" fn free_rectangle(rectangle: *mut c_void) {
+        drop(Box::from_raw(rectangle as *mut zathura_rectangle_t));
+    }
+
+    /// Search a page for text.
+    ///
+    /// Returns a list of the rectangles of all matches, or null and an error
+    /// code in `error`.
+    pub unsafe extern "C" fn page_search_text<P: ZathuraPlugin>(
+        page: *mut zathura_page_t,
+        data: *mut c_void,
+        text: *const c_char,
+        error: *mut zathura_error_t,
+    ) -> *mut girara_list_t {
+        let callback = trace::Callback::PageSearchText;
+        let result = traced(callback, ptr::null_mut(), page, false, || {
+            wrap(|| {
+                if text.is_null() {
+                    return Err(PluginError::InvalidArguments);
+                }
+                let text = CStr::from_ptr(text)
+                    .to_str()
+                    .map_err(|_| PluginError::InvalidArguments)?;
+                let p = PageRef::from_raw(page);
+                let (doc_data, page_data) = PageSlot::<P>::from_raw(data);
+                P::page_search_text(p, &mut *doc_data, &mut *page_data, text)
+            })
+        });
+
+        let (list, code) = match result {
+            Ok(rectangles) => {
+                let list = girara_list_new2(Some(free_rectangle));
+                for rectangle in rectangles {
+                    girara_list_append(list, Box::into_raw(Box::new(rectangle)) as *mut c_void);
+                }
+                (list, 0)
+            }
+            Err(e) => (ptr::null_mut(), e as zathura_error_t),
+        };
+        if !error.is_null() {
+            *error = code;
+        }
+        list
+    }
 }
 
 /// Declares this library as a Zathura plugin.
 ///
-/// A crate can only provide one Zathura plugin, so this macro may only be
-/// called once per crate.
+/// Zathura loads a single plugin definition per library, so this macro may
+/// only be called once per crate. To handle several formats with separate
+/// plugin types, list all of them in one invocation, each with its own MIME
+/// types:
+///
+/// ```
+/// # use zathura_plugin::*;
+/// # struct PdfPlugin; struct DjvuPlugin;
+/// # impl ZathuraPlugin for PdfPlugin {
+/// #     type DocumentData = (); type PageData = ();
+/// #     fn document_open(_: DocumentRef<'_>) -> Result<DocumentInfo<Self>, PluginError> { unimplemented!() }
+/// #     fn page_init(_: PageRef<'_>, _: &mut ()) -> Result<PageInfo<Self>, PluginError> { unimplemented!() }
+/// #     fn page_render(_: PageRef<'_>, _: &mut (), _: &mut (), _: &mut cairo::Context, _: bool) -> Result<(), PluginError> { unimplemented!() }
+/// # }
+/// # impl ZathuraPlugin for DjvuPlugin {
+/// #     type DocumentData = (); type PageData = ();
+/// #     fn document_open(_: DocumentRef<'_>) -> Result<DocumentInfo<Self>, PluginError> { unimplemented!() }
+/// #     fn page_init(_: PageRef<'_>, _: &mut ()) -> Result<PageInfo<Self>, PluginError> { unimplemented!() }
+/// #     fn page_render(_: PageRef<'_>, _: &mut (), _: &mut (), _: &mut cairo::Context, _: bool) -> Result<(), PluginError> { unimplemented!() }
+/// # }
+/// plugin_entry!("MyFormats", [
+///     PdfPlugin: ["application/pdf"],
+///     DjvuPlugin: ["image/vnd.djvu"],
+/// ]);
+/// ```
+///
+/// The plugins are combined into a [`Chain`], which offers every document to
+/// the listed plugins in order until one of them opens it. A plugin is not
+/// offered documents whose format the header identifies as one that only
+/// other plugins are listed with (see [`Filtered`]), nor documents that its
+/// `ZathuraPlugin::probe` rejects. The plugins share the library's global
+/// state, such as the thread pool and caches.
 ///
 /// For this to work, this crate must be built as a `cdylib` and the result put
 /// somewhere Zathura can find it. An easy way to iterate on a plugin is running
@@ -306,8 +669,45 @@ pub mod wrapper {
 /// # Examples
 ///
 /// For a usage example of this macro, refer to the crate-level docs.
+///
+/// [`Chain`]: struct.Chain.html
+/// [`Filtered`]: struct.Filtered.html
 #[macro_export]
 macro_rules! plugin_entry {
+    (
+        $name:literal,
+        [
+            $(
+                $plugin_ty:ty : [
+                    $($mime:literal),+
+                    $(,)?
+                ]
+            ),+
+            $(,)?
+        ]
+    ) => {
+        #[doc(hidden)]
+        pub enum __PluginMimeTypes {}
+
+        impl __PluginMimeTypes {
+            const ALL: &'static [&'static str] = &[$($($mime),+),+];
+        }
+
+        $(
+            impl $crate::MimeTypes<$plugin_ty> for __PluginMimeTypes {
+                const MIME_TYPES: &'static [&'static str] = &[$($mime),+];
+                const LIBRARY_MIME_TYPES: &'static [&'static str] = __PluginMimeTypes::ALL;
+            }
+        )+
+
+        $crate::plugin_entry!(
+            $name,
+            $crate::__plugin_chain!(
+                $($crate::Filtered<$plugin_ty, __PluginMimeTypes>),+
+            ),
+            [$($($mime),+),+]
+        );
+    };
     (
         $name:literal,
         $plugin_ty:ty,
@@ -315,7 +715,117 @@ macro_rules! plugin_entry {
             $($mime:literal),+
             $(,)?
         ]
+    ) => {
+        $crate::__plugin_definition!(
+            $name,
+            $crate::wrapper::functions::<$plugin_ty>(),
+            [$($mime),+]
+        );
+    };
+}
+
+/// Declares this library as a caching proxy for another plugin.
+///
+/// The library loads the plugin library at the given path when the first
+/// document is opened, and forwards all callbacks to it, adding the caches
+/// described in the [`proxy`] module. The proxy registers the listed MIME
+/// types, which should be the ones the loaded plugin supports.
+///
+/// Like `plugin_entry!`, this may only be called once per crate, and not
+/// together with `plugin_entry!`.
+///
+/// # Examples
+///
+/// ```
+/// zathura_plugin::proxy_entry!(
+///     "PDF (cached)",
+///     "/usr/lib/zathura-backends/libpdf-poppler.so",
+///     ["application/pdf"]
+/// );
+/// ```
+///
+/// [`proxy`]: proxy/index.html
+#[macro_export]
+macro_rules! proxy_entry {
+    (
+        $name:literal,
+        $backend:literal,
+        [
+            $($mime:literal),+
+            $(,)?
+        ]
+    ) => {
+        #[doc(hidden)]
+        pub enum __ProxyBackend {}
+
+        impl $crate::proxy::Backend for __ProxyBackend {
+            const PATH: &'static str = $backend;
+        }
+
+        $crate::__plugin_definition!(
+            $name,
+            $crate::proxy::functions::<__ProxyBackend>(),
+            [$($mime),+]
+        );
+    };
+}
+
+/// Declares this library as a profiling proxy for another plugin.
+///
+/// Like `proxy_entry!`, the library loads the plugin library at the given
+/// path and forwards all callbacks to it, but without caching anything.
+/// Instead, it records how often each callback is called, how long the calls
+/// take and how large their results are, and writes a report whenever a
+/// document is freed, as described in the [`proxy`] module.
+///
+/// Like `plugin_entry!`, this may only be called once per crate, and not
+/// together with `plugin_entry!` or `proxy_entry!`.
+///
+/// # Examples
+///
+/// ```
+/// zathura_plugin::profiling_proxy_entry!(
+///     "PDF (profiled)",
+///     "/usr/lib/zathura-backends/libpdf-poppler.so",
+///     ["application/pdf"]
+/// );
+/// ```
+///
+/// [`proxy`]: proxy/index.html
+#[macro_export]
+macro_rules! profiling_proxy_entry {
+    (
+        $name:literal,
+        $backend:literal,
+        [
+            $($mime:literal),+
+            $(,)?
+        ]
     ) => {
+        #[doc(hidden)]
+        pub enum __ProxyBackend {}
+
+        impl $crate::proxy::Backend for __ProxyBackend {
+            const PATH: &'static str = $backend;
+            const CACHE: bool = false;
+            const PROFILE: bool = true;
+        }
+
+        $crate::__plugin_definition!(
+            $name,
+            $crate::proxy::functions::<__ProxyBackend>(),
+            [$($mime),+]
+        );
+    };
+}
+
+/// Defines the `zathura_plugin_3_4` symbol Zathura loads plugins from.
+///
+/// Used by `plugin_entry!`, `proxy_entry!` and `profiling_proxy_entry!`.
+#[doc(hidden)]
+#[macro_export]
+macro_rules! __plugin_definition {
+    ($name:literal, $functions:expr, [$($mime:literal),+]) => {
         #[doc(hidden)]
         #[repr(transparent)]
         #[allow(warnings)]
@@ -328,7 +838,6 @@ macro_rules! plugin_entry {
         pub static mut zathura_plugin_3_4: /* API=3, ABI=4 */
         __AssertSync<$crate::sys::zathura_plugin_definition_t> = __AssertSync({
             use $crate::sys::*;
-            use $crate::wrapper::*;
 
             zathura_plugin_definition_t {
                 name: concat!($name, "\0").as_ptr() as *const _,
@@ -351,121 +860,11 @@ macro_rules! plugin_entry {
                         concat!($mime, "\0").as_ptr() as *const _,
                     )+
                 ].as_ptr() as *mut _, // assuming Zathura never mutates this
-                functions: zathura_plugin_functions_t {
-                    document_open: Some(document_open::<$plugin_ty>),
-                    document_free: Some(document_free::<$plugin_ty>),
-                    document_index_generate: None,
-                    document_save_as: None,
-                    document_attachments_get: None,
-                    document_attachment_save: None,
-                    document_get_information: None,
-                    page_init: Some(page_init::<$plugin_ty>),
-                    page_clear: Some(page_clear::<$plugin_ty>),
-                    page_search_text: None,
-                    page_links_get: None,
-                    page_form_fields_get: None,
-                    page_images_get: None,
-                    page_image_get_cairo: None,
-                    page_get_text: None,
-                    page_render: None, // no longer used?
-                    page_render_cairo: Some(page_render_cairo::<$plugin_ty>),
-                    page_get_label: None,
-                },
+                functions: $functions,
             }
         });
     };
 }
 
 #[cfg(feature = "testplugin")]
-struct TestPlugin;
-
-#[cfg(feature = "testplugin")]
-impl ZathuraPlugin for TestPlugin {
-    type DocumentData = ();
-    type PageData = ();
-
-    fn document_open(doc: DocumentRef<'_>) -> Result<DocumentInfo<Self>, PluginError> {
-        println!("open: {:?}", doc.basename_utf8());
-        println!("path: {:?}", doc.path_utf8());
-        println!("url:  {:?}", doc.uri_utf8());
-        println!("{} pages", doc.page_count());
-        Ok(DocumentInfo {
-            page_count: 5,
-            plugin_data: (),
-        })
-    }
-
-    fn document_free(doc: DocumentRef<'_>, _doc_data: &mut ()) -> Result<(), PluginError> {
-        println!("free! {:?}", doc);
-        Ok(())
-    }
-
-    fn page_init(page: PageRef<'_>, _doc_data: &mut ()) -> Result<PageInfo<Self>, PluginError> {
-        println!("page init: {:?}", page);
-
-        Ok(PageInfo {
-            width: 75.0,
-            height: 100.0,
-            plugin_data: (),
-        })
-    }
-
-    fn page_free(
-        page: PageRef<'_>,
-        _doc_data: &mut (),
-        _page_data: &mut (),
-    ) -> Result<(), PluginError> {
-        println!("page free: {:?}", page);
-        Ok(())
-    }
-
-    fn page_render(
-        mut page: PageRef<'_>,
-        _doc_data: &mut Self::DocumentData,
-        _page_data: &mut Self::PageData,
-        cairo: &mut cairo::Context,
-        printing: bool,
-    ) -> Result<(), PluginError> {
-        println!(
-            "render! {:?}, index={:?}, {}x{}, {:?}",
-            page,
-            page.index(),
-            page.width(),
-            page.height(),
-            printing
-        );
-
-        {
-            let doc = page.document();
-            println!(
-                "doc: zoom={}, scale={}, rotation={}°, ppi={}, scale={:?}, cell-size={:?}",
-                doc.zoom(),
-                doc.scale(),
-                doc.rotation(),
-                doc.viewport_ppi(),
-                doc.scaling_factors(),
-                doc.cell_size(),
-            );
-        }
-
-        println!(
-            "cairo: scale={:?}, 50,50={:?}",
-            cairo.get_target().get_device_scale(),
-            cairo.user_to_device(50.0, 50.0),
-        );
-
-        if page.index() == 0 {
-            cairo.move_to(10.0, 10.0);
-            cairo.show_text("Wello!");
-            cairo.set_source_rgb(0.0, 1.0, 1.0);
-            cairo.set_line_width(1.0);
-            cairo.move_to(0.0, 0.0);
-            cairo.line_to(10.5, 50.5);
-            cairo.stroke();
-        }
-        Ok(())
-    }
-}
-
-#[cfg(feature = "testplugin")]
-plugin_entry!("TestPlugin", TestPlugin, ["text/plain"]);
+plugin_entry!("TestPlugin", testplugin::TestPlugin, ["text/plain"]);
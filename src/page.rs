@@ -1,5 +1,5 @@
 use {
-    crate::{sys, DocumentRef},
+    crate::{arena::SyncArena, document, sys, DocumentRef},
     std::marker::PhantomData,
 };
 
@@ -69,10 +69,12 @@ impl PageRef<'_> {
         unsafe { sys::zathura_page_set_height(self.ptr, height) }
     }
 
-    /// Returns the plugin-controlled pointer associated with the document.
+    /// Returns the plugin-controlled pointer associated with the page.
     ///
     /// This is mostly for internal use by this library and is usually unsafe
-    /// to dereference.
+    /// to dereference. For pages initialized by this library, it points to
+    /// the library's own page data rather than to the plugin's `PageData`, and
+    /// if `PageData` is zero-sized, it points to the document's data instead.
     pub fn plugin_data(&self) -> *mut () {
         unsafe { sys::zathura_page_get_data(self.ptr) as *mut () }
     }
@@ -85,10 +87,25 @@ impl PageRef<'_> {
     /// `ZathuraPlugin` trait already provides an associated `PageData` type,
     /// which can be used instead.
     ///
-    /// This library will assume that the plugin data is a
-    /// `*mut Plugin::PageData` obtained from `Box::into_raw`, and frees the
-    /// data automatically.
+    /// This library stores its own page data in this pointer (which holds the
+    /// plugin's `PageData` alongside a pointer to the `DocumentData`), and
+    /// frees it automatically.
     pub unsafe fn set_plugin_data(&mut self, data: *mut ()) {
         sys::zathura_page_set_data(self.ptr, data as *mut _)
     }
 }
+
+impl<'a> PageRef<'a> {
+    /// Returns the arena of the document containing this page.
+    ///
+    /// Unlike going through `document`, this doesn't borrow the page.
+    ///
+    /// # Safety
+    ///
+    /// The document must have been opened through this library's
+    /// `ZathuraPlugin` wrapper, like the documents of all pages passed to
+    /// `ZathuraPlugin` callbacks.
+    pub unsafe fn arena(&self) -> &'a SyncArena {
+        document::arena(sys::zathura_page_get_document(self.ptr))
+    }
+}
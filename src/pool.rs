@@ -0,0 +1,402 @@
+//! A process-wide work-stealing task pool shared by all plugin instances.
+//!
+//! Zathura may have several documents open in the same process, each handled
+//! by its own plugin instance. Spawning threads per document quickly
+//! oversubscribes the CPU, so this library owns a single pool that every
+//! parallel feature (page initialization, search, decoding, ...) submits its
+//! work to.
+//!
+//! The pool is created lazily when the first task is spawned. It runs one
+//! worker thread per available core, which can be overridden by setting the
+//! `ZATHURA_PLUGIN_THREADS` environment variable before the first task is
+//! spawned.
+//!
+//! # Examples
+//!
+//! ```no_run
+//! use zathura_plugin::pool::{self, Priority};
+//!
+//! let handle = pool::spawn(Priority::Background, || 6 * 7);
+//! assert_eq!(handle.wait(), Ok(42));
+//! ```
+
+use {
+    crate::PluginError,
+    std::{
+        cell::Cell,
+        collections::VecDeque,
+        env, fmt,
+        panic::{catch_unwind, AssertUnwindSafe},
+        sync::{
+            atomic::{AtomicUsize, Ordering},
+            Arc, Condvar, Mutex, OnceLock,
+        },
+        thread,
+    },
+};
+
+/// Scheduling priority of a task.
+///
+/// Workers always prefer `Visible` tasks over `Background` tasks, regardless of
+/// which worker queue they are in.
+#[derive(Debug, Copy, Clone, PartialEq, Eq, PartialOrd, Ord, Hash)]
+pub enum Priority {
+    /// Work needed to display a page that is currently on screen.
+    Visible,
+
+    /// Work whose result is not needed right now (prefetching, indexing).
+    Background,
+}
+
+type Task = Box<dyn FnOnce() + Send + 'static>;
+
+/// A pair of FIFO queues, one per priority.
+#[derive(Default)]
+struct Queues {
+    visible: VecDeque<Task>,
+    background: VecDeque<Task>,
+}
+
+impl Queues {
+    fn get(&mut self, priority: Priority) -> &mut VecDeque<Task> {
+        match priority {
+            Priority::Visible => &mut self.visible,
+            Priority::Background => &mut self.background,
+        }
+    }
+}
+
+struct Shared {
+    /// Tasks spawned from threads that are not part of the pool.
+    injector: Mutex<Queues>,
+
+    /// Per-worker queues. Tasks spawned from a worker go into its own queue
+    /// and are taken LIFO by their owner, and FIFO by stealing workers.
+    locals: Vec<Mutex<Queues>>,
+
+    /// Number of queued tasks that haven't been picked up by a worker yet.
+    pending: AtomicUsize,
+
+    sleep: Mutex<()>,
+    wakeup: Condvar,
+}
+
+thread_local! {
+    /// Index of the pool worker running on this thread, if any.
+    static WORKER_INDEX: Cell<Option<usize>> = Cell::new(None);
+}
+
+static POOL: OnceLock<Arc<Shared>> = OnceLock::new();
+
+fn shared() -> &'static Shared {
+    POOL.get_or_init(|| {
+        let threads = env::var("ZATHURA_PLUGIN_THREADS")
+            .ok()
+            .and_then(|s| s.parse().ok())
+            .filter(|&n: &usize| n > 0)
+            .unwrap_or_else(|| thread::available_parallelism().map_or(1, |n| n.get()));
+
+        let shared = Shared::new(threads);
+        shared.start();
+        shared
+    })
+}
+
+impl Shared {
+    /// Creates a pool with `threads` workers, without starting them.
+    fn new(threads: usize) -> Arc<Self> {
+        Arc::new(Shared {
+            injector: Mutex::default(),
+            locals: (0..threads).map(|_| Mutex::default()).collect(),
+            pending: AtomicUsize::new(0),
+            sleep: Mutex::new(()),
+            wakeup: Condvar::new(),
+        })
+    }
+
+    /// Starts the worker threads.
+    fn start(self: &Arc<Self>) {
+        for index in 0..self.locals.len() {
+            let shared = self.clone();
+            thread::Builder::new()
+                .name(format!("zathura-plugin-{}", index))
+                .spawn(move || shared.worker_loop(index))
+                .expect("failed to spawn pool worker thread");
+        }
+    }
+
+    fn push(&self, priority: Priority, task: Task) {
+        self.pending.fetch_add(1, Ordering::SeqCst);
+        match WORKER_INDEX.with(Cell::get) {
+            Some(index) => self.locals[index]
+                .lock()
+                .unwrap()
+                .get(priority)
+                .push_back(task),
+            None => self.injector.lock().unwrap().get(priority).push_back(task),
+        }
+
+        // Taking the lock orders this notification after any worker's check of
+        // `pending`, so no wakeup is lost.
+        drop(self.sleep.lock().unwrap());
+        self.wakeup.notify_one();
+    }
+
+    /// Finds the next task for worker `index` (or for a non-worker thread when
+    /// `index` is `None`).
+    fn find_task(&self, index: Option<usize>) -> Option<Task> {
+        if self.pending.load(Ordering::SeqCst) == 0 {
+            return None;
+        }
+
+        for &priority in &[Priority::Visible, Priority::Background] {
+            let task = index
+                .and_then(|i| self.locals[i].lock().unwrap().get(priority).pop_back())
+                .or_else(|| self.injector.lock().unwrap().get(priority).pop_front())
+                .or_else(|| self.steal(index.unwrap_or(0), priority));
+
+            if task.is_some() {
+                self.pending.fetch_sub(1, Ordering::SeqCst);
+                return task;
+            }
+        }
+
+        None
+    }
+
+    fn steal(&self, start: usize, priority: Priority) -> Option<Task> {
+        let n = self.locals.len();
+        (1..=n)
+            .map(|offset| (start + offset) % n)
+            .find_map(|victim| {
+                self.locals[victim]
+                    .lock()
+                    .unwrap()
+                    .get(priority)
+                    .pop_front()
+            })
+    }
+
+    fn worker_loop(&self, index: usize) {
+        WORKER_INDEX.with(|w| w.set(Some(index)));
+
+        loop {
+            if let Some(task) = self.find_task(Some(index)) {
+                task();
+                continue;
+            }
+
+            let guard = self.sleep.lock().unwrap();
+            if self.pending.load(Ordering::SeqCst) == 0 {
+                drop(self.wakeup.wait(guard).unwrap());
+            }
+        }
+    }
+}
+
+struct Slot<T> {
+    result: Mutex<Option<thread::Result<T>>>,
+    done: Condvar,
+}
+
+/// Handle to a task spawned on the pool.
+///
+/// Dropping the handle detaches the task; it will still run to completion.
+pub struct TaskHandle<T> {
+    slot: Arc<Slot<T>>,
+}
+
+impl<T> TaskHandle<T> {
+    /// Returns whether the task has finished running.
+    pub fn is_finished(&self) -> bool {
+        self.slot.result.lock().unwrap().is_some()
+    }
+
+    /// Blocks until the task has finished and returns its result.
+    ///
+    /// If the task panicked, this returns `PluginError::Unknown`, just like a
+    /// panic inside a plugin callback.
+    ///
+    /// When called from a pool worker, this keeps executing other queued tasks
+    /// while waiting, so tasks may safely wait on tasks they spawned.
+    pub fn wait(self) -> Result<T, PluginError> {
+        let worker = WORKER_INDEX.with(Cell::get);
+        let mut result = self.slot.result.lock().unwrap();
+
+        loop {
+            if let Some(result) = result.take() {
+                return result.map_err(|_| PluginError::Unknown);
+            }
+
+            if worker.is_some() {
+                drop(result);
+                let ran_task = match shared().find_task(worker) {
+                    Some(task) => {
+                        task();
+                        true
+                    }
+                    None => false,
+                };
+                result = self.slot.result.lock().unwrap();
+                if ran_task || result.is_some() {
+                    continue;
+                }
+            }
+
+            result = self.slot.done.wait(result).unwrap();
+        }
+    }
+}
+
+impl<T> fmt::Debug for TaskHandle<T> {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        f.debug_struct("TaskHandle")
+            .field("finished", &self.is_finished())
+            .finish()
+    }
+}
+
+/// Spawns `f` on the shared pool with the given priority.
+///
+/// This can be called from any plugin callback and from within other pool
+/// tasks. The returned handle can be used to wait for the result.
+pub fn spawn<F, T>(priority: Priority, f: F) -> TaskHandle<T>
+where
+    F: FnOnce() -> T + Send + 'static,
+    T: Send + 'static,
+{
+    let slot = Arc::new(Slot {
+        result: Mutex::new(None),
+        done: Condvar::new(),
+    });
+
+    let task_slot = slot.clone();
+    shared().push(
+        priority,
+        Box::new(move || {
+            let result = catch_unwind(AssertUnwindSafe(f));
+            *task_slot.result.lock().unwrap() = Some(result);
+            task_slot.done.notify_all();
+        }),
+    );
+
+    TaskHandle { slot }
+}
+
+/// Returns the number of worker threads in the pool.
+///
+/// This will start the pool if it isn't running yet.
+pub fn thread_count() -> usize {
+    shared().locals.len()
+}
+
+#[cfg(test)]
+mod tests {
+    use {
+        super::*,
+        std::{sync::mpsc, time::Duration},
+    };
+
+    /// How long a test waits for the pool before considering it stuck.
+    const TIMEOUT: Duration = Duration::from_secs(10);
+
+    /// Returns a task that appends `id` to `log`.
+    fn logger(log: &Arc<Mutex<Vec<u32>>>, id: u32) -> Task {
+        let log = log.clone();
+        Box::new(move || log.lock().unwrap().push(id))
+    }
+
+    /// Runs the tasks `find_task` returns for `index` until there are none.
+    fn drain(shared: &Shared, index: Option<usize>) {
+        while let Some(task) = shared.find_task(index) {
+            task();
+        }
+    }
+
+    #[test]
+    fn visible_tasks_run_first() {
+        let shared = Shared::new(2);
+        let log = Arc::new(Mutex::new(Vec::new()));
+
+        // Spawned from outside the pool, each priority is run in order.
+        shared.push(Priority::Background, logger(&log, 1));
+        shared.push(Priority::Visible, logger(&log, 2));
+        shared.push(Priority::Background, logger(&log, 3));
+        shared.push(Priority::Visible, logger(&log, 4));
+        drain(&shared, None);
+        assert_eq!(*log.lock().unwrap(), [2, 4, 1, 3]);
+        assert_eq!(shared.pending.load(Ordering::SeqCst), 0);
+
+        // Visible tasks are preferred even when they have to be stolen from
+        // another worker, and a worker takes its own tasks newest first.
+        log.lock().unwrap().clear();
+        WORKER_INDEX.with(|w| w.set(Some(0)));
+        shared.push(Priority::Background, logger(&log, 1));
+        shared.push(Priority::Background, logger(&log, 2));
+        WORKER_INDEX.with(|w| w.set(Some(1)));
+        shared.push(Priority::Visible, logger(&log, 3));
+        shared.push(Priority::Visible, logger(&log, 4));
+        WORKER_INDEX.with(|w| w.set(None));
+        drain(&shared, Some(0));
+        assert_eq!(*log.lock().unwrap(), [3, 4, 2, 1]);
+        assert_eq!(shared.pending.load(Ordering::SeqCst), 0);
+    }
+
+    #[test]
+    fn workers_sleep_and_wake_up() {
+        let shared = Shared::new(1);
+        shared.start();
+
+        let (sender, receiver) = mpsc::channel();
+        for round in 0..100 {
+            // Let the worker run out of tasks and go to sleep first.
+            if round % 10 == 0 {
+                thread::sleep(Duration::from_millis(20));
+            }
+            let sender = sender.clone();
+            shared.push(
+                Priority::Background,
+                Box::new(move || sender.send(round).unwrap()),
+            );
+            assert_eq!(receiver.recv_timeout(TIMEOUT), Ok(round));
+        }
+        assert_eq!(shared.pending.load(Ordering::SeqCst), 0);
+    }
+
+    #[test]
+    fn tasks_can_wait_for_tasks_they_spawned() {
+        // More tasks wait than there are workers, so the pool would deadlock
+        // if waiting workers didn't run the tasks they wait for.
+        let (sender, receiver) = mpsc::channel();
+        thread::spawn(move || {
+            let outer: Vec<_> = (0..thread_count() * 4)
+                .map(|i| {
+                    spawn(Priority::Background, move || {
+                        let inner = spawn(Priority::Visible, move || i * 2);
+                        inner.wait().unwrap() + 1
+                    })
+                })
+                .collect();
+            let results: Vec<_> = outer.into_iter().map(|h| h.wait().unwrap()).collect();
+            sender.send(results).unwrap();
+        });
+
+        let results = receiver.recv_timeout(TIMEOUT).expect("pool deadlocked");
+        let expected: Vec<_> = (0..thread_count() * 4).map(|i| i * 2 + 1).collect();
+        assert_eq!(results, expected);
+    }
+
+    #[test]
+    fn panicking_tasks_report_an_unknown_error() {
+        let handle = spawn(Priority::Visible, || -> u32 { panic!("task failed") });
+        assert_eq!(handle.wait(), Err(PluginError::Unknown));
+
+        // The worker that ran the task is still usable.
+        let handles: Vec<_> = (0..thread_count() * 2)
+            .map(|i| spawn(Priority::Visible, move || i))
+            .collect();
+        for (i, handle) in handles.into_iter().enumerate() {
+            assert_eq!(handle.wait(), Ok(i));
+        }
+    }
+}
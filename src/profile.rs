@@ -0,0 +1,251 @@
+//! Per-callback call counts, latency histograms and result sizes.
+//!
+//! A [`Profile`] collects statistics about the calls made into a plugin, and
+//! formats them as a human-readable report. It is used by proxies built with
+//! `profiling_proxy_entry!`, but can be filled by any code that wants to
+//! measure callbacks.
+//!
+//! Latencies are recorded into histograms with power-of-two buckets, so
+//! recording is cheap and memory use is constant, while percentiles are
+//! accurate to within a factor of two.
+//!
+//! [`Profile`]: struct.Profile.html
+
+use std::{collections::BTreeMap, fmt, time::Duration};
+
+/// Number of histogram buckets. Bucket `i` holds durations below `2^i` ns,
+/// the last one also holds all longer durations (above ~9 minutes).
+const BUCKETS: usize = 40;
+
+/// A histogram of durations with power-of-two buckets.
+#[derive(Debug, Copy, Clone, PartialEq, Eq)]
+pub struct Histogram {
+    buckets: [u64; BUCKETS],
+    count: u64,
+    total: Duration,
+    max: Duration,
+}
+
+impl Default for Histogram {
+    fn default() -> Self {
+        Histogram {
+            buckets: [0; BUCKETS],
+            count: 0,
+            total: Duration::default(),
+            max: Duration::default(),
+        }
+    }
+}
+
+impl Histogram {
+    /// Creates an empty histogram.
+    pub fn new() -> Self {
+        Self::default()
+    }
+
+    /// Adds a duration to the histogram.
+    pub fn record(&mut self, duration: Duration) {
+        let ns = duration.as_nanos().min(u64::MAX.into()) as u64;
+        let bucket = (64 - ns.leading_zeros() as usize).min(BUCKETS - 1);
+        self.buckets[bucket] += 1;
+        self.count += 1;
+        self.total += duration;
+        self.max = self.max.max(duration);
+    }
+
+    /// Returns the number of recorded durations.
+    pub fn count(&self) -> u64 {
+        self.count
+    }
+
+    /// Returns the mean of all recorded durations.
+    pub fn mean(&self) -> Duration {
+        match self.count {
+            0 => Duration::default(),
+            count => {
+                let ns = self.total.as_nanos() / u128::from(count);
+                Duration::from_nanos(ns as u64)
+            }
+        }
+    }
+
+    /// Returns the longest recorded duration.
+    pub fn max(&self) -> Duration {
+        self.max
+    }
+
+    /// Returns an upper bound of the `p`th percentile (`0.0..=1.0`).
+    ///
+    /// The bound is the upper end of the bucket containing the percentile, so
+    /// it exceeds the exact percentile by less than a factor of two. It never
+    /// exceeds `max`.
+    pub fn percentile(&self, p: f64) -> Duration {
+        let rank = ((p * self.count as f64).ceil() as u64).max(1);
+        let mut seen = 0;
+        for (bucket, &count) in self.buckets.iter().enumerate() {
+            seen += count;
+            if seen >= rank {
+                return Duration::from_nanos(1 << bucket).min(self.max);
+            }
+        }
+        self.max
+    }
+
+    /// Returns the non-empty buckets as (upper bound, count) pairs.
+    pub fn buckets(&self) -> impl Iterator<Item = (Duration, u64)> + '_ {
+        self.buckets
+            .iter()
+            .enumerate()
+            .filter(|&(_, &count)| count > 0)
+            .map(|(bucket, &count)| (Duration::from_nanos(1 << bucket), count))
+    }
+}
+
+/// Statistics about the calls of one callback.
+#[derive(Debug, Copy, Clone, Default, PartialEq, Eq)]
+pub struct CallStats {
+    /// Latencies of all calls.
+    pub latency: Histogram,
+    /// Number of calls that failed or returned no result.
+    pub failed: u64,
+    /// Number of calls that reported a result size.
+    pub sized: u64,
+    /// Sum of all reported result sizes (eg. the number of search results).
+    pub items: u64,
+}
+
+/// Statistics about all callbacks made into a plugin.
+#[derive(Debug, Clone, Default, PartialEq, Eq)]
+pub struct Profile {
+    calls: BTreeMap<&'static str, CallStats>,
+}
+
+impl Profile {
+    /// Creates an empty profile.
+    pub fn new() -> Self {
+        Self::default()
+    }
+
+    /// Records a call of `callback` that took `duration`.
+    ///
+    /// `ok` is whether the call succeeded, and `items` the size of its result
+    /// if it returned a list or text.
+    pub fn record(
+        &mut self,
+        callback: &'static str,
+        duration: Duration,
+        ok: bool,
+        items: Option<usize>,
+    ) {
+        let stats = self.calls.entry(callback).or_default();
+        stats.latency.record(duration);
+        if !ok {
+            stats.failed += 1;
+        }
+        if let Some(items) = items {
+            stats.sized += 1;
+            stats.items += items as u64;
+        }
+    }
+
+    /// Returns the statistics of `callback`, if it was called.
+    pub fn get(&self, callback: &str) -> Option<&CallStats> {
+        self.calls.get(callback)
+    }
+
+    /// Returns the statistics of all callbacks that were called, ordered by
+    /// name.
+    pub fn iter(&self) -> impl Iterator<Item = (&'static str, &CallStats)> + '_ {
+        self.calls.iter().map(|(&name, stats)| (name, stats))
+    }
+}
+
+/// Formats a duration with a unit suited to its magnitude, eg. `12.5µs`.
+///
+/// Padding and alignment flags apply to the whole text.
+#[derive(Debug, Copy, Clone)]
+pub struct Short(pub Duration);
+
+impl fmt::Display for Short {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        let ns = self.0.as_nanos() as f64;
+        let text = if ns < 1e3 {
+            format!("{:.0}ns", ns)
+        } else if ns < 1e6 {
+            format!("{:.1}µs", ns / 1e3)
+        } else if ns < 1e9 {
+            format!("{:.1}ms", ns / 1e6)
+        } else {
+            format!("{:.2}s", ns / 1e9)
+        };
+        f.pad(&text)
+    }
+}
+
+/// Formats the profile as a table with one row per callback, followed by
+/// the latency histogram of each callback.
+impl fmt::Display for Profile {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        writeln!(
+            f,
+            "{:<26} {:>7} {:>7} {:>9} {:>9} {:>9} {:>9} {:>9} {:>10}",
+            "callback", "calls", "failed", "mean", "p50", "p90", "p99", "max", "items/call"
+        )?;
+        for (name, stats) in self.iter() {
+            let latency = &stats.latency;
+            let items = if stats.sized > 0 {
+                format!("{:.1}", stats.items as f64 / stats.sized as f64)
+            } else {
+                "-".to_string()
+            };
+            writeln!(
+                f,
+                "{:<26} {:>7} {:>7} {:>9} {:>9} {:>9} {:>9} {:>9} {:>10}",
+                name,
+                latency.count(),
+                stats.failed,
+                Short(latency.mean()),
+                Short(latency.percentile(0.5)),
+                Short(latency.percentile(0.9)),
+                Short(latency.percentile(0.99)),
+                Short(latency.max()),
+                items
+            )?;
+        }
+
+        const WIDTH: u64 = 40;
+        for (name, stats) in self.iter() {
+            writeln!(f)?;
+            writeln!(f, "{}:", name)?;
+            let most = stats.latency.buckets().map(|(_, n)| n).max().unwrap_or(1);
+            for (bound, count) in stats.latency.buckets() {
+                let bar = (count * WIDTH + most - 1) / most;
+                writeln!(
+                    f,
+                    "  < {:>8} {:<40} {}",
+                    Short(bound),
+                    "#".repeat(bar as usize),
+                    count
+                )?;
+            }
+        }
+        Ok(())
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn mean_of_many_calls() {
+        let mut histogram = Histogram::new();
+        histogram.record(Duration::from_nanos(3));
+        assert_eq!(histogram.mean(), Duration::from_nanos(3));
+
+        // More calls than fit into a `u32`.
+        histogram.count = 1 << 33;
+        histogram.total = Duration::from_nanos(3 << 33);
+        assert_eq!(histogram.mean(), Duration::from_nanos(3));
+    }
+}
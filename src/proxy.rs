@@ -0,0 +1,966 @@
+//! A proxy plugin that adds caching or profiling in front of an existing
+//! plugin.
+//!
+//! [`proxy_entry!`] builds a plugin library that loads another Zathura plugin
+//! (the *backend*, eg. a PDF plugin written in C) with `dlopen` and forwards
+//! every callback to it. Documents and pages are entirely managed by the
+//! backend; the proxy adds:
+//!
+//! * A cache of rendered pages. Every page rendered for display is kept as an
+//!   image surface of the exact device size it was displayed at, and painted
+//!   from there when the page is rendered at that size again. The cache holds
+//!   up to [`cache_budget`] bytes across all documents, dropping the least
+//!   recently used pages beyond that.
+//! * Prefetching. After a page was rendered, its neighbours are rendered into
+//!   the cache in the background on the shared [`pool`], ordered by a
+//!   [`RenderScheduler`]. Zathura never makes two calls for a document at
+//!   once, and backends rely on that, so every call into the backend for a
+//!   document holds a lock that prefetch jobs take as well. A prefetch job
+//!   therefore never runs alongside a search or any other call Zathura makes
+//!   for the same document.
+//! * A cache of search results. The rectangles found by the most recent
+//!   searches are kept per page, so repeating a search doesn't run it again.
+//!
+//! Pages rendered for printing bypass the caches.
+//!
+//! [`profiling_proxy_entry!`] builds a proxy without caches that instead
+//! measures every callback Zathura makes into the backend: how often it was
+//! called, how long the calls took and how large their results were (eg. the
+//! number of links or search results). When a document is freed, a report of
+//! its [`Profile`] is appended to the file named by the
+//! `ZATHURA_PLUGIN_PROFILE` environment variable, or printed to stderr if it
+//! isn't set. As with tracing, any `%p` in the path is replaced by the
+//! process ID. The measured times include the proxy's own overhead, which is
+//! well below a microsecond per call.
+//!
+//! Zathura reads the MIME types of a plugin before any of its code runs, so
+//! they have to be listed when building the proxy instead of being taken from
+//! the backend. The backend is loaded when the first document is opened, and
+//! should not be installed in Zathura's plugin directory itself, since
+//! Zathura would then pick one of the two plugins for its MIME types at
+//! random.
+//!
+//! [`proxy_entry!`]: ../macro.proxy_entry.html
+//! [`profiling_proxy_entry!`]: ../macro.profiling_proxy_entry.html
+//! [`Profile`]: ../profile/struct.Profile.html
+//! [`cache_budget`]: fn.cache_budget.html
+//! [`pool`]: ../pool/index.html
+//! [`RenderScheduler`]: ../scheduler/struct.RenderScheduler.html
+
+use {
+    crate::{
+        profile::Profile, render_target::RenderTarget, scheduler::RenderScheduler, sys::*,
+        DocumentRef, PageRef, PluginError,
+    },
+    cairo::{Format, ImageSurface},
+    std::{
+        collections::{HashMap, VecDeque},
+        env,
+        ffi::{CStr, CString},
+        fs::OpenOptions,
+        io::Write,
+        os::raw::{c_char, c_int, c_void},
+        panic::{catch_unwind, AssertUnwindSafe},
+        process, ptr,
+        sync::{
+            atomic::{AtomicBool, Ordering},
+            Arc, Mutex, MutexGuard, OnceLock, PoisonError,
+        },
+        time::{Duration, Instant},
+    },
+};
+
+extern "C" {
+    fn dlopen(filename: *const c_char, flags: c_int) -> *mut c_void;
+    fn dlsym(handle: *mut c_void, symbol: *const c_char) -> *mut c_void;
+    fn dlerror() -> *const c_char;
+}
+
+const RTLD_NOW: c_int = 2;
+
+/// Default value of [`cache_budget`](fn.cache_budget.html): 256 MiB, about 30
+/// full-screen pages at 4K.
+const DEFAULT_BUDGET: usize = 256 << 20;
+
+/// Number of searches whose results are kept per document.
+const SEARCHES: usize = 8;
+
+/// Name of the environment variable naming the file profiles are written to.
+pub const PROFILE_VAR: &str = "ZATHURA_PLUGIN_PROFILE";
+
+/// Describes the backend of a proxy.
+///
+/// Implemented by `proxy_entry!` and `profiling_proxy_entry!`.
+#[doc(hidden)]
+pub trait Backend {
+    /// Path of the backend library, as passed to `dlopen`.
+    const PATH: &'static str;
+    /// Whether rendered pages and search results are cached.
+    const CACHE: bool = true;
+    /// Whether the callbacks are profiled.
+    const PROFILE: bool = false;
+
+    /// Loads the backend and returns its functions, or `None` if that
+    /// failed. By default, this loads the library at `PATH`.
+    ///
+    /// Tests override this to put the proxy in front of a plugin that is
+    /// linked into them.
+    fn load() -> Option<zathura_plugin_functions_t> {
+        unsafe { load_library(Self::PATH) }
+    }
+}
+
+type RenderFn =
+    unsafe extern "C" fn(*mut zathura_page_t, *mut c_void, *mut cairo_t, bool) -> zathura_error_t;
+
+/// Statistics about the proxy's caches.
+#[derive(Debug, Copy, Clone, Default, PartialEq, Eq)]
+pub struct ProxyStats {
+    /// Number of rendered pages in the cache.
+    pub cached_pages: usize,
+    /// Memory used by cached pages, in bytes.
+    pub cached_bytes: usize,
+    /// Number of renders served from the cache.
+    pub render_hits: u64,
+    /// Number of renders forwarded to the backend.
+    pub render_misses: u64,
+    /// Number of pages rendered in advance.
+    pub prefetched: u64,
+    /// Number of page searches served from the cache.
+    pub search_hits: u64,
+    /// Number of page searches forwarded to the backend.
+    pub search_misses: u64,
+}
+
+/// The backend's functions, or `None` if it failed to load.
+static BACKEND: OnceLock<Option<zathura_plugin_functions_t>> = OnceLock::new();
+
+/// Loads the plugin library at `path` and returns its functions.
+unsafe fn load_library(path: &str) -> Option<zathura_plugin_functions_t> {
+    let c_path = CString::new(path).ok()?;
+    // The backend stays loaded until the process exits.
+    let handle = dlopen(c_path.as_ptr(), RTLD_NOW);
+    let definition = if handle.is_null() {
+        ptr::null_mut()
+    } else {
+        dlsym(handle, b"zathura_plugin_3_4\0".as_ptr() as *const c_char)
+            as *const zathura_plugin_definition_t
+    };
+    if definition.is_null() {
+        // Zathura only says that the document couldn't be opened, so report
+        // why.
+        let error = dlerror();
+        let error = if error.is_null() {
+            "no plugin definition".into()
+        } else {
+            CStr::from_ptr(error).to_string_lossy()
+        };
+        eprintln!("failed to load plugin {}: {}", path, error);
+        return None;
+    }
+    Some((*definition).functions)
+}
+
+/// Loads the backend if that hasn't been tried yet.
+fn load<B: Backend>() -> Option<&'static zathura_plugin_functions_t> {
+    BACKEND.get_or_init(B::load).as_ref()
+}
+
+/// Returns the backend's functions, if it was loaded.
+fn backend() -> Option<&'static zathura_plugin_functions_t> {
+    BACKEND.get().and_then(Option::as_ref)
+}
+
+fn check(error: zathura_error_t) -> Result<(), PluginError> {
+    PluginError::from_raw(error).unwrap_or(Err(PluginError::Unknown))
+}
+
+fn to_zathura(result: Result<(), PluginError>) -> zathura_error_t {
+    match result {
+        Ok(()) => 0,
+        Err(e) => e as zathura_error_t,
+    }
+}
+
+/// Reports that the backend doesn't implement a callback returning a
+/// pointer.
+unsafe fn unsupported<T>(error: *mut zathura_error_t) -> *mut T {
+    if !error.is_null() {
+        *error = PluginError::NotImplemented as zathura_error_t;
+    }
+    ptr::null_mut()
+}
+
+fn lock<T>(mutex: &Mutex<T>) -> MutexGuard<'_, T> {
+    mutex.lock().unwrap_or_else(PoisonError::into_inner)
+}
+
+/// Results of a search, by page index. Pages without results store the error
+/// the backend reported.
+struct Search {
+    text: CString,
+    pages: HashMap<u32, Result<Vec<zathura_rectangle_t>, zathura_error_t>>,
+}
+
+/// Proxy state of an open document.
+struct DocState {
+    scheduler: RenderScheduler,
+    /// Held while calling into the backend for the document, from Zathura's
+    /// thread or a prefetch job.
+    backend: Mutex<()>,
+    /// Set when Zathura starts freeing the document. Prefetch jobs must not
+    /// access the document after this is set.
+    closing: AtomicBool,
+    /// Recent searches, least recent first.
+    searches: Mutex<VecDeque<Search>>,
+    /// When the document was opened.
+    opened: Instant,
+    /// Calls made into the backend for the document, if profiling.
+    profile: Mutex<Profile>,
+}
+
+impl DocState {
+    /// Stops prefetching, and waits for a running prefetch job to finish.
+    fn close(&self) {
+        self.closing.store(true, Ordering::SeqCst);
+        self.scheduler.clear();
+        drop(lock(&self.backend));
+    }
+}
+
+static DOCUMENTS: OnceLock<Mutex<HashMap<usize, Arc<DocState>>>> = OnceLock::new();
+
+fn documents() -> &'static Mutex<HashMap<usize, Arc<DocState>>> {
+    DOCUMENTS.get_or_init(Default::default)
+}
+
+fn state(document: *mut zathura_document_t) -> Option<Arc<DocState>> {
+    lock(documents()).get(&(document as usize)).cloned()
+}
+
+/// The first argument of a callback, which identifies the document.
+trait Owner: Copy {
+    unsafe fn document(self) -> *mut zathura_document_t;
+}
+
+impl Owner for *mut zathura_document_t {
+    unsafe fn document(self) -> *mut zathura_document_t {
+        self
+    }
+}
+
+impl Owner for *mut zathura_page_t {
+    unsafe fn document(self) -> *mut zathura_document_t {
+        zathura_page_get_document(self)
+    }
+}
+
+/// The value a callback returns.
+trait Outcome {
+    /// Returns whether the call succeeded, and the size of its result if it
+    /// is a list or text.
+    unsafe fn outcome(&self) -> (bool, Option<usize>);
+}
+
+impl Outcome for zathura_error_t {
+    unsafe fn outcome(&self) -> (bool, Option<usize>) {
+        (*self == 0, None)
+    }
+}
+
+impl Outcome for *mut girara_list_t {
+    unsafe fn outcome(&self) -> (bool, Option<usize>) {
+        match self.is_null() {
+            true => (false, None),
+            false => (true, Some(girara_list_size(*self))),
+        }
+    }
+}
+
+impl Outcome for *mut c_char {
+    unsafe fn outcome(&self) -> (bool, Option<usize>) {
+        match self.is_null() {
+            true => (false, None),
+            false => (true, Some(CStr::from_ptr(*self).to_bytes().len())),
+        }
+    }
+}
+
+macro_rules! pointer_outcome {
+    ($($ty:ty),+) => {
+        $(
+            impl Outcome for *mut $ty {
+                unsafe fn outcome(&self) -> (bool, Option<usize>) {
+                    (!self.is_null(), None)
+                }
+            }
+        )+
+    };
+}
+
+pointer_outcome!(girara_tree_node_t, cairo_surface_t, zathura_image_buffer_t);
+
+/// Calls `f` while holding the document's backend lock, so that it doesn't
+/// run alongside a prefetch job.
+unsafe fn exclusive<T>(owner: impl Owner, f: impl FnOnce() -> T) -> T {
+    match state(owner.document()) {
+        Some(state) => {
+            let _backend = lock(&state.backend);
+            f()
+        }
+        None => f(),
+    }
+}
+
+/// Calls `f`, recording the call in the document's profile if the proxy
+/// profiles.
+unsafe fn profiled<B: Backend, T: Outcome>(
+    callback: &'static str,
+    owner: impl Owner,
+    f: impl FnOnce() -> T,
+) -> T {
+    if !B::PROFILE {
+        return f();
+    }
+    let start = Instant::now();
+    let value = f();
+    let elapsed = start.elapsed();
+    if let Some(state) = state(owner.document()) {
+        let (ok, items) = value.outcome();
+        lock(&state.profile).record(callback, elapsed, ok, items);
+    }
+    value
+}
+
+/// Appends the report of a document's profile to the file named by
+/// `ZATHURA_PLUGIN_PROFILE`, or prints it to stderr.
+fn write_report(backend: &str, document: &str, pages: u32, open: Duration, profile: &Profile) {
+    let report = format!(
+        "zathura-plugin profile of {}\ndocument: {} ({} pages, open for {:.1} s)\n\n{}\n",
+        backend,
+        document,
+        pages,
+        open.as_secs_f64(),
+        profile
+    );
+    let path = match env::var_os(PROFILE_VAR) {
+        Some(path) => path
+            .to_string_lossy()
+            .replace("%p", &process::id().to_string()),
+        None => return eprint!("{}", report),
+    };
+    let result = OpenOptions::new()
+        .create(true)
+        .append(true)
+        .open(&path)
+        .and_then(|mut file| file.write_all(report.as_bytes()));
+    if let Err(e) = result {
+        eprintln!("failed to write profile to {}: {}", path, e);
+    }
+}
+
+struct Cached {
+    document: usize,
+    page: u32,
+    width: u32,
+    height: u32,
+    surface: ImageSurface,
+    bytes: usize,
+}
+
+struct Cache {
+    /// Rendered pages, least recently used first.
+    pages: Vec<Cached>,
+    budget: usize,
+    stats: ProxyStats,
+}
+
+// Cairo surfaces are reference counted atomically and not bound to a thread.
+// Cached surfaces are never drawn to, and only accessed while holding the
+// cache's mutex or through a clone that is only read from.
+unsafe impl Send for Cache {}
+
+static CACHE: OnceLock<Mutex<Cache>> = OnceLock::new();
+
+fn cache() -> &'static Mutex<Cache> {
+    CACHE.get_or_init(|| {
+        Mutex::new(Cache {
+            pages: Vec::new(),
+            budget: DEFAULT_BUDGET,
+            stats: ProxyStats::default(),
+        })
+    })
+}
+
+impl Cache {
+    fn position(&self, document: usize, page: u32, width: u32, height: u32) -> Option<usize> {
+        self.pages.iter().rposition(|cached| {
+            cached.document == document
+                && cached.page == page
+                && cached.width == width
+                && cached.height == height
+        })
+    }
+
+    /// Looks up a rendered page and marks it as most recently used.
+    fn get(&mut self, document: usize, page: u32, target: &RenderTarget) -> Option<ImageSurface> {
+        let index = self.position(document, page, target.width, target.height)?;
+        let cached = self.pages.remove(index);
+        let surface = cached.surface.clone();
+        self.pages.push(cached);
+        self.stats.render_hits += 1;
+        Some(surface)
+    }
+
+    fn insert(&mut self, document: usize, page: u32, target: &RenderTarget, surface: ImageSurface) {
+        let bytes = surface.get_stride() as usize * target.height as usize;
+        self.pages.push(Cached {
+            document,
+            page,
+            width: target.width,
+            height: target.height,
+            surface,
+            bytes,
+        });
+        self.stats.cached_bytes += bytes;
+        let budget = self.budget;
+        self.shrink_to(budget);
+    }
+
+    /// Drops the least recently used pages until they fit into `budget`.
+    fn shrink_to(&mut self, budget: usize) {
+        while self.stats.cached_bytes > budget {
+            let cached = self.pages.remove(0);
+            self.stats.cached_bytes -= cached.bytes;
+        }
+        self.stats.cached_pages = self.pages.len();
+    }
+
+    fn remove_document(&mut self, document: usize) {
+        let stats = &mut self.stats;
+        self.pages.retain(|cached| {
+            let keep = cached.document != document;
+            if !keep {
+                stats.cached_bytes -= cached.bytes;
+            }
+            keep
+        });
+        self.stats.cached_pages = self.pages.len();
+    }
+}
+
+/// Returns the maximum amount of memory used for cached pages, in bytes.
+pub fn cache_budget() -> usize {
+    lock(cache()).budget
+}
+
+/// Sets the maximum amount of memory used for cached pages, in bytes.
+///
+/// Cached pages exceeding the new budget are freed immediately. A budget of 0
+/// disables the page cache and prefetching.
+pub fn set_cache_budget(bytes: usize) {
+    let mut cache = lock(cache());
+    cache.budget = bytes;
+    cache.shrink_to(bytes);
+}
+
+/// Returns statistics about the proxy's caches.
+pub fn stats() -> ProxyStats {
+    lock(cache()).stats
+}
+
+/// Lets the backend render a page into a new surface of the target's size.
+///
+/// Like Zathura, the surface is painted white first, since backends only draw
+/// the page's contents.
+unsafe fn render_to_surface(
+    render: RenderFn,
+    page: *mut zathura_page_t,
+    data: *mut c_void,
+    target: &RenderTarget,
+) -> Result<ImageSurface, PluginError> {
+    let surface = ImageSurface::create(Format::ARgb32, target.width as i32, target.height as i32)
+        .map_err(|_| PluginError::OutOfMemory)?;
+    {
+        let cairo = cairo::Context::new(&surface);
+        cairo.set_source_rgb(1.0, 1.0, 1.0);
+        cairo.paint();
+        cairo.scale(target.scale_x, target.scale_y);
+        check(render(page, data, cairo.to_raw_none() as *mut _, false))?;
+    }
+    surface.flush();
+    Ok(surface)
+}
+
+/// Computes the render target Zathura uses for page `index` at the given
+/// document scale and device scaling factors.
+///
+/// This mirrors how Zathura sizes page surfaces, so that it yields the same
+/// size as `RenderTarget::new` does when Zathura renders the page.
+fn display_target(page: &PageRef<'_>, scale: f64, factors: (f64, f64)) -> RenderTarget {
+    let real_scale = (page.width() * scale).ceil() / page.width();
+    let (scale_x, scale_y) = (real_scale * factors.0, real_scale * factors.1);
+    RenderTarget {
+        width: (page.width() * scale_x).ceil() as u32,
+        height: (page.height() * scale_y).ceil() as u32,
+        scale_x,
+        scale_y,
+    }
+}
+
+/// Queues prefetch jobs for the neighbours of page `index`.
+unsafe fn prefetch(
+    document: *mut zathura_document_t,
+    state: &Arc<DocState>,
+    index: u32,
+    render: RenderFn,
+) {
+    if cache_budget() == 0 {
+        return;
+    }
+
+    let doc = DocumentRef::from_raw(document);
+    let (count, scale, factors) = (doc.page_count(), doc.scale(), doc.scaling_factors());
+    let neighbours = [index.checked_sub(1), index.checked_add(1)];
+    for &neighbour in neighbours.iter().flatten().filter(|&&i| i < count) {
+        let state_ref = state.clone();
+        let document = document as usize;
+        state.scheduler.submit(neighbour, move || {
+            let state = state_ref;
+            let _backend = lock(&state.backend);
+            if state.closing.load(Ordering::SeqCst) {
+                return;
+            }
+            unsafe {
+                let page = zathura_document_get_page(document as *mut _, neighbour);
+                if page.is_null() {
+                    return;
+                }
+                let target = display_target(&PageRef::from_raw(page), scale, factors);
+                let cached = lock(cache())
+                    .position(document, neighbour, target.width, target.height)
+                    .is_some();
+                if cached || target.width == 0 || target.height == 0 {
+                    return;
+                }
+                let data = zathura_page_get_data(page);
+                if let Ok(surface) = render_to_surface(render, page, data, &target) {
+                    let mut cache = lock(cache());
+                    cache.stats.prefetched += 1;
+                    cache.insert(document, neighbour, &target, surface);
+                }
+            }
+        });
+    }
+}
+
+/// Open a document with the backend.
+#[doc(hidden)]
+pub unsafe extern "C" fn document_open<B: Backend>(
+    document: *mut zathura_document_t,
+) -> zathura_error_t {
+    let open = match load::<B>() {
+        Some(functions) => functions.document_open,
+        None => return PluginError::Unknown as zathura_error_t,
+    };
+    let open = match open {
+        Some(open) => open,
+        None => return PluginError::NotImplemented as zathura_error_t,
+    };
+
+    let opened = Instant::now();
+    let error = open(document);
+    if error == 0 {
+        let mut profile = Profile::new();
+        if B::PROFILE {
+            profile.record("document_open", opened.elapsed(), true, None);
+        }
+        let state = DocState {
+            scheduler: RenderScheduler::new(),
+            backend: Mutex::new(()),
+            closing: AtomicBool::new(false),
+            searches: Mutex::new(VecDeque::new()),
+            opened,
+            profile: Mutex::new(profile),
+        };
+        lock(documents()).insert(document as usize, Arc::new(state));
+    }
+    error
+}
+
+/// Drop all cached data of a document and let the backend free it. Writes
+/// the document's profile if profiling.
+#[doc(hidden)]
+pub unsafe extern "C" fn document_free<B: Backend>(
+    document: *mut zathura_document_t,
+    data: *mut c_void,
+) -> zathura_error_t {
+    let result = catch_unwind(|| {
+        let state = lock(documents()).remove(&(document as usize));
+        if let Some(state) = &state {
+            state.close();
+        }
+        if B::CACHE {
+            lock(cache()).remove_document(document as usize);
+        }
+        state
+    });
+    let state = match result {
+        Ok(state) => state,
+        Err(_) => return PluginError::Unknown as zathura_error_t,
+    };
+
+    let start = Instant::now();
+    let error = match backend().and_then(|functions| functions.document_free) {
+        Some(free) => free(document, data),
+        None => PluginError::NotImplemented as zathura_error_t,
+    };
+    let elapsed = start.elapsed();
+
+    if let (true, Some(state)) = (B::PROFILE, state) {
+        let result = catch_unwind(AssertUnwindSafe(|| {
+            let mut profile = lock(&state.profile);
+            profile.record("document_free", elapsed, error == 0, None);
+            let doc = DocumentRef::from_raw(document);
+            let path = doc.path_raw().to_string_lossy();
+            let open = state.opened.elapsed();
+            write_report(B::PATH, &path, doc.page_count(), open, &profile);
+        }));
+        if result.is_err() && error == 0 {
+            return PluginError::Unknown as zathura_error_t;
+        }
+    }
+    error
+}
+
+/// Stop prefetching and let the backend free a page.
+#[doc(hidden)]
+pub unsafe extern "C" fn page_clear<B: Backend>(
+    page: *mut zathura_page_t,
+    data: *mut c_void,
+) -> zathura_error_t {
+    let clear = match backend().and_then(|functions| functions.page_clear) {
+        Some(clear) => clear,
+        None => return PluginError::NotImplemented as zathura_error_t,
+    };
+
+    // Zathura only frees pages when closing the document, so no more pages
+    // have to be prefetched.
+    match catch_unwind(|| state(zathura_page_get_document(page))) {
+        Ok(Some(state)) => {
+            state.close();
+            let _backend = lock(&state.backend);
+            profiled::<B, _>("page_clear", page, || clear(page, data))
+        }
+        Ok(None) => clear(page, data),
+        Err(_) => PluginError::Unknown as zathura_error_t,
+    }
+}
+
+/// Render a page from the cache, or let the backend render it.
+#[doc(hidden)]
+pub unsafe extern "C" fn page_render_cairo<B: Backend>(
+    page: *mut zathura_page_t,
+    data: *mut c_void,
+    cairo: *mut cairo_t,
+    printing: bool,
+) -> zathura_error_t {
+    let render = match backend().and_then(|functions| functions.page_render_cairo) {
+        Some(render) => render,
+        None => return PluginError::NotImplemented as zathura_error_t,
+    };
+    profiled::<B, _>("page_render_cairo", page, || {
+        if B::CACHE {
+            render_cached(render, page, data, cairo, printing)
+        } else {
+            exclusive(page, || render(page, data, cairo, printing))
+        }
+    })
+}
+
+/// Renders a page from the cache, or lets the backend render it into the
+/// cache.
+unsafe fn render_cached(
+    render: RenderFn,
+    page: *mut zathura_page_t,
+    data: *mut c_void,
+    cairo: *mut cairo_t,
+    printing: bool,
+) -> zathura_error_t {
+    let result = catch_unwind(AssertUnwindSafe(|| {
+        let document = zathura_page_get_document(page);
+        let state = match state(document) {
+            Some(state) => state,
+            None => return check(render(page, data, cairo, printing)),
+        };
+
+        let p = PageRef::from_raw(page);
+        let index = p.index() as u32;
+        let context = cairo::Context::from_raw_borrow(cairo as *mut _);
+        let target = RenderTarget::new(&p, &context);
+        let cacheable = !printing && target.width > 0 && target.height > 0 && cache_budget() > 0;
+        if !cacheable {
+            let _backend = lock(&state.backend);
+            return check(render(page, data, cairo, printing));
+        }
+
+        state.scheduler.set_current_page(index);
+        let cached = lock(cache()).get(document as usize, index, &target);
+        let surface = match cached {
+            Some(surface) => surface,
+            None => {
+                let _backend = lock(&state.backend);
+                // A prefetch job may have rendered the page in the meantime.
+                let cached = lock(cache()).get(document as usize, index, &target);
+                match cached {
+                    Some(surface) => surface,
+                    None => {
+                        let surface = render_to_surface(render, page, data, &target)?;
+                        let mut cache = lock(cache());
+                        cache.stats.render_misses += 1;
+                        cache.insert(document as usize, index, &target, surface.clone());
+                        surface
+                    }
+                }
+            }
+        };
+
+        context.save();
+        context.scale(1.0 / target.scale_x, 1.0 / target.scale_y);
+        context.set_source_surface(&surface, 0.0, 0.0);
+        context.rectangle(0.0, 0.0, target.width.into(), target.height.into());
+        context.fill();
+        context.restore();
+
+        prefetch(document, &state, index, render);
+        Ok(())
+    }));
+    to_zathura(result.unwrap_or(Err(PluginError::Unknown)))
+}
+
+unsafe extern "C" fn free_rectangle(rectangle: *mut c_void) {
+    drop(Box::from_raw(rectangle as *mut zathura_rectangle_t));
+}
+
+/// Search a page for text, returning cached results if the search was done
+/// recently.
+#[doc(hidden)]
+pub unsafe extern "C" fn page_search_text<B: Backend>(
+    page: *mut zathura_page_t,
+    data: *mut c_void,
+    text: *const c_char,
+    error: *mut zathura_error_t,
+) -> *mut girara_list_t {
+    let search = match backend().and_then(|functions| functions.page_search_text) {
+        Some(search) => search,
+        None => return unsupported(error),
+    };
+    profiled::<B, _>("page_search_text", page, || {
+        if B::CACHE {
+            search_cached(search, page, data, text, error)
+        } else {
+            exclusive(page, || search(page, data, text, error))
+        }
+    })
+}
+
+type SearchFn = unsafe extern "C" fn(
+    *mut zathura_page_t,
+    *mut c_void,
+    *const c_char,
+    *mut zathura_error_t,
+) -> *mut girara_list_t;
+
+/// Searches a page, using the results of recent searches if possible.
+unsafe fn search_cached(
+    search: SearchFn,
+    page: *mut zathura_page_t,
+    data: *mut c_void,
+    text: *const c_char,
+    error: *mut zathura_error_t,
+) -> *mut girara_list_t {
+    let state = match state(zathura_page_get_document(page)) {
+        Some(state) if !text.is_null() => state,
+        _ => return exclusive(page, || search(page, data, text, error)),
+    };
+
+    let index = PageRef::from_raw(page).index() as u32;
+    let query = CStr::from_ptr(text);
+    let cached = lock(&state.searches)
+        .iter()
+        .find(|search| &*search.text == query)
+        .and_then(|search| search.pages.get(&index).cloned());
+    if let Some(result) = cached {
+        lock(cache()).stats.search_hits += 1;
+        return match result {
+            Ok(rectangles) => {
+                let list = girara_list_new2(Some(free_rectangle));
+                for rectangle in rectangles {
+                    girara_list_append(list, Box::into_raw(Box::new(rectangle)) as *mut c_void);
+                }
+                list
+            }
+            Err(code) => {
+                if !error.is_null() {
+                    *error = code;
+                }
+                ptr::null_mut()
+            }
+        };
+    }
+
+    lock(cache()).stats.search_misses += 1;
+    let mut code = 0;
+    let list = {
+        let _backend = lock(&state.backend);
+        search(page, data, text, &mut code)
+    };
+    if !error.is_null() {
+        *error = code;
+    }
+    let result = if list.is_null() {
+        Err(code)
+    } else {
+        let rectangles = (0..girara_list_size(list))
+            .map(|i| *(girara_list_nth(list, i) as *const zathura_rectangle_t))
+            .collect();
+        Ok(rectangles)
+    };
+
+    let mut searches = lock(&state.searches);
+    let position = searches.iter().position(|search| &*search.text == query);
+    let mut entry = match position {
+        Some(position) => searches.remove(position).unwrap(),
+        None => Search {
+            text: query.to_owned(),
+            pages: HashMap::new(),
+        },
+    };
+    entry.pages.insert(index, result);
+    searches.push_back(entry);
+    if searches.len() > SEARCHES {
+        searches.pop_front();
+    }
+    list
+}
+
+/// Defines a trampoline that forwards a callback to the backend unchanged,
+/// while holding the document's backend lock.
+macro_rules! forward {
+    ($(
+        $name:ident($first:ident: $first_ty:ty $(, $arg:ident: $ty:ty)*) -> $ret:ty,
+        $unsupported:expr;
+    )+) => {
+        $(
+            #[doc(hidden)]
+            pub unsafe extern "C" fn $name<B: Backend>(
+                $first: $first_ty $(, $arg: $ty)*
+            ) -> $ret {
+                match backend().and_then(|functions| functions.$name) {
+                    Some(f) => profiled::<B, _>(stringify!($name), $first, || {
+                        exclusive($first, || f($first $(, $arg)*))
+                    }),
+                    None => $unsupported,
+                }
+            }
+        )+
+    };
+}
+
+const NOT_IMPLEMENTED: zathura_error_t = PluginError::NotImplemented as zathura_error_t;
+
+forward! {
+    document_index_generate(
+        document: *mut zathura_document_t,
+        data: *mut c_void,
+        error: *mut zathura_error_t
+    ) -> *mut girara_tree_node_t, unsupported(error);
+    document_save_as(
+        document: *mut zathura_document_t,
+        data: *mut c_void,
+        path: *const c_char
+    ) -> zathura_error_t, NOT_IMPLEMENTED;
+    document_attachments_get(
+        document: *mut zathura_document_t,
+        data: *mut c_void,
+        error: *mut zathura_error_t
+    ) -> *mut girara_list_t, unsupported(error);
+    document_attachment_save(
+        document: *mut zathura_document_t,
+        data: *mut c_void,
+        attachment: *const c_char,
+        file: *const c_char
+    ) -> zathura_error_t, NOT_IMPLEMENTED;
+    document_get_information(
+        document: *mut zathura_document_t,
+        data: *mut c_void,
+        error: *mut zathura_error_t
+    ) -> *mut girara_list_t, unsupported(error);
+    page_init(page: *mut zathura_page_t) -> zathura_error_t, NOT_IMPLEMENTED;
+    page_links_get(
+        page: *mut zathura_page_t,
+        data: *mut c_void,
+        error: *mut zathura_error_t
+    ) -> *mut girara_list_t, unsupported(error);
+    page_form_fields_get(
+        page: *mut zathura_page_t,
+        data: *mut c_void,
+        error: *mut zathura_error_t
+    ) -> *mut girara_list_t, unsupported(error);
+    page_images_get(
+        page: *mut zathura_page_t,
+        data: *mut c_void,
+        error: *mut zathura_error_t
+    ) -> *mut girara_list_t, unsupported(error);
+    page_image_get_cairo(
+        page: *mut zathura_page_t,
+        data: *mut c_void,
+        image: *mut zathura_image_t,
+        error: *mut zathura_error_t
+    ) -> *mut cairo_surface_t, unsupported(error);
+    page_get_text(
+        page: *mut zathura_page_t,
+        data: *mut c_void,
+        rectangle: zathura_rectangle_t,
+        error: *mut zathura_error_t
+    ) -> *mut c_char, unsupported(error);
+    page_render(
+        page: *mut zathura_page_t,
+        data: *mut c_void,
+        error: *mut zathura_error_t
+    ) -> *mut zathura_image_buffer_t, unsupported(error);
+    page_get_label(
+        page: *mut zathura_page_t,
+        data: *mut c_void,
+        label: *mut *mut c_char
+    ) -> zathura_error_t, NOT_IMPLEMENTED;
+}
+
+/// Returns the function table of a proxy for backend `B`.
+///
+/// Zathura reads the table before the backend is loaded, so every callback is
+/// filled in. Callbacks the backend doesn't implement report
+/// `PluginError::NotImplemented`.
+#[doc(hidden)]
+pub const fn functions<B: Backend>() -> zathura_plugin_functions_t {
+    zathura_plugin_functions_t {
+        document_open: Some(document_open::<B>),
+        document_free: Some(document_free::<B>),
+        document_index_generate: Some(document_index_generate::<B>),
+        document_save_as: Some(document_save_as::<B>),
+        document_attachments_get: Some(document_attachments_get::<B>),
+        document_attachment_save: Some(document_attachment_save::<B>),
+        document_get_information: Some(document_get_information::<B>),
+        page_init: Some(page_init::<B>),
+        page_clear: Some(page_clear::<B>),
+        page_search_text: Some(page_search_text::<B>),
+        page_links_get: Some(page_links_get::<B>),
+        page_form_fields_get: Some(page_form_fields_get::<B>),
+        page_images_get: Some(page_images_get::<B>),
+        page_image_get_cairo: Some(page_image_get_cairo::<B>),
+        page_get_text: Some(page_get_text::<B>),
+        page_render: Some(page_render::<B>),
+        page_render_cairo: Some(page_render_cairo::<B>),
+        page_get_label: Some(page_get_label::<B>),
+    }
+}
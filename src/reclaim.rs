@@ -0,0 +1,287 @@
+//! Dropping large plugin data on a background thread.
+//!
+//! Zathura frees a document and its pages on its main thread, when the
+//! document is closed or reloaded, and the wrapper drops the plugin's
+//! `DocumentData` and `PageData` right there. For documents with millions of
+//! parsed objects, that can block Zathura for a noticeable time.
+//!
+//! Wrapping the data in a [`DeferDrop`] moves that work off the critical
+//! path: when a `DeferDrop` is dropped, its value is handed to a single
+//! background thread (the *reclaimer*) which drops it there. A plugin only
+//! has to change its `DocumentData` (or `PageData`) to eg.
+//! `DeferDrop<ParsedDocument>`.
+//!
+//! ```
+//! use zathura_plugin::reclaim::{self, DeferDrop};
+//!
+//! struct ParsedDocument {
+//!     objects: Vec<String>,
+//! }
+//!
+//! let doc = DeferDrop::new(ParsedDocument {
+//!     objects: vec!["obj".to_string(); 100_000],
+//! });
+//! assert_eq!(doc.objects.len(), 100_000);
+//!
+//! // Returns right away, the strings are freed in the background.
+//! drop(doc);
+//! reclaim::flush();
+//! ```
+//!
+//! The reclaimer is started by the first deferred drop. Its queue holds at
+//! most [`QUEUE_DEPTH`] values; when it is full, values are dropped on the
+//! dropping thread instead, so memory is never held back for long and a
+//! burst of drops can't pile up unbounded work. Values whose type has no drop
+//! glue are always dropped inline.
+//!
+//! Every deferred value costs an allocation and a channel send, so wrap a few
+//! large values (like a whole parsed document) rather than many small ones.
+//!
+//! [`DeferDrop`]: struct.DeferDrop.html
+//! [`QUEUE_DEPTH`]: constant.QUEUE_DEPTH.html
+
+use std::{
+    fmt,
+    mem::{self, ManuallyDrop},
+    ops::{Deref, DerefMut},
+    sync::{
+        mpsc::{sync_channel, SyncSender, TrySendError},
+        OnceLock,
+    },
+    thread,
+};
+
+/// Maximum number of values waiting to be dropped by the reclaimer.
+pub const QUEUE_DEPTH: usize = 256;
+
+type Garbage = Box<dyn Send>;
+
+static RECLAIMER: OnceLock<Option<SyncSender<Garbage>>> = OnceLock::new();
+
+/// Returns the queue of the reclaimer thread, starting it if necessary.
+///
+/// Returns `None` if the thread couldn't be started.
+fn reclaimer() -> Option<&'static SyncSender<Garbage>> {
+    RECLAIMER
+        .get_or_init(|| {
+            let (sender, receiver) = sync_channel::<Garbage>(QUEUE_DEPTH);
+            thread::Builder::new()
+                .name("zathura-plugin-reclaim".into())
+                .spawn(move || {
+                    for garbage in receiver {
+                        drop(garbage);
+                    }
+                })
+                .ok()?;
+            Some(sender)
+        })
+        .as_ref()
+}
+
+/// Hands `value` to the reclaimer, or drops it right away if that isn't
+/// worthwhile or possible.
+fn defer<T: Send + 'static>(value: Box<T>) {
+    if !mem::needs_drop::<T>() {
+        return;
+    }
+    let sender = match reclaimer() {
+        Some(sender) => sender,
+        None => return,
+    };
+    match sender.try_send(value) {
+        Ok(()) => {}
+        // Dropping the returned value here applies back pressure.
+        Err(TrySendError::Full(value)) | Err(TrySendError::Disconnected(value)) => drop(value),
+    }
+}
+
+/// Waits until all values handed to the reclaimer so far have been dropped.
+///
+/// Useful in tests and benchmarks that measure memory use after a document
+/// was closed.
+pub fn flush() {
+    let sender = match RECLAIMER.get().and_then(Option::as_ref) {
+        Some(sender) => sender,
+        None => return,
+    };
+
+    /// Signals when it is dropped, which happens after everything queued
+    /// before it.
+    struct Marker(SyncSender<()>);
+
+    impl Drop for Marker {
+        fn drop(&mut self) {
+            let _ = self.0.send(());
+        }
+    }
+
+    let (done, wait) = sync_channel(1);
+    if sender.send(Box::new(Marker(done))).is_ok() {
+        let _ = wait.recv();
+    }
+}
+
+/// A box whose contents are dropped on a background thread.
+///
+/// `DeferDrop<T>` dereferences to `T`, and can be used as a plugin's
+/// `DocumentData` or `PageData` (or any part of it) to keep dropping it from
+/// blocking Zathura. See the [module documentation](index.html) for details.
+pub struct DeferDrop<T: Send + 'static> {
+    value: ManuallyDrop<Box<T>>,
+}
+
+impl<T: Send + 'static> DeferDrop<T> {
+    /// Moves `value` into a new `DeferDrop`.
+    pub fn new(value: T) -> Self {
+        Self {
+            value: ManuallyDrop::new(Box::new(value)),
+        }
+    }
+
+    /// Returns the contained value, which is then dropped normally.
+    pub fn into_inner(this: Self) -> T {
+        let mut this = ManuallyDrop::new(this);
+        // `this` is never used or dropped again.
+        let value = unsafe { ManuallyDrop::take(&mut this.value) };
+        *value
+    }
+}
+
+impl<T: Send + 'static> Drop for DeferDrop<T> {
+    fn drop(&mut self) {
+        // `self.value` is never used again.
+        let value = unsafe { ManuallyDrop::take(&mut self.value) };
+        defer(value);
+    }
+}
+
+impl<T: Send + 'static> Deref for DeferDrop<T> {
+    type Target = T;
+
+    fn deref(&self) -> &T {
+        &self.value
+    }
+}
+
+impl<T: Send + 'static> DerefMut for DeferDrop<T> {
+    fn deref_mut(&mut self) -> &mut T {
+        &mut self.value
+    }
+}
+
+impl<T: Send + Default + 'static> Default for DeferDrop<T> {
+    fn default() -> Self {
+        Self::new(T::default())
+    }
+}
+
+impl<T: Send + 'static> From<T> for DeferDrop<T> {
+    fn from(value: T) -> Self {
+        Self::new(value)
+    }
+}
+
+impl<T: Send + fmt::Debug + 'static> fmt::Debug for DeferDrop<T> {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        f.debug_tuple("DeferDrop").field(&**self).finish()
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use {
+        super::*,
+        std::{
+            sync::{
+                atomic::{AtomicBool, Ordering},
+                mpsc::{channel, Receiver, Sender},
+                Arc, Mutex, PoisonError,
+            },
+            thread::ThreadId,
+            time::Duration,
+        },
+    };
+
+    /// Serializes the tests, since they all use the process-wide reclaimer.
+    static GLOBAL: Mutex<()> = Mutex::new(());
+
+    const TIMEOUT: Duration = Duration::from_secs(10);
+
+    /// Reports the thread it is dropped on.
+    struct Reporter(Sender<ThreadId>);
+
+    impl Drop for Reporter {
+        fn drop(&mut self) {
+            let _ = self.0.send(thread::current().id());
+        }
+    }
+
+    /// Blocks the thread it is dropped on until `release` is signaled.
+    struct Blocker {
+        started: Sender<()>,
+        release: Receiver<()>,
+    }
+
+    impl Drop for Blocker {
+        fn drop(&mut self) {
+            self.started.send(()).unwrap();
+            self.release.recv().unwrap();
+        }
+    }
+
+    #[test]
+    fn values_are_dropped_on_the_reclaimer() {
+        let _global = GLOBAL.lock().unwrap_or_else(PoisonError::into_inner);
+        let (sender, dropped) = channel();
+        drop(DeferDrop::new(Reporter(sender)));
+        let thread = dropped.recv_timeout(TIMEOUT).unwrap();
+        assert_ne!(thread, thread::current().id());
+    }
+
+    #[test]
+    fn values_are_dropped_inline_when_the_queue_is_full() {
+        let _global = GLOBAL.lock().unwrap_or_else(PoisonError::into_inner);
+
+        // Keep the reclaimer busy, so that nothing is taken off the queue.
+        let (started, has_started) = channel();
+        let (release, blocked) = channel();
+        drop(DeferDrop::new(Blocker {
+            started,
+            release: blocked,
+        }));
+        has_started.recv_timeout(TIMEOUT).unwrap();
+
+        let (sender, dropped) = channel();
+        for _ in 0..QUEUE_DEPTH {
+            drop(DeferDrop::new(Reporter(sender.clone())));
+        }
+        assert!(dropped.try_recv().is_err());
+        drop(DeferDrop::new(Reporter(sender)));
+        assert_eq!(dropped.try_recv(), Ok(thread::current().id()));
+
+        release.send(()).unwrap();
+        flush();
+        let queued: Vec<_> = dropped.try_iter().collect();
+        assert_eq!(queued.len(), QUEUE_DEPTH);
+        assert!(queued.iter().all(|&id| id != thread::current().id()));
+    }
+
+    #[test]
+    fn flush_waits_for_queued_drops() {
+        let _global = GLOBAL.lock().unwrap_or_else(PoisonError::into_inner);
+
+        struct Slow(Arc<AtomicBool>);
+
+        impl Drop for Slow {
+            fn drop(&mut self) {
+                thread::sleep(Duration::from_millis(50));
+                self.0.store(true, Ordering::SeqCst);
+            }
+        }
+
+        let dropped = Arc::new(AtomicBool::new(false));
+        drop(DeferDrop::new(Slow(dropped.clone())));
+        flush();
+        assert!(dropped.load(Ordering::SeqCst));
+    }
+}
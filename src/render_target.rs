@@ -0,0 +1,104 @@
+//! Selection of the resolution a page is rasterized at.
+//!
+//! When rendering to the screen, Zathura hands `page_render` a Cairo context
+//! whose transformation scales page points to logical pixels (by
+//! `DocumentRef::scale`), drawing to a surface with a device scale of
+//! `DocumentRef::scaling_factors`. The context is never rotated: Zathura
+//! renders pages unrotated and applies `DocumentRef::rotation` when it
+//! displays the rendered surface. Plugins that rasterize pages themselves
+//! need to combine the scale and the scaling factors to find the number of
+//! pixels to render, and easily get it wrong: multiplying by the scaling
+//! factors again on a HiDPI screen renders 4 times as many pixels as are
+//! displayed.
+//!
+//! [`RenderTarget`] computes the raster size from the context passed to
+//! `page_render`, and [`RenderTarget::render_native`] renders a raster of
+//! exactly that size and composites it onto the page pixel by pixel.
+//!
+//! [`RenderTarget`]: struct.RenderTarget.html
+//! [`RenderTarget::render_native`]: struct.RenderTarget.html#method.render_native
+
+use {
+    crate::{surface_pool, PageRef, PluginError},
+    cairo::{Format, ImageSurface},
+};
+
+/// The device pixel raster a page is displayed at.
+#[derive(Debug, Copy, Clone, PartialEq)]
+pub struct RenderTarget {
+    /// Width of the page raster in device pixels.
+    pub width: u32,
+    /// Height of the page raster in device pixels.
+    pub height: u32,
+    /// Device pixels per point along the page's X axis.
+    pub scale_x: f64,
+    /// Device pixels per point along the page's Y axis.
+    pub scale_y: f64,
+}
+
+impl RenderTarget {
+    /// Computes the render target for drawing `page` to `cairo`.
+    ///
+    /// `cairo` must be the context passed to `page_render`, with its
+    /// transformation unchanged. The scale is taken from that transformation
+    /// and the target surface's device scale rather than from
+    /// `DocumentRef::scale`, since Zathura rounds the page size to whole
+    /// pixels and adjusts the scale accordingly, and since printing uses an
+    /// unrelated transformation.
+    pub fn new(page: &PageRef<'_>, cairo: &cairo::Context) -> Self {
+        let matrix = cairo.get_matrix();
+        let (device_x, device_y) = cairo.get_target().get_device_scale();
+
+        // Length of the page's unit vectors in device space.
+        let scale_x = matrix.xx.hypot(matrix.yx * device_y / device_x) * device_x;
+        let scale_y = matrix.yy.hypot(matrix.xy * device_x / device_y) * device_y;
+
+        RenderTarget {
+            width: (page.width() * scale_x).ceil() as u32,
+            height: (page.height() * scale_y).ceil() as u32,
+            scale_x,
+            scale_y,
+        }
+    }
+
+    /// Renders the page once at native device resolution and draws the result
+    /// onto `cairo`.
+    ///
+    /// `draw` is passed a transparent `ImageSurface` of the given
+    /// format, and must render the page into its top left `width` x `height`
+    /// pixels, at `scale_x` / `scale_y` pixels per point. The surface comes
+    /// from the [`surface_pool`], so it may be larger than requested; pixels
+    /// outside of the page area are ignored. `draw` must not keep references
+    /// to the surface (such as a `cairo::Context`) around.
+    ///
+    /// The raster is then drawn onto `cairo` with one raster pixel per device
+    /// pixel, so no resampling takes place.
+    ///
+    /// [`surface_pool`]: ../surface_pool/index.html
+    pub fn render_native<F>(
+        &self,
+        cairo: &cairo::Context,
+        format: Format,
+        draw: F,
+    ) -> Result<(), PluginError>
+    where
+        F: FnOnce(&mut ImageSurface) -> Result<(), PluginError>,
+    {
+        if self.width == 0 || self.height == 0 {
+            return Ok(());
+        }
+
+        let (width, height) = (self.width as i32, self.height as i32);
+        let mut surface = surface_pool::acquire(format, width, height)?;
+        draw(&mut surface)?;
+        surface.flush();
+
+        cairo.save();
+        cairo.scale(1.0 / self.scale_x, 1.0 / self.scale_y);
+        cairo.set_source_surface(&surface, 0.0, 0.0);
+        cairo.rectangle(0.0, 0.0, width.into(), height.into());
+        cairo.fill();
+        cairo.restore();
+        Ok(())
+    }
+}
@@ -0,0 +1,305 @@
+//! Per-document scheduling of page jobs, favouring the page being viewed.
+//!
+//! A [`RenderScheduler`] queues render, decode or prefetch jobs for individual
+//! pages and runs them on the shared [`pool`]. Jobs are not ordered by
+//! submission time, but by their distance to the document's current page: each
+//! time a worker becomes available, it runs the queued job closest to the page
+//! the user is looking at. Since this distance is evaluated when the job is
+//! picked, moving to another page immediately reprioritizes all queued jobs.
+//!
+//! [`RenderScheduler`]: struct.RenderScheduler.html
+//! [`pool`]: ../pool/index.html
+
+use {
+    crate::{
+        pool::{self, Priority},
+        DocumentRef,
+    },
+    std::{
+        collections::{BTreeMap, VecDeque},
+        fmt,
+        sync::{Arc, Mutex},
+    },
+};
+
+type Job = Box<dyn FnOnce() + Send + 'static>;
+
+#[derive(Default)]
+struct State {
+    current_page: u32,
+    /// Queued jobs by page index.
+    jobs: BTreeMap<u32, VecDeque<Job>>,
+    len: usize,
+}
+
+impl State {
+    /// Removes the job for the page closest to the current page.
+    ///
+    /// When two pages are equally far away, the one after the current page is
+    /// preferred, since that's where readers usually go next.
+    fn pop_nearest(&mut self) -> Option<Job> {
+        let current = self.current_page;
+        let after = self.jobs.range(current..).next().map(|(&i, _)| i);
+        let before = self.jobs.range(..current).next_back().map(|(&i, _)| i);
+
+        let page = match (after, before) {
+            (Some(a), Some(b)) if current - b < a - current => b,
+            (Some(a), _) => a,
+            (None, Some(b)) => b,
+            (None, None) => return None,
+        };
+
+        let queue = self.jobs.get_mut(&page).unwrap();
+        let job = queue.pop_front();
+        if queue.is_empty() {
+            self.jobs.remove(&page);
+        }
+        self.len -= 1;
+        job
+    }
+}
+
+/// Schedules page jobs of a document by distance to its current page.
+///
+/// The scheduler is cheap to clone; all clones refer to the same job queue.
+/// It is typically stored in the plugin's `DocumentData` and updated from
+/// `page_render` via [`update_current_page`].
+///
+/// # Examples
+///
+/// ```no_run
+/// use zathura_plugin::scheduler::RenderScheduler;
+///
+/// let scheduler = RenderScheduler::new();
+/// for page in 0..10 {
+///     scheduler.submit(page, move || println!("decoding page {}", page));
+/// }
+///
+/// // Page 7 is decoded first from now on, then 6 and 8, and so on.
+/// scheduler.set_current_page(7);
+/// ```
+///
+/// [`update_current_page`]: #method.update_current_page
+#[derive(Clone, Default)]
+pub struct RenderScheduler {
+    state: Arc<Mutex<State>>,
+}
+
+impl RenderScheduler {
+    /// Creates a scheduler with an empty queue and page 0 as current page.
+    pub fn new() -> Self {
+        Self::default()
+    }
+
+    /// Queues `job` for the page at `page_index`.
+    ///
+    /// Jobs for the current page are run with `Priority::Visible` on the
+    /// shared pool, all other jobs with `Priority::Background`.
+    pub fn submit<F>(&self, page_index: u32, job: F)
+    where
+        F: FnOnce() + Send + 'static,
+    {
+        let priority = {
+            let mut state = self.state.lock().unwrap();
+            state
+                .jobs
+                .entry(page_index)
+                .or_default()
+                .push_back(Box::new(job));
+            state.len += 1;
+
+            if page_index == state.current_page {
+                Priority::Visible
+            } else {
+                Priority::Background
+            }
+        };
+
+        self.dispatch(priority);
+    }
+
+    /// Sets the page the user is looking at.
+    ///
+    /// All queued jobs are reprioritized relative to this page. If jobs for the
+    /// new current page are queued, they are dispatched with
+    /// `Priority::Visible` so that they also overtake other documents'
+    /// background work.
+    pub fn set_current_page(&self, page_index: u32) {
+        let visible_jobs = {
+            let mut state = self.state.lock().unwrap();
+            if state.current_page == page_index {
+                return;
+            }
+            state.current_page = page_index;
+            state.jobs.get(&page_index).map_or(0, VecDeque::len)
+        };
+
+        // Every dispatch runs at most one job, so surplus dispatches that find
+        // the queue empty later on are harmless.
+        for _ in 0..visible_jobs {
+            self.dispatch(Priority::Visible);
+        }
+    }
+
+    /// Sets the current page to the one focused in `doc`.
+    pub fn update_current_page(&self, doc: &DocumentRef<'_>) {
+        self.set_current_page(doc.current_page_index());
+    }
+
+    /// Returns the page index jobs are currently prioritized around.
+    pub fn current_page(&self) -> u32 {
+        self.state.lock().unwrap().current_page
+    }
+
+    /// Returns the number of queued jobs that haven't started yet.
+    pub fn pending(&self) -> usize {
+        self.state.lock().unwrap().len
+    }
+
+    /// Drops all queued jobs for pages more than `distance` pages away from
+    /// the current page.
+    ///
+    /// This is useful during rapid navigation, when work for pages that have
+    /// been scrolled past is no longer needed.
+    pub fn retain_within(&self, distance: u32) {
+        let mut state = self.state.lock().unwrap();
+        let current = state.current_page;
+        let mut dropped = 0;
+        state.jobs.retain(|&page, queue| {
+            let keep = page.max(current) - page.min(current) <= distance;
+            if !keep {
+                dropped += queue.len();
+            }
+            keep
+        });
+        state.len -= dropped;
+    }
+
+    /// Drops all queued jobs.
+    pub fn clear(&self) {
+        let mut state = self.state.lock().unwrap();
+        state.jobs.clear();
+        state.len = 0;
+    }
+
+    fn dispatch(&self, priority: Priority) {
+        let state = self.state.clone();
+        pool::spawn(priority, move || {
+            let job = state.lock().unwrap().pop_nearest();
+            if let Some(job) = job {
+                job();
+            }
+        });
+    }
+}
+
+impl fmt::Debug for RenderScheduler {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        let state = self.state.lock().unwrap();
+        f.debug_struct("RenderScheduler")
+            .field("current_page", &state.current_page)
+            .field("pending", &state.len)
+            .finish()
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use {
+        super::*,
+        std::{sync::mpsc, time::Duration},
+    };
+
+    /// Queues a job for `page` that logs the page when run, without
+    /// dispatching it to the pool.
+    fn queue(scheduler: &RenderScheduler, page: u32, log: &mpsc::Sender<u32>) {
+        let log = log.clone();
+        let mut state = scheduler.state.lock().unwrap();
+        state
+            .jobs
+            .entry(page)
+            .or_default()
+            .push_back(Box::new(move || log.send(page).unwrap()));
+        state.len += 1;
+    }
+
+    /// Runs all queued jobs in the order the pool would and returns the pages
+    /// they were queued for.
+    fn run_all(scheduler: &RenderScheduler, log: &mpsc::Receiver<u32>) -> Vec<u32> {
+        loop {
+            let job = scheduler.state.lock().unwrap().pop_nearest();
+            match job {
+                Some(job) => job(),
+                None => break,
+            }
+        }
+        log.try_iter().collect()
+    }
+
+    #[test]
+    fn nearest_page_first() {
+        let scheduler = RenderScheduler::new();
+        let (sender, log) = mpsc::channel();
+        for &page in &[0, 9, 4, 2, 6, 6] {
+            queue(&scheduler, page, &sender);
+        }
+        scheduler.state.lock().unwrap().current_page = 4;
+
+        // Ties are broken towards later pages, and jobs of the same page run
+        // in submission order.
+        assert_eq!(run_all(&scheduler, &log), [4, 6, 6, 2, 0, 9]);
+        assert_eq!(scheduler.pending(), 0);
+    }
+
+    #[test]
+    fn moving_reprioritizes_queued_jobs() {
+        let scheduler = RenderScheduler::new();
+        let (sender, log) = mpsc::channel();
+        for page in 0..6 {
+            queue(&scheduler, page, &sender);
+        }
+
+        // No job is queued for page 10, so nothing is dispatched.
+        scheduler.set_current_page(10);
+        assert_eq!(scheduler.current_page(), 10);
+        assert_eq!(run_all(&scheduler, &log), [5, 4, 3, 2, 1, 0]);
+
+        // Jobs for the new current page are dispatched right away.
+        for page in 0..6 {
+            queue(&scheduler, page, &sender);
+        }
+        scheduler.set_current_page(3);
+        assert_eq!(log.recv_timeout(Duration::from_secs(10)), Ok(3));
+        assert_eq!(scheduler.pending(), 5);
+        assert_eq!(run_all(&scheduler, &log), [4, 2, 5, 1, 0]);
+    }
+
+    #[test]
+    fn distant_jobs_are_dropped() {
+        let scheduler = RenderScheduler::new();
+        let (sender, log) = mpsc::channel();
+        for page in 0..20 {
+            queue(&scheduler, page, &sender);
+        }
+        scheduler.state.lock().unwrap().current_page = 10;
+
+        scheduler.retain_within(2);
+        assert_eq!(scheduler.pending(), 5);
+        assert_eq!(run_all(&scheduler, &log), [10, 11, 9, 12, 8]);
+    }
+
+    #[test]
+    fn clearing_drops_queued_jobs() {
+        let scheduler = RenderScheduler::new();
+        let (sender, log) = mpsc::channel();
+        for page in 0..4 {
+            queue(&scheduler, page, &sender);
+        }
+        drop(sender);
+
+        scheduler.clear();
+        assert_eq!(scheduler.pending(), 0);
+        // The jobs, and the senders they held, were dropped without running.
+        assert_eq!(log.recv(), Err(mpsc::RecvError));
+    }
+}
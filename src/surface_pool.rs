@@ -0,0 +1,418 @@
+//! A process-wide pool of reusable scratch image surfaces.
+//!
+//! Plugins that render into an intermediate surface (for compositing raster
+//! images, masking or applying filters) would otherwise create and destroy a
+//! page-sized surface on every `page_render` call. At HiDPI resolutions such a
+//! surface is tens of megabytes, so every render pays for mapping and
+//! unmapping fresh memory. Instead, [`acquire`] hands out a surface from the
+//! pool, and the returned [`ScratchSurface`] guard puts it back when dropped.
+//!
+//! Surfaces are bucketed by format and by size rounded up to [`TILE_SIZE`], so
+//! that renders of the same page at slightly different zoom levels can share
+//! a surface. A surface handed out by the pool may therefore be larger than
+//! requested.
+//!
+//! The pool keeps at most [`budget`] bytes of idle surfaces, dropping the
+//! least recently used ones beyond that. If creating a new surface fails,
+//! which happens when memory is exhausted, the idle surfaces are freed before
+//! trying again. The pool doesn't watch the system's memory otherwise:
+//! [`trim`] frees all idle surfaces, and has to be called by the plugin, eg.
+//! when it knows that memory is scarce or no more rendering is expected
+//! soon.
+//!
+//! [`acquire`]: fn.acquire.html
+//! [`ScratchSurface`]: struct.ScratchSurface.html
+//! [`TILE_SIZE`]: constant.TILE_SIZE.html
+//! [`budget`]: fn.budget.html
+//! [`trim`]: fn.trim.html
+
+use {
+    crate::PluginError,
+    cairo::{Format, ImageSurface},
+    std::{
+        fmt,
+        ops::{Deref, DerefMut},
+        sync::{Mutex, OnceLock},
+    },
+};
+
+/// Surface dimensions are rounded up to multiples of this many pixels.
+pub const TILE_SIZE: i32 = 256;
+
+/// Default value of [`budget`](fn.budget.html): 128 MiB, enough for a few
+/// full-screen surfaces at 4K.
+const DEFAULT_BUDGET: usize = 128 << 20;
+
+struct Idle {
+    format: Format,
+    width: i32,
+    height: i32,
+    surface: ImageSurface,
+    bytes: usize,
+}
+
+/// Statistics about the surface pool.
+#[derive(Debug, Copy, Clone, Default, PartialEq, Eq)]
+pub struct SurfacePoolStats {
+    /// Number of idle surfaces in the pool.
+    pub idle: usize,
+    /// Memory used by idle surfaces, in bytes.
+    pub idle_bytes: usize,
+    /// Number of requests served with a pooled surface.
+    pub hits: u64,
+    /// Number of requests that had to create a new surface.
+    pub misses: u64,
+}
+
+struct Pool {
+    /// Idle surfaces, least recently used first.
+    idle: Vec<Idle>,
+    budget: usize,
+    stats: SurfacePoolStats,
+}
+
+// Cairo surfaces are reference counted atomically and not bound to a thread.
+// Idle surfaces are only accessed while holding the pool's mutex, and a
+// surface is only ever handed out to a single `ScratchSurface` at a time: it
+// is only returned to the pool if the guard held the last reference to it.
+unsafe impl Send for Pool {}
+
+static POOL: OnceLock<Mutex<Pool>> = OnceLock::new();
+
+fn pool() -> &'static Mutex<Pool> {
+    POOL.get_or_init(|| {
+        Mutex::new(Pool {
+            idle: Vec::new(),
+            budget: DEFAULT_BUDGET,
+            stats: SurfacePoolStats::default(),
+        })
+    })
+}
+
+impl Pool {
+    /// Removes the least recently used idle surfaces until the rest fit into
+    /// `budget`.
+    ///
+    /// The removed surfaces are returned, so that they can be freed after the
+    /// pool's lock was released.
+    #[must_use]
+    fn shrink_to(&mut self, budget: usize) -> Vec<Idle> {
+        let mut evict = 0;
+        while self.stats.idle_bytes > budget {
+            self.stats.idle_bytes -= self.idle[evict].bytes;
+            evict += 1;
+        }
+        let evicted = self.idle.drain(..evict).collect();
+        self.stats.idle = self.idle.len();
+        evicted
+    }
+}
+
+fn round_up(size: i32) -> i32 {
+    (size + TILE_SIZE - 1) / TILE_SIZE * TILE_SIZE
+}
+
+/// A scratch surface borrowed from the pool.
+///
+/// Dereferences to the underlying `ImageSurface`. The surface is at least as
+/// large as requested, and the requested area is fully transparent when the
+/// surface is handed out; contents outside of that area are unspecified.
+///
+/// When dropped, the surface is returned to the pool. If other references to
+/// the surface are still alive at that point (eg. a clone of the surface, a
+/// `cairo::Context` drawing to it, or a pattern using it as a source), the
+/// surface is freed instead once they are gone, so it is never handed out
+/// again while someone else can still access it.
+pub struct ScratchSurface {
+    surface: Option<ImageSurface>,
+    format: Format,
+    width: i32,
+    height: i32,
+}
+
+impl ScratchSurface {
+    /// Returns the requested width in pixels.
+    pub fn width(&self) -> i32 {
+        self.width
+    }
+
+    /// Returns the requested height in pixels.
+    pub fn height(&self) -> i32 {
+        self.height
+    }
+}
+
+impl Deref for ScratchSurface {
+    type Target = ImageSurface;
+
+    fn deref(&self) -> &ImageSurface {
+        self.surface.as_ref().unwrap()
+    }
+}
+
+impl DerefMut for ScratchSurface {
+    fn deref_mut(&mut self) -> &mut ImageSurface {
+        self.surface.as_mut().unwrap()
+    }
+}
+
+impl Drop for ScratchSurface {
+    fn drop(&mut self) {
+        let surface = self.surface.take().unwrap();
+        // Surfaces that are still referenced elsewhere (or that were replaced
+        // through `DerefMut`) are not pooled.
+        let references =
+            unsafe { cairo_sys::cairo_surface_get_reference_count(surface.to_raw_none()) };
+        if references != 1 || surface.get_format() != self.format {
+            return;
+        }
+
+        let bytes = surface.get_stride() as usize * surface.get_height() as usize;
+        let mut pool = pool().lock().unwrap();
+        if bytes > pool.budget {
+            return;
+        }
+
+        pool.idle.push(Idle {
+            format: self.format,
+            width: surface.get_width(),
+            height: surface.get_height(),
+            surface,
+            bytes,
+        });
+        pool.stats.idle_bytes += bytes;
+        let budget = pool.budget;
+        let evicted = pool.shrink_to(budget);
+        drop(pool);
+        drop(evicted);
+    }
+}
+
+impl fmt::Debug for ScratchSurface {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        f.debug_struct("ScratchSurface")
+            .field("format", &self.format)
+            .field("width", &self.width)
+            .field("height", &self.height)
+            .finish()
+    }
+}
+
+/// Obtains a transparent `width` x `height` surface of the given format.
+///
+/// Reuses an idle surface of the same format and rounded size if there is
+/// one, and creates a new surface otherwise. Fails with
+/// `PluginError::OutOfMemory` if Cairo can't create the surface, even after
+/// all idle surfaces were freed.
+pub fn acquire(format: Format, width: i32, height: i32) -> Result<ScratchSurface, PluginError> {
+    if width <= 0 || height <= 0 {
+        return Err(PluginError::InvalidArguments);
+    }
+
+    let (rounded_width, rounded_height) = (round_up(width), round_up(height));
+    let reused = {
+        let mut pool = pool().lock().unwrap();
+        let found = pool.idle.iter().rposition(|idle| {
+            idle.format == format && idle.width == rounded_width && idle.height == rounded_height
+        });
+        match found {
+            Some(index) => {
+                let idle = pool.idle.remove(index);
+                pool.stats.idle = pool.idle.len();
+                pool.stats.idle_bytes -= idle.bytes;
+                pool.stats.hits += 1;
+                Some(idle.surface)
+            }
+            None => {
+                pool.stats.misses += 1;
+                None
+            }
+        }
+    };
+
+    let surface = match reused {
+        Some(surface) => {
+            // Only the requested area has to be cleared.
+            let cr = cairo::Context::new(&surface);
+            cr.set_operator(cairo::Operator::Clear);
+            cr.rectangle(0.0, 0.0, width.into(), height.into());
+            cr.fill();
+            surface
+        }
+        // New surfaces are already cleared by Cairo.
+        None => create(format, rounded_width, rounded_height)?,
+    };
+
+    Ok(ScratchSurface {
+        surface: Some(surface),
+        format,
+        width,
+        height,
+    })
+}
+
+/// Creates a new surface, freeing the idle surfaces first if that fails.
+fn create(format: Format, width: i32, height: i32) -> Result<ImageSurface, PluginError> {
+    ImageSurface::create(format, width, height)
+        .or_else(|_| {
+            trim();
+            ImageSurface::create(format, width, height)
+        })
+        .map_err(|_| PluginError::OutOfMemory)
+}
+
+/// Returns the maximum amount of memory kept in idle surfaces, in bytes.
+pub fn budget() -> usize {
+    pool().lock().unwrap().budget
+}
+
+/// Sets the maximum amount of memory kept in idle surfaces, in bytes.
+///
+/// Idle surfaces exceeding the new budget are freed immediately. A budget of
+/// 0 disables pooling.
+pub fn set_budget(bytes: usize) {
+    let evicted = {
+        let mut pool = pool().lock().unwrap();
+        pool.budget = bytes;
+        pool.shrink_to(bytes)
+    };
+    drop(evicted);
+}
+
+/// Frees all idle surfaces.
+///
+/// Surfaces that are currently in use are returned to the pool as usual.
+pub fn trim() {
+    let evicted = pool().lock().unwrap().shrink_to(0);
+    drop(evicted);
+}
+
+/// Returns statistics about the surface pool.
+pub fn stats() -> SurfacePoolStats {
+    pool().lock().unwrap().stats
+}
+
+impl fmt::Debug for Pool {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        f.debug_struct("Pool")
+            .field("idle", &self.idle.len())
+            .field("budget", &self.budget)
+            .finish()
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use {super::*, std::sync::PoisonError};
+
+    /// Serializes the tests, since they all use the process-wide pool.
+    static GLOBAL: Mutex<()> = Mutex::new(());
+
+    /// Size of an idle `ARgb32` surface of one tile.
+    const TILE_BYTES: usize = (TILE_SIZE * TILE_SIZE * 4) as usize;
+
+    /// Locks the pool for a test and empties it.
+    fn reset() -> std::sync::MutexGuard<'static, ()> {
+        let global = GLOBAL.lock().unwrap_or_else(PoisonError::into_inner);
+        set_budget(DEFAULT_BUDGET);
+        trim();
+        global
+    }
+
+    fn id(surface: &ScratchSurface) -> usize {
+        surface.to_raw_none() as usize
+    }
+
+    #[test]
+    fn sizes_are_rounded_up_to_tiles() {
+        let _global = reset();
+        for &(requested, rounded) in &[(1, 256), (256, 256), (257, 512), (700, 768)] {
+            let surface = acquire(Format::A8, requested, 10).unwrap();
+            assert_eq!((surface.width(), surface.height()), (requested, 10));
+            assert_eq!((surface.get_width(), surface.get_height()), (rounded, 256));
+        }
+        assert_eq!(
+            acquire(Format::A8, 0, 10).unwrap_err(),
+            PluginError::InvalidArguments
+        );
+    }
+
+    #[test]
+    fn surfaces_are_reused_within_a_bucket() {
+        let _global = reset();
+        let before = stats();
+        let first = acquire(Format::ARgb32, 300, 200).unwrap();
+        let first_id = id(&first);
+        drop(first);
+        assert_eq!(stats().idle, 1);
+
+        // Same format and rounded size.
+        let again = acquire(Format::ARgb32, 500, 256).unwrap();
+        assert_eq!(id(&again), first_id);
+        // Another format, and another rounded size.
+        let other_format = acquire(Format::A8, 300, 200).unwrap();
+        let other_size = acquire(Format::ARgb32, 300, 300).unwrap();
+        let after = stats();
+        assert_eq!(
+            (after.hits - before.hits, after.misses - before.misses),
+            (1, 3)
+        );
+        drop((again, other_format, other_size));
+        assert_eq!(stats().idle, 3);
+    }
+
+    #[test]
+    fn least_recently_used_surfaces_are_evicted() {
+        let _global = reset();
+        set_budget(2 * TILE_BYTES);
+        let surfaces: Vec<_> = (0..3)
+            .map(|_| acquire(Format::ARgb32, TILE_SIZE, TILE_SIZE).unwrap())
+            .collect();
+        let ids: Vec<_> = surfaces.iter().map(id).collect();
+        drop(surfaces);
+
+        // The first surface was returned first, so it was evicted.
+        let pooled = stats();
+        assert_eq!((pooled.idle, pooled.idle_bytes), (2, 2 * TILE_BYTES));
+        // The most recently returned surface is handed out first.
+        let third = acquire(Format::ARgb32, TILE_SIZE, TILE_SIZE).unwrap();
+        let second = acquire(Format::ARgb32, TILE_SIZE, TILE_SIZE).unwrap();
+        assert_eq!((id(&third), id(&second)), (ids[2], ids[1]));
+        drop((third, second));
+
+        // Surfaces larger than the whole budget are never pooled.
+        drop(acquire(Format::ARgb32, 3 * TILE_SIZE, TILE_SIZE).unwrap());
+        assert_eq!(stats().idle_bytes, 2 * TILE_BYTES);
+        set_budget(0);
+        assert_eq!(stats().idle, 0);
+    }
+
+    #[test]
+    fn referenced_surfaces_are_not_pooled() {
+        let _global = reset();
+        let cloned = acquire(Format::ARgb32, 10, 10).unwrap();
+        let clone = ImageSurface::clone(&cloned);
+        drop(cloned);
+        let drawn_to = acquire(Format::ARgb32, 10, 10).unwrap();
+        let context = cairo::Context::new(&drawn_to);
+        drop(drawn_to);
+        assert_eq!(stats().idle, 0);
+
+        drop((clone, context));
+        assert_eq!(stats().idle, 0);
+        drop(acquire(Format::ARgb32, 10, 10).unwrap());
+        assert_eq!(stats().idle, 1);
+    }
+
+    #[test]
+    fn idle_surfaces_are_freed_when_creating_one_fails() {
+        let _global = reset();
+        drop(acquire(Format::ARgb32, 10, 10).unwrap());
+        assert_eq!(stats().idle, 1);
+
+        // Larger than Cairo supports, so creating it always fails.
+        let error = acquire(Format::ARgb32, 40_000, 10).unwrap_err();
+        assert_eq!(error, PluginError::OutOfMemory);
+        assert_eq!(stats().idle, 0);
+    }
+}
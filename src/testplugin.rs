@@ -0,0 +1,174 @@
+//! A reference plugin that displays plain text files.
+//!
+//! This plugin is built with the `testplugin` feature, and registered for
+//! `text/plain` so that it can be loaded into Zathura. It is written like a
+//! real plugin would be: opening a document reads and paginates the whole
+//! file, `page_init` only assigns each page its lines, and each page is
+//! recorded into a [`DisplayList`] when it is first rendered and replayed
+//! afterwards. Pages can also be searched. The benchmarks use it as their
+//! baseline plugin.
+//!
+//! [`DisplayList`]: ../display_list/struct.DisplayList.html
+
+use {
+    crate::{
+        display_list::{DisplayList, DisplayListBuilder},
+        sys::zathura_rectangle_t,
+        DocumentInfo, DocumentRef, PageInfo, PageRef, PluginError, ZathuraPlugin,
+    },
+    cairo::{FontSlant, FontWeight},
+    std::{ffi::OsStr, fs, ops::Range, os::unix::ffi::OsStrExt, path::Path},
+};
+
+/// Page size in points (A4).
+const PAGE_WIDTH: f64 = 595.0;
+const PAGE_HEIGHT: f64 = 842.0;
+const MARGIN: f64 = 56.0;
+const FONT_SIZE: f64 = 10.0;
+const LINE_HEIGHT: f64 = 12.0;
+/// Approximate advance of a monospace character at `FONT_SIZE`.
+const CHAR_WIDTH: f64 = 0.6 * FONT_SIZE;
+/// Lines longer than this many characters are wrapped.
+const LINE_LENGTH: usize = 80;
+
+/// The reference plugin.
+#[derive(Debug)]
+pub struct TestPlugin;
+
+/// An open text document.
+#[derive(Debug)]
+pub struct TextDocument {
+    text: String,
+    /// Byte ranges of all (wrapped) lines in `text`.
+    lines: Vec<Range<usize>>,
+}
+
+impl TextDocument {
+    fn lines_per_page() -> usize {
+        ((PAGE_HEIGHT - 2.0 * MARGIN) / LINE_HEIGHT) as usize
+    }
+
+    fn page_count(&self) -> usize {
+        ((self.lines.len() + Self::lines_per_page() - 1) / Self::lines_per_page()).max(1)
+    }
+}
+
+/// A page of a `TextDocument`.
+#[derive(Debug)]
+pub struct TextPage {
+    /// Indices of the lines on this page.
+    lines: Range<usize>,
+    /// The page contents, recorded on first render.
+    display_list: Option<DisplayList>,
+}
+
+/// Splits `text` into lines of at most `LINE_LENGTH` characters.
+fn wrap_lines(text: &str) -> Vec<Range<usize>> {
+    let mut lines = Vec::new();
+    let mut offset = 0;
+    for line in text.split('\n') {
+        let mut start = offset;
+        let mut chars = 0;
+        for (index, _) in line.char_indices() {
+            if chars == LINE_LENGTH {
+                lines.push(start..offset + index);
+                start = offset + index;
+                chars = 0;
+            }
+            chars += 1;
+        }
+        lines.push(start..offset + line.len());
+        offset += line.len() + 1;
+    }
+    lines
+}
+
+impl ZathuraPlugin for TestPlugin {
+    type DocumentData = TextDocument;
+    type PageData = TextPage;
+
+    fn document_open(doc: DocumentRef<'_>) -> Result<DocumentInfo<Self>, PluginError> {
+        let path = Path::new(OsStr::from_bytes(doc.path_raw().to_bytes()));
+        let bytes = fs::read(path).map_err(|_| PluginError::Unknown)?;
+        let text = String::from_utf8_lossy(&bytes).replace('\t', "    ");
+        let lines = wrap_lines(&text);
+        let document = TextDocument { text, lines };
+        Ok(DocumentInfo {
+            page_count: document.page_count() as u32,
+            plugin_data: document,
+        })
+    }
+
+    fn page_init(
+        page: PageRef<'_>,
+        doc_data: &mut TextDocument,
+    ) -> Result<PageInfo<Self>, PluginError> {
+        let per_page = TextDocument::lines_per_page();
+        let start = (page.index() * per_page).min(doc_data.lines.len());
+        let end = (start + per_page).min(doc_data.lines.len());
+        Ok(PageInfo {
+            width: PAGE_WIDTH,
+            height: PAGE_HEIGHT,
+            plugin_data: TextPage {
+                lines: start..end,
+                display_list: None,
+            },
+        })
+    }
+
+    fn page_render(
+        _page: PageRef<'_>,
+        doc_data: &mut TextDocument,
+        page_data: &mut TextPage,
+        cairo: &mut cairo::Context,
+        _printing: bool,
+    ) -> Result<(), PluginError> {
+        let lines = page_data.lines.clone();
+        let display_list = page_data.display_list.get_or_insert_with(|| {
+            let mut builder = DisplayListBuilder::new();
+            builder.set_source_rgb(0.0, 0.0, 0.0);
+            builder.select_font_face("monospace", FontSlant::Normal, FontWeight::Normal);
+            builder.set_font_size(FONT_SIZE);
+            for (row, line) in doc_data.lines[lines].iter().enumerate() {
+                let text = &doc_data.text[line.clone()];
+                if !text.trim().is_empty() {
+                    let y = MARGIN + (row + 1) as f64 * LINE_HEIGHT;
+                    builder.show_text(MARGIN, y, text);
+                }
+            }
+            builder.finish()
+        });
+
+        display_list.replay(cairo);
+        Ok(())
+    }
+
+    const SEARCH_TEXT: bool = true;
+
+    fn page_search_text(
+        _page: PageRef<'_>,
+        doc_data: &mut TextDocument,
+        page_data: &mut TextPage,
+        text: &str,
+    ) -> Result<Vec<zathura_rectangle_t>, PluginError> {
+        if text.is_empty() {
+            return Err(PluginError::InvalidArguments);
+        }
+        let mut matches = Vec::new();
+        for (row, line) in doc_data.lines[page_data.lines.clone()].iter().enumerate() {
+            let line = &doc_data.text[line.clone()];
+            for (offset, _) in line.match_indices(text) {
+                let column = line[..offset].chars().count();
+                let x1 = MARGIN + column as f64 * CHAR_WIDTH;
+                let y2 = MARGIN + (row + 1) as f64 * LINE_HEIGHT;
+                matches.push(zathura_rectangle_t {
+                    x1,
+                    y1: y2 - LINE_HEIGHT,
+                    x2: x1 + text.chars().count() as f64 * CHAR_WIDTH,
+                    y2,
+                });
+            }
+        }
+        Ok(matches)
+    }
+}
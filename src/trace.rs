@@ -0,0 +1,435 @@
+//! Recording of the callbacks Zathura makes into a plugin.
+//!
+//! When the `ZATHURA_PLUGIN_TRACE` environment variable is set to a file
+//! path, the wrapper logs every call Zathura makes into the plugin to that
+//! file: which callback was called, when, on which thread, for which page,
+//! the document's view state at that time, how long the call took and what
+//! it returned. Any `%p` in the path is replaced by the process ID, so that
+//! several Zathura instances don't overwrite each other's traces.
+//!
+//! Traces use a compact binary format (a small header followed by 80 byte
+//! records, each `DocumentOpen` record followed by the document's basename)
+//! and can be read back with [`TraceReader`], eg. to replay real sessions in
+//! benchmarks. By convention, binary traces use the `.ztrace` extension, to
+//! tell them apart from the text traces of the `replay` benchmark. Records
+//! are buffered and written out whenever a document is opened or freed, so
+//! the end of a trace can be missing if Zathura crashes.
+//!
+//! If the variable is not set, tracing costs a single check per callback.
+//!
+//! [`TraceReader`]: struct.TraceReader.html
+
+use {
+    crate::PluginError,
+    std::{
+        cell::Cell,
+        env,
+        fs::File,
+        io::{self, BufReader, BufWriter, Read, Write},
+        path::Path,
+        process,
+        sync::{
+            atomic::{AtomicU32, Ordering},
+            Mutex, OnceLock,
+        },
+        time::{Duration, Instant},
+    },
+};
+
+/// Magic bytes at the start of every trace file.
+const MAGIC: &[u8; 8] = b"ZPTRACE\0";
+
+/// Version of the trace format.
+const VERSION: u32 = 3;
+
+/// Size of an encoded `Record` in bytes.
+const RECORD_SIZE: usize = 80;
+
+/// Longest basename stored in a trace, in bytes.
+const MAX_BASENAME: usize = 4096;
+
+/// The environment variable holding the trace file path.
+pub const TRACE_VAR: &str = "ZATHURA_PLUGIN_TRACE";
+
+/// The plugin callback a record describes.
+#[derive(Debug, Copy, Clone, PartialEq, Eq)]
+pub enum Callback {
+    DocumentOpen,
+    DocumentFree,
+    PageInit,
+    PageClear,
+    PageRender,
+    /// A text search on a page. The query is not recorded.
+    PageSearchText,
+}
+
+impl Callback {
+    fn from_u8(raw: u8) -> Option<Self> {
+        Some(match raw {
+            0 => Callback::DocumentOpen,
+            1 => Callback::DocumentFree,
+            2 => Callback::PageInit,
+            3 => Callback::PageClear,
+            4 => Callback::PageRender,
+            5 => Callback::PageSearchText,
+            _ => return None,
+        })
+    }
+}
+
+/// A recorded callback.
+#[derive(Debug, Clone, PartialEq)]
+pub struct Record {
+    /// The callback that was called.
+    pub callback: Callback,
+    /// Time of the call, relative to the start of the trace.
+    pub timestamp: Duration,
+    /// How long the call took.
+    pub duration: Duration,
+    /// What the callback returned to Zathura.
+    pub result: Result<(), PluginError>,
+    /// Identifies the thread the call was made on. Threads are numbered in
+    /// the order they first called into the plugin, starting at 0.
+    pub thread: u32,
+    /// Identifies the document. This is the address of Zathura's document,
+    /// so it is only unique among documents open at the same time.
+    pub document: u64,
+    /// The basename of the document's path, for `DocumentOpen` calls. Only
+    /// the basename is recorded, so that traces don't reveal where the user
+    /// keeps their documents; see [`DocumentRef::basename_raw`].
+    ///
+    /// [`DocumentRef::basename_raw`]: ../struct.DocumentRef.html#method.basename_raw
+    pub basename: Option<Vec<u8>>,
+    /// The page index, for page callbacks.
+    pub page: Option<u32>,
+    /// The number of pages, for successful `DocumentOpen` calls.
+    pub page_count: Option<u32>,
+    /// The document's zoom level.
+    pub zoom: f64,
+    /// The document's render scale.
+    pub scale: f64,
+    /// The document's rotation in degrees.
+    pub rotation: u32,
+    /// The device scaling factors (x, y), eg. `(2.0, 2.0)` on a HiDPI
+    /// screen.
+    pub scaling_factors: (f64, f64),
+    /// The document's page cell size in device pixels (width, height).
+    pub cell_size: (u32, u32),
+    /// Whether a page was rendered for printing.
+    pub printing: bool,
+}
+
+impl Record {
+    /// Encodes the record, followed by the basename of `DocumentOpen`
+    /// records.
+    fn encode(&self) -> Vec<u8> {
+        let mut buf = vec![0; RECORD_SIZE];
+        buf[0] = self.callback as u8;
+        buf[1] = match self.result {
+            Ok(()) => 0,
+            Err(e) => e as u8,
+        };
+        buf[2] = self.printing as u8;
+        buf[3] = self.page.is_some() as u8 | (self.page_count.is_some() as u8) << 1;
+        buf[4..8].copy_from_slice(&self.thread.to_le_bytes());
+        buf[8..16].copy_from_slice(&(self.timestamp.as_nanos() as u64).to_le_bytes());
+        buf[16..24].copy_from_slice(&(self.duration.as_nanos() as u64).to_le_bytes());
+        buf[24..32].copy_from_slice(&self.document.to_le_bytes());
+        let page = self.page.or(self.page_count).unwrap_or(0);
+        buf[32..36].copy_from_slice(&page.to_le_bytes());
+        buf[36..40].copy_from_slice(&self.cell_size.0.to_le_bytes());
+        buf[40..44].copy_from_slice(&self.cell_size.1.to_le_bytes());
+        buf[44..48].copy_from_slice(&self.rotation.to_le_bytes());
+        buf[48..56].copy_from_slice(&self.zoom.to_le_bytes());
+        buf[56..64].copy_from_slice(&self.scale.to_le_bytes());
+        buf[64..72].copy_from_slice(&self.scaling_factors.0.to_le_bytes());
+        buf[72..80].copy_from_slice(&self.scaling_factors.1.to_le_bytes());
+        if self.callback == Callback::DocumentOpen {
+            let name = self.basename.as_deref().unwrap_or_default();
+            let name = &name[..name.len().min(MAX_BASENAME)];
+            buf.extend_from_slice(&(name.len() as u32).to_le_bytes());
+            buf.extend_from_slice(name);
+        }
+        buf
+    }
+
+    /// Decodes the fixed size part of a record. The basename is read
+    /// separately.
+    fn decode(buf: &[u8; RECORD_SIZE]) -> io::Result<Self> {
+        let u32_at = |i: usize| {
+            let mut bytes = [0; 4];
+            bytes.copy_from_slice(&buf[i..i + 4]);
+            u32::from_le_bytes(bytes)
+        };
+        let u64_at = |i: usize| {
+            let mut bytes = [0; 8];
+            bytes.copy_from_slice(&buf[i..i + 8]);
+            u64::from_le_bytes(bytes)
+        };
+
+        let callback = Callback::from_u8(buf[0])
+            .ok_or_else(|| io::Error::new(io::ErrorKind::InvalidData, "unknown callback"))?;
+        let result = PluginError::from_raw(buf[1].into()).unwrap_or(Err(PluginError::Unknown));
+        let page = u32_at(32);
+        Ok(Record {
+            callback,
+            timestamp: Duration::from_nanos(u64_at(8)),
+            duration: Duration::from_nanos(u64_at(16)),
+            result,
+            thread: u32_at(4),
+            document: u64_at(24),
+            basename: None,
+            page: if buf[3] & 1 != 0 { Some(page) } else { None },
+            page_count: if buf[3] & 2 != 0 { Some(page) } else { None },
+            zoom: f64::from_bits(u64_at(48)),
+            scale: f64::from_bits(u64_at(56)),
+            rotation: u32_at(44),
+            scaling_factors: (f64::from_bits(u64_at(64)), f64::from_bits(u64_at(72))),
+            cell_size: (u32_at(36), u32_at(40)),
+            printing: buf[2] != 0,
+        })
+    }
+}
+
+/// Reads the records of a trace file.
+///
+/// # Examples
+///
+/// ```no_run
+/// use zathura_plugin::trace::{Callback, TraceReader};
+///
+/// for record in TraceReader::open("zathura.ztrace")? {
+///     let record = record?;
+///     if record.callback == Callback::PageRender {
+///         println!("page {:?} took {:?}", record.page, record.duration);
+///     }
+/// }
+/// # Ok::<(), std::io::Error>(())
+/// ```
+#[derive(Debug)]
+pub struct TraceReader<R> {
+    reader: R,
+}
+
+impl TraceReader<BufReader<File>> {
+    /// Opens the trace file at `path`.
+    pub fn open(path: impl AsRef<Path>) -> io::Result<Self> {
+        Self::new(BufReader::new(File::open(path)?))
+    }
+}
+
+impl<R: Read> TraceReader<R> {
+    /// Creates a reader for the trace in `reader`, and checks its header.
+    pub fn new(mut reader: R) -> io::Result<Self> {
+        let mut header = [0; 12];
+        reader.read_exact(&mut header)?;
+        if &header[..8] != MAGIC {
+            return Err(io::Error::new(
+                io::ErrorKind::InvalidData,
+                "not a trace file",
+            ));
+        }
+        let mut version = [0; 4];
+        version.copy_from_slice(&header[8..]);
+        if u32::from_le_bytes(version) != VERSION {
+            return Err(io::Error::new(
+                io::ErrorKind::InvalidData,
+                "unsupported trace version",
+            ));
+        }
+        Ok(TraceReader { reader })
+    }
+}
+
+impl<R: Read> TraceReader<R> {
+    /// Fills `buf` completely, returning `false` at the end of the trace.
+    fn fill(&mut self, buf: &mut [u8]) -> io::Result<bool> {
+        let mut filled = 0;
+        while filled < buf.len() {
+            match self.reader.read(&mut buf[filled..]) {
+                Ok(0) => return Ok(false),
+                Ok(n) => filled += n,
+                Err(ref e) if e.kind() == io::ErrorKind::Interrupted => {}
+                Err(e) => return Err(e),
+            }
+        }
+        Ok(true)
+    }
+
+    fn read_record(&mut self) -> io::Result<Option<Record>> {
+        // A truncated last record is dropped, since the trace may have been
+        // cut off by a crash.
+        let mut buf = [0; RECORD_SIZE];
+        if !self.fill(&mut buf)? {
+            return Ok(None);
+        }
+        let mut record = Record::decode(&buf)?;
+        if record.callback == Callback::DocumentOpen {
+            let mut len = [0; 4];
+            if !self.fill(&mut len)? {
+                return Ok(None);
+            }
+            let len = u32::from_le_bytes(len) as usize;
+            if len > MAX_BASENAME {
+                return Err(io::Error::new(
+                    io::ErrorKind::InvalidData,
+                    "basename too long",
+                ));
+            }
+            let mut name = vec![0; len];
+            if !self.fill(&mut name)? {
+                return Ok(None);
+            }
+            record.basename = Some(name);
+        }
+        Ok(Some(record))
+    }
+}
+
+impl<R: Read> Iterator for TraceReader<R> {
+    type Item = io::Result<Record>;
+
+    fn next(&mut self) -> Option<io::Result<Record>> {
+        self.read_record().transpose()
+    }
+}
+
+/// Writes records to the trace file.
+pub(crate) struct Recorder {
+    start: Instant,
+    out: Mutex<BufWriter<File>>,
+}
+
+static RECORDER: OnceLock<Option<Recorder>> = OnceLock::new();
+
+static NEXT_THREAD: AtomicU32 = AtomicU32::new(0);
+
+thread_local! {
+    static THREAD: Cell<Option<u32>> = Cell::new(None);
+}
+
+/// Returns the recorder, if tracing is enabled.
+pub(crate) fn recorder() -> Option<&'static Recorder> {
+    RECORDER
+        .get_or_init(|| {
+            let path = env::var_os(TRACE_VAR)?;
+            let path = path
+                .to_string_lossy()
+                .replace("%p", &process::id().to_string());
+            let mut out = BufWriter::new(File::create(path).ok()?);
+            out.write_all(MAGIC).ok()?;
+            out.write_all(&VERSION.to_le_bytes()).ok()?;
+            Some(Recorder {
+                start: Instant::now(),
+                out: Mutex::new(out),
+            })
+        })
+        .as_ref()
+}
+
+impl Recorder {
+    /// Returns the time since the start of the trace.
+    pub(crate) fn now(&self) -> Duration {
+        self.start.elapsed()
+    }
+
+    /// Returns the ID of the calling thread.
+    pub(crate) fn thread_id(&self) -> u32 {
+        THREAD.with(|id| match id.get() {
+            Some(id) => id,
+            None => {
+                let new = NEXT_THREAD.fetch_add(1, Ordering::Relaxed);
+                id.set(Some(new));
+                new
+            }
+        })
+    }
+
+    /// Appends `record` to the trace.
+    ///
+    /// Write errors are ignored: tracing must never make the plugin fail.
+    pub(crate) fn record(&self, record: &Record) {
+        let mut out = self.out.lock().unwrap_or_else(|e| e.into_inner());
+        let _ = out.write_all(&record.encode());
+        match record.callback {
+            Callback::DocumentOpen | Callback::DocumentFree => {
+                let _ = out.flush();
+            }
+            _ => {}
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn record(callback: Callback, basename: Option<&[u8]>) -> Record {
+        Record {
+            callback,
+            timestamp: Duration::from_micros(1500),
+            duration: Duration::from_nanos(42),
+            result: Ok(()),
+            thread: 3,
+            document: 0xDEAD_BEEF,
+            basename: basename.map(<[u8]>::to_vec),
+            page: None,
+            page_count: Some(12),
+            zoom: 1.5,
+            scale: 2.0,
+            rotation: 90,
+            scaling_factors: (2.0, 1.0),
+            cell_size: (800, 600),
+            printing: false,
+        }
+    }
+
+    fn trace(records: &[Record]) -> Vec<u8> {
+        let mut trace = MAGIC.to_vec();
+        trace.extend_from_slice(&VERSION.to_le_bytes());
+        for record in records {
+            trace.extend_from_slice(&record.encode());
+        }
+        trace
+    }
+
+    #[test]
+    fn round_trip() {
+        let mut render = record(Callback::PageRender, None);
+        render.page = Some(7);
+        render.page_count = None;
+        render.result = Err(PluginError::OutOfMemory);
+        let mut search = record(Callback::PageSearchText, None);
+        search.page = Some(3);
+        search.page_count = None;
+        let records = vec![
+            record(Callback::DocumentOpen, Some(b"paper.pdf")),
+            render,
+            search,
+            record(Callback::DocumentOpen, Some(b"")),
+            record(Callback::DocumentFree, None),
+        ];
+        let read = TraceReader::new(&trace(&records)[..])
+            .unwrap()
+            .collect::<io::Result<Vec<_>>>()
+            .unwrap();
+        assert_eq!(read, records);
+    }
+
+    #[test]
+    fn truncated_record_is_dropped() {
+        let records = [
+            record(Callback::DocumentFree, None),
+            record(Callback::DocumentOpen, Some(b"paper.pdf")),
+        ];
+        let trace = trace(&records);
+        // Cut off inside the basename and inside the fixed size part.
+        for &cut in &[2, 8 + RECORD_SIZE + 2] {
+            let read = TraceReader::new(&trace[..trace.len() - cut])
+                .unwrap()
+                .collect::<io::Result<Vec<_>>>()
+                .unwrap();
+            assert_eq!(read, &records[..1]);
+        }
+    }
+}
@@ -0,0 +1,274 @@
+//! Checks that the wrapper doesn't allocate on hot paths.
+//!
+//! Plugins are driven through the `extern "C"` trampolines by the `host`
+//! module, with a global allocator that counts the allocations made by the
+//! current thread. Allocations made by C libraries (such as Cairo) are not
+//! counted.
+
+use {
+    std::{
+        alloc::{GlobalAlloc, Layout, System},
+        cell::{Cell, RefCell},
+        env,
+        marker::PhantomData,
+        os::raw::{c_char, c_void},
+        ptr,
+    },
+    zathura_plugin::{
+        host::{self, Document},
+        sys::{girara_list_t, zathura_error_t, zathura_page_t, zathura_rectangle_t},
+        wrapper, DocumentInfo, DocumentRef, PageInfo, PageRef, PluginError, ZathuraPlugin,
+    },
+};
+
+struct CountingAllocator;
+
+thread_local! {
+    static COUNTING: Cell<bool> = const { Cell::new(false) };
+    static ALLOCATIONS: Cell<usize> = const { Cell::new(0) };
+    static BYTES: Cell<usize> = const { Cell::new(0) };
+}
+
+impl CountingAllocator {
+    fn record(size: usize) {
+        let _ = COUNTING.try_with(|counting| {
+            if counting.get() {
+                ALLOCATIONS.with(|count| count.set(count.get() + 1));
+                BYTES.with(|bytes| bytes.set(bytes.get() + size));
+            }
+        });
+    }
+}
+
+unsafe impl GlobalAlloc for CountingAllocator {
+    unsafe fn alloc(&self, layout: Layout) -> *mut u8 {
+        Self::record(layout.size());
+        System.alloc(layout)
+    }
+
+    unsafe fn alloc_zeroed(&self, layout: Layout) -> *mut u8 {
+        Self::record(layout.size());
+        System.alloc_zeroed(layout)
+    }
+
+    unsafe fn realloc(&self, ptr: *mut u8, layout: Layout, new_size: usize) -> *mut u8 {
+        Self::record(new_size);
+        System.realloc(ptr, layout, new_size)
+    }
+
+    unsafe fn dealloc(&self, ptr: *mut u8, layout: Layout) {
+        System.dealloc(ptr, layout)
+    }
+}
+
+#[global_allocator]
+static ALLOCATOR: CountingAllocator = CountingAllocator;
+
+/// Runs `f` and returns the number of allocations and allocated bytes.
+fn count_allocations(f: impl FnOnce()) -> (usize, usize) {
+    ALLOCATIONS.with(|count| count.set(0));
+    BYTES.with(|bytes| bytes.set(0));
+    COUNTING.with(|counting| counting.set(true));
+    f();
+    COUNTING.with(|counting| counting.set(false));
+    (ALLOCATIONS.with(Cell::get), BYTES.with(Cell::get))
+}
+
+const PAGES: u32 = 100;
+
+thread_local! {
+    /// The matches the next search returns.
+    static MATCHES: RefCell<Vec<zathura_rectangle_t>> = const { RefCell::new(Vec::new()) };
+}
+
+/// A plugin that counts renders in its `DocumentData` and returns the search
+/// results prepared in `MATCHES`, with `PageData` of type `D`.
+struct Plugin<D>(PhantomData<D>);
+
+impl<D: Default> ZathuraPlugin for Plugin<D> {
+    type DocumentData = u64;
+    type PageData = D;
+
+    fn document_open(_doc: DocumentRef<'_>) -> Result<DocumentInfo<Self>, PluginError> {
+        Ok(DocumentInfo {
+            page_count: PAGES,
+            plugin_data: 0,
+        })
+    }
+
+    fn page_init(_page: PageRef<'_>, _doc_data: &mut u64) -> Result<PageInfo<Self>, PluginError> {
+        Ok(PageInfo {
+            width: 595.0,
+            height: 842.0,
+            plugin_data: D::default(),
+        })
+    }
+
+    fn page_render(
+        _page: PageRef<'_>,
+        doc_data: &mut u64,
+        _page_data: &mut D,
+        cairo: &mut cairo::Context,
+        _printing: bool,
+    ) -> Result<(), PluginError> {
+        *doc_data += 1;
+        cairo.rectangle(10.0, 10.0, 100.0, 100.0);
+        cairo.fill();
+        Ok(())
+    }
+
+    const SEARCH_TEXT: bool = true;
+
+    fn page_search_text(
+        _page: PageRef<'_>,
+        _doc_data: &mut u64,
+        _page_data: &mut D,
+        _text: &str,
+    ) -> Result<Vec<zathura_rectangle_t>, PluginError> {
+        // Hands out matches prepared by the test, so the plugin itself
+        // doesn't allocate.
+        Ok(MATCHES.with(RefCell::take))
+    }
+}
+
+fn open<D: Default>() -> Document {
+    let path = env::current_exe().unwrap();
+    Document::open::<Plugin<D>>(path).unwrap()
+}
+
+#[test]
+fn render_does_not_allocate() {
+    let mut doc = open::<[u64; 8]>();
+    let surface = cairo::ImageSurface::create(cairo::Format::ARgb32, 64, 64).unwrap();
+    let cairo = cairo::Context::new(&surface);
+
+    // Warm up.
+    doc.render(0, &cairo, false).unwrap();
+
+    let (allocations, bytes) = count_allocations(|| {
+        for _ in 0..10 {
+            for page in 0..doc.page_count() {
+                doc.render(page, &cairo, false).unwrap();
+            }
+        }
+    });
+    assert_eq!((allocations, bytes), (0, 0));
+}
+
+#[test]
+fn zero_sized_page_data_does_not_allocate() {
+    let mut doc = open::<()>();
+    doc.clear_pages().unwrap();
+
+    let (allocations, bytes) = count_allocations(|| {
+        doc.init_pages().unwrap();
+        doc.clear_pages().unwrap();
+    });
+    assert_eq!((allocations, bytes), (0, 0));
+}
+
+#[test]
+fn page_data_allocates_once_per_page() {
+    let mut doc = open::<[u64; 8]>();
+    doc.clear_pages().unwrap();
+
+    let (allocations, bytes) = count_allocations(|| {
+        doc.init_pages().unwrap();
+        doc.clear_pages().unwrap();
+    });
+    assert_eq!(allocations, PAGES as usize);
+    // The page data and a pointer to the document data.
+    assert_eq!(bytes, PAGES as usize * 72);
+}
+
+thread_local! {
+    /// Allocations made by the last search through `counted_search` and
+    /// `reference_search`.
+    static SEARCH_ALLOCATIONS: Cell<(usize, usize)> = const { Cell::new((0, 0)) };
+}
+
+/// Calls the wrapper's `page_search_text` and counts its allocations.
+unsafe extern "C" fn counted_search(
+    page: *mut zathura_page_t,
+    data: *mut c_void,
+    text: *const c_char,
+    error: *mut zathura_error_t,
+) -> *mut girara_list_t {
+    let mut list = ptr::null_mut();
+    let counted = count_allocations(|| {
+        list = wrapper::page_search_text::<Plugin<()>>(page, data, text, error);
+    });
+    SEARCH_ALLOCATIONS.with(|allocations| allocations.set(counted));
+    list
+}
+
+unsafe extern "C" fn free_box(rectangle: *mut c_void) {
+    drop(Box::from_raw(rectangle as *mut zathura_rectangle_t));
+}
+
+/// Returns the matches as a list with a box per rectangle, without the
+/// wrapper, and counts the allocations made for that.
+unsafe extern "C" fn reference_search(
+    _page: *mut zathura_page_t,
+    _data: *mut c_void,
+    _text: *const c_char,
+    error: *mut zathura_error_t,
+) -> *mut girara_list_t {
+    let matches = MATCHES.with(RefCell::take);
+    let mut list = ptr::null_mut();
+    let counted = count_allocations(|| {
+        list = host::girara_list_new2(Some(free_box));
+        for &rectangle in &matches {
+            host::girara_list_append(list, Box::into_raw(Box::new(rectangle)) as *mut c_void);
+        }
+    });
+    SEARCH_ALLOCATIONS.with(|allocations| allocations.set(counted));
+    *error = 0;
+    list
+}
+
+fn corners(rectangles: &[zathura_rectangle_t]) -> Vec<(f64, f64, f64, f64)> {
+    rectangles
+        .iter()
+        .map(|r| (r.x1, r.y1, r.x2, r.y2))
+        .collect()
+}
+
+#[test]
+fn search_allocates_only_the_result_list() {
+    let path = env::current_exe().unwrap();
+    let mut functions = wrapper::functions::<Plugin<()>>();
+    let mut doc = unsafe {
+        functions.page_search_text = Some(counted_search);
+        Document::open_raw(functions, &path).unwrap()
+    };
+    let mut reference = unsafe {
+        functions.page_search_text = Some(reference_search);
+        Document::open_raw(functions, &path).unwrap()
+    };
+
+    for &count in &[0, 1, 5, 100] {
+        let matches = (0..count)
+            .map(|i| zathura_rectangle_t {
+                x1: 10.0,
+                y1: f64::from(i) * 12.0,
+                x2: 50.0,
+                y2: f64::from(i) * 12.0 + 10.0,
+            })
+            .collect::<Vec<_>>();
+
+        MATCHES.with(|next| next.replace(matches.clone()));
+        let found = doc.search(0, "text").unwrap();
+        assert_eq!(corners(&found), corners(&matches));
+        let allocations = SEARCH_ALLOCATIONS.with(Cell::get);
+
+        MATCHES.with(|next| next.replace(matches.clone()));
+        let found = reference.search(0, "text").unwrap();
+        assert_eq!(corners(&found), corners(&matches));
+        let expected = SEARCH_ALLOCATIONS.with(Cell::get);
+
+        // The list itself, and a box per rectangle.
+        assert!(expected.0 >= 1 + count as usize);
+        assert_eq!(allocations, expected, "{} matches", count);
+    }
+}
@@ -0,0 +1,192 @@
+//! Checks which plugin of a `Chain` documents are routed to.
+//!
+//! Every plugin opens the documents whose content it recognizes, and the test
+//! checks which plugin ended up opening a document, which shows both the
+//! order in which the plugins were offered the document and which of them
+//! were skipped.
+
+use {
+    std::{cell::Cell, env, fs, path::PathBuf, process},
+    zathura_plugin::{
+        host::Document, Chain, DocumentInfo, DocumentRef, FileHeader, Filtered, MimeTypes,
+        PageInfo, PageRef, PluginError, ZathuraPlugin,
+    },
+};
+
+thread_local! {
+    /// The plugin that opened the last document.
+    static OPENED_BY: Cell<Option<&'static str>> = const { Cell::new(None) };
+}
+
+/// Defines a plugin named `$name` that opens the files `$opens` accepts.
+macro_rules! plugin {
+    ($name:ident, $opens:expr) => {
+        struct $name;
+
+        impl ZathuraPlugin for $name {
+            type DocumentData = ();
+            type PageData = ();
+
+            fn document_open(doc: DocumentRef<'_>) -> Result<DocumentInfo<Self>, PluginError> {
+                let bytes = fs::read(doc.path_utf8().unwrap()).unwrap();
+                let opens: fn(&[u8]) -> bool = $opens;
+                if !opens(&bytes) {
+                    return Err(PluginError::InvalidArguments);
+                }
+                OPENED_BY.with(|opened| opened.set(Some(stringify!($name))));
+                Ok(DocumentInfo {
+                    page_count: 1,
+                    plugin_data: (),
+                })
+            }
+
+            fn page_init(_page: PageRef<'_>, _: &mut ()) -> Result<PageInfo<Self>, PluginError> {
+                Ok(PageInfo {
+                    width: 100.0,
+                    height: 100.0,
+                    plugin_data: (),
+                })
+            }
+
+            fn page_render(
+                _page: PageRef<'_>,
+                _: &mut (),
+                _: &mut (),
+                _: &mut cairo::Context,
+                _printing: bool,
+            ) -> Result<(), PluginError> {
+                Ok(())
+            }
+        }
+    };
+}
+
+plugin!(Text, |bytes| !bytes.contains(&0));
+plugin!(Cbz, |bytes| bytes.starts_with(b"PK\x03\x04"));
+plugin!(Epub, |bytes| bytes.get(30..58)
+    == Some(b"mimetypeapplication/epub+zip"));
+plugin!(Gzip, |bytes| bytes.starts_with(b"\x1F\x8B"));
+plugin!(Pdf, |bytes| bytes.starts_with(b"%PDF-"));
+plugin!(Bmp, |bytes| bytes.starts_with(b"BM"));
+
+/// The MIME types of the plugins, as `plugin_entry!` lists them.
+enum Listed {}
+
+const ALL: &[&str] = &[
+    "text/plain",
+    "application/x-cbz",
+    "application/epub+zip",
+    "application/x-gzip",
+    "application/pdf",
+    "image/bmp",
+];
+
+macro_rules! listed {
+    ($($plugin:ty: $mime:literal),+) => {
+        $(
+            impl MimeTypes<$plugin> for Listed {
+                const MIME_TYPES: &'static [&'static str] = &[$mime];
+                const LIBRARY_MIME_TYPES: &'static [&'static str] = ALL;
+            }
+        )+
+    };
+}
+
+listed!(
+    Text: "text/plain",
+    Cbz: "application/x-cbz",
+    Epub: "application/epub+zip",
+    Gzip: "application/x-gzip",
+    Pdf: "application/pdf",
+    Bmp: "image/bmp"
+);
+
+/// The plugins in the order `plugin_entry!` chains them. The text plugin
+/// comes first, so that it is offered every document it doesn't leave to
+/// another plugin.
+type Library = Chain<
+    Filtered<Text, Listed>,
+    Chain<
+        Filtered<Cbz, Listed>,
+        Chain<
+            Filtered<Epub, Listed>,
+            Chain<Filtered<Gzip, Listed>, Chain<Filtered<Pdf, Listed>, Filtered<Bmp, Listed>>>,
+        >,
+    >,
+>;
+
+/// Writes `contents` to a temporary file.
+fn file(name: &str, contents: &[u8]) -> PathBuf {
+    let path = env::temp_dir().join(format!("zathura-plugin-chain-{}-{}", process::id(), name));
+    fs::write(&path, contents).unwrap();
+    path
+}
+
+/// Opens a file with `contents` and returns the plugin that opened it.
+fn opened_by(name: &str, contents: &[u8]) -> Option<&'static str> {
+    let path = file(name, contents);
+    OPENED_BY.with(|opened| opened.set(None));
+    let result = Document::open::<Library>(&path);
+    fs::remove_file(&path).unwrap();
+    result.ok().and(OPENED_BY.with(Cell::get))
+}
+
+fn zip_entry(name: &[u8], contents: &[u8]) -> Vec<u8> {
+    let mut zip = b"PK\x03\x04\x14\0\0\0\0\0\0\0\0\0\0\0\0\0".to_vec();
+    zip.extend_from_slice(&(contents.len() as u32).to_le_bytes());
+    zip.extend_from_slice(&(contents.len() as u32).to_le_bytes());
+    zip.extend_from_slice(&(name.len() as u16).to_le_bytes());
+    zip.extend_from_slice(&[0, 0]);
+    zip.extend_from_slice(name);
+    zip.extend_from_slice(contents);
+    zip
+}
+
+#[test]
+fn conclusive_formats_go_to_their_plugin() {
+    // The text plugin could open this, but it is listed for the PDF plugin.
+    assert_eq!(opened_by("doc.pdf", b"%PDF-1.4\n%%EOF\n"), Some("Pdf"));
+
+    let epub = zip_entry(b"mimetype", b"application/epub+zip");
+    assert_eq!(opened_by("book.epub", &epub), Some("Epub"));
+    let path = file("probe.epub", &epub);
+    let header = FileHeader::read(&path).unwrap();
+    fs::remove_file(&path).unwrap();
+    assert!(!<Filtered<Cbz, Listed>>::probe(&header));
+    assert!(<Filtered<Epub, Listed>>::probe(&header));
+}
+
+#[test]
+fn containers_are_offered_to_every_plugin() {
+    // Both are sniffed as `application/zip`, which no plugin is listed with.
+    let cbz = zip_entry(b"page001.png", b"\x89PNG\r\n\x1A\n");
+    assert_eq!(opened_by("comic.cbz", &cbz), Some("Cbz"));
+
+    // Sniffed as `application/gzip`, while the plugin is listed with the
+    // alias `application/x-gzip`.
+    assert_eq!(
+        opened_by("doc.ps.gz", b"\x1F\x8B\x08\0\0\0\0\0"),
+        Some("Gzip")
+    );
+}
+
+#[test]
+fn text_is_not_mistaken_for_magic_numbers() {
+    assert_eq!(opened_by("bm.txt", b"BM is a bitmap.\n"), Some("Text"));
+    assert_eq!(opened_by("bzh.txt", b"BZh, said the bee.\n"), Some("Text"));
+    assert_eq!(
+        opened_by("pk.txt", b"PK\x03\x04 is a ZIP file.\n"),
+        Some("Text")
+    );
+
+    // Real bitmaps are still opened by the bitmap plugin.
+    assert_eq!(
+        opened_by("image.bmp", b"BM\x36\0\x0C\0\0\0\0\0"),
+        Some("Bmp")
+    );
+}
+
+#[test]
+fn unopenable_documents_fail() {
+    assert_eq!(opened_by("garbage", b"\0\0\0\0"), None);
+}
@@ -0,0 +1,127 @@
+//! Checks that the wrapper handles the calls Zathura makes after a callback
+//! failed.
+//!
+//! Zathura frees a document whose `document_open` failed like any other, so
+//! the plugin's `document_free` is called for it too. Likewise, a page whose
+//! `page_init` failed is passed to `page_clear`. The host does the same.
+
+use {
+    std::{cell::Cell, env, ffi::c_void, ptr},
+    zathura_plugin::{
+        host::Document,
+        sys::{zathura_document_t, zathura_error_t, zathura_page_t, zathura_plugin_functions_t},
+        wrapper, DocumentInfo, DocumentRef, PageInfo, PageRef, PluginError, ZathuraPlugin,
+    },
+};
+
+thread_local! {
+    /// The data pointer `document_free` was last called with.
+    static FREED: Cell<Option<*mut c_void>> = const { Cell::new(None) };
+    /// The data pointer `page_clear` was last called with.
+    static CLEARED: Cell<Option<*mut c_void>> = const { Cell::new(None) };
+}
+
+/// A plugin that refuses to open documents, like one asking for a password.
+struct Locked;
+
+impl ZathuraPlugin for Locked {
+    // Has drop glue, so freeing a document that was never opened crashes.
+    type DocumentData = Vec<u8>;
+    type PageData = ();
+
+    fn document_open(_doc: DocumentRef<'_>) -> Result<DocumentInfo<Self>, PluginError> {
+        Err(PluginError::InvalidPassword)
+    }
+
+    fn page_init(_page: PageRef<'_>, _: &mut Vec<u8>) -> Result<PageInfo<Self>, PluginError> {
+        unreachable!("no document is opened");
+    }
+
+    fn page_render(
+        _page: PageRef<'_>,
+        _: &mut Vec<u8>,
+        _: &mut (),
+        _: &mut cairo::Context,
+        _printing: bool,
+    ) -> Result<(), PluginError> {
+        unreachable!("no document is opened");
+    }
+}
+
+/// A plugin that opens documents, but fails to initialize their pages.
+struct Damaged;
+
+impl ZathuraPlugin for Damaged {
+    type DocumentData = Vec<u8>;
+    // Zero-sized, so the page data pointer is the `DocumentData` pointer.
+    type PageData = ();
+
+    fn document_open(_doc: DocumentRef<'_>) -> Result<DocumentInfo<Self>, PluginError> {
+        Ok(DocumentInfo {
+            page_count: 1,
+            plugin_data: vec![0; 16],
+        })
+    }
+
+    fn page_init(_page: PageRef<'_>, _: &mut Vec<u8>) -> Result<PageInfo<Self>, PluginError> {
+        Err(PluginError::InvalidArguments)
+    }
+
+    fn page_free(_page: PageRef<'_>, _: &mut Vec<u8>, _: &mut ()) -> Result<(), PluginError> {
+        unreachable!("no page is initialized");
+    }
+
+    fn page_render(
+        _page: PageRef<'_>,
+        _: &mut Vec<u8>,
+        _: &mut (),
+        _: &mut cairo::Context,
+        _printing: bool,
+    ) -> Result<(), PluginError> {
+        unreachable!("no page is initialized");
+    }
+}
+
+/// Records the data pointer and forwards to the wrapper.
+unsafe extern "C" fn document_free<P: ZathuraPlugin>(
+    document: *mut zathura_document_t,
+    data: *mut c_void,
+) -> zathura_error_t {
+    FREED.with(|freed| freed.set(Some(data)));
+    wrapper::document_free::<P>(document, data)
+}
+
+/// Records the data pointer and forwards to the wrapper.
+unsafe extern "C" fn page_clear<P: ZathuraPlugin>(
+    page: *mut zathura_page_t,
+    data: *mut c_void,
+) -> zathura_error_t {
+    CLEARED.with(|cleared| cleared.set(Some(data)));
+    wrapper::page_clear::<P>(page, data)
+}
+
+fn functions<P: ZathuraPlugin>() -> zathura_plugin_functions_t {
+    zathura_plugin_functions_t {
+        document_free: Some(document_free::<P>),
+        page_clear: Some(page_clear::<P>),
+        ..wrapper::functions::<P>()
+    }
+}
+
+#[test]
+fn failed_open_is_freed() {
+    let path = env::current_exe().unwrap();
+    let result = unsafe { Document::open_raw(functions::<Locked>(), path) };
+    assert_eq!(result.unwrap_err(), PluginError::InvalidPassword);
+    assert_eq!(FREED.with(Cell::get), Some(ptr::null_mut()));
+}
+
+#[test]
+fn failed_page_is_cleared() {
+    let path = env::current_exe().unwrap();
+    let result = unsafe { Document::open_raw(functions::<Damaged>(), path) };
+    assert_eq!(result.unwrap_err(), PluginError::InvalidArguments);
+    assert_eq!(CLEARED.with(Cell::get), Some(ptr::null_mut()));
+    // The document itself was opened, so it is freed with its data.
+    assert!(!FREED.with(Cell::get).unwrap().is_null());
+}
@@ -0,0 +1,92 @@
+//! Checks the report of a profiling proxy, with the reference plugin as its
+//! backend.
+//!
+//! The proxy's backend is global, so this needs a test binary of its own
+//! rather than sharing one with the caching proxy's tests.
+
+use {
+    std::{
+        env, fs,
+        path::{Path, PathBuf},
+        process,
+    },
+    zathura_plugin::{
+        host::Document,
+        proxy::{self, Backend, PROFILE_VAR},
+        sys::zathura_plugin_functions_t,
+        testplugin::TestPlugin,
+        wrapper,
+    },
+};
+
+struct ProfiledBackend;
+
+impl Backend for ProfiledBackend {
+    const PATH: &'static str = "testplugin";
+    const CACHE: bool = false;
+    const PROFILE: bool = true;
+
+    fn load() -> Option<zathura_plugin_functions_t> {
+        Some(wrapper::functions::<TestPlugin>())
+    }
+}
+
+/// Returns the calls, failures and items per call of `callback` in the
+/// report's table.
+fn row<'a>(report: &'a str, callback: &str) -> (u64, u64, &'a str) {
+    let table = report.split("\n\n").nth(1).expect("no table in report");
+    let columns: Vec<&str> = table
+        .lines()
+        .map(|line| line.split_whitespace().collect::<Vec<_>>())
+        .find(|columns| columns[0] == callback)
+        .unwrap_or_else(|| panic!("{} is missing from the report:\n{}", callback, report));
+    assert_eq!(columns.len(), 9, "malformed row: {:?}", columns);
+    (
+        columns[1].parse().unwrap(),
+        columns[2].parse().unwrap(),
+        columns[8],
+    )
+}
+
+#[test]
+fn report_is_written_when_the_document_is_freed() {
+    let report = env::temp_dir().join(format!("zathura-plugin-profile-{}.txt", process::id()));
+    let _ = fs::remove_file(&report);
+    env::set_var(PROFILE_VAR, &report);
+
+    let path: PathBuf = Path::new(env!("CARGO_MANIFEST_DIR")).join("benches/corpus/medium.txt");
+    let mut doc =
+        unsafe { Document::open_raw(proxy::functions::<ProfiledBackend>(), &path).unwrap() };
+    let pages = doc.page_count();
+    assert!(pages >= 3);
+
+    for &index in &[0, 1, 2, 1] {
+        doc.render_page(index).unwrap();
+    }
+    let mut found = 0;
+    for index in 0..3 {
+        found += doc.search(index, "Section").unwrap().len();
+    }
+    assert!(found > 0);
+    // The reference plugin rejects empty queries.
+    assert!(doc.search(0, "").is_err());
+
+    // Nothing is reported while the document is open.
+    assert!(!report.exists());
+    drop(doc);
+    let text = fs::read_to_string(&report).unwrap();
+    fs::remove_file(&report).unwrap();
+
+    assert!(text.starts_with("zathura-plugin profile of testplugin\n"));
+    let header = format!("document: {} ({} pages,", path.display(), pages);
+    assert!(text.contains(&header), "{}", text);
+
+    assert_eq!(row(&text, "document_open"), (1, 0, "-"));
+    assert_eq!(row(&text, "page_init"), (pages as u64, 0, "-"));
+    assert_eq!(row(&text, "page_render_cairo"), (4, 0, "-"));
+    // Only successful searches report a number of results.
+    let per_search = format!("{:.1}", found as f64 / 3.0);
+    assert_eq!(row(&text, "page_search_text"), (4, 1, per_search.as_str()));
+    assert_eq!(row(&text, "page_clear"), (pages as u64, 0, "-"));
+    assert_eq!(row(&text, "document_free"), (1, 0, "-"));
+}
@@ -0,0 +1,165 @@
+//! Checks the caches of the proxy, with the reference plugin as its backend.
+//!
+//! The proxy's caches and statistics are global, so everything is checked
+//! from a single test. Prefetching renders pages in the background, so only
+//! pages whose neighbours are never rendered are used where exact counts
+//! matter.
+
+use {
+    std::{
+        ffi::c_void,
+        os::raw::c_char,
+        path::{Path, PathBuf},
+        sync::atomic::{AtomicBool, AtomicUsize, Ordering},
+        thread,
+        time::Duration,
+    },
+    zathura_plugin::{
+        host::Document,
+        proxy::{self, Backend, ProxyStats},
+        sys::{
+            cairo_t, girara_list_t, zathura_error_t, zathura_page_t, zathura_plugin_functions_t,
+        },
+        testplugin::TestPlugin,
+        wrapper,
+    },
+};
+
+/// Set while the backend renders or searches a page.
+static BUSY: AtomicBool = AtomicBool::new(false);
+/// Number of calls into the backend made while another one was running.
+static OVERLAPS: AtomicUsize = AtomicUsize::new(0);
+
+/// Runs a call into the backend, counting it if another one is running.
+fn busy<T>(f: impl FnOnce() -> T) -> T {
+    if BUSY.swap(true, Ordering::SeqCst) {
+        OVERLAPS.fetch_add(1, Ordering::SeqCst);
+    }
+    let value = f();
+    BUSY.store(false, Ordering::SeqCst);
+    value
+}
+
+/// Renders slowly, so that calls made during a prefetch would overlap it.
+unsafe extern "C" fn page_render_cairo(
+    page: *mut zathura_page_t,
+    data: *mut c_void,
+    cairo: *mut cairo_t,
+    printing: bool,
+) -> zathura_error_t {
+    busy(|| {
+        thread::sleep(Duration::from_millis(20));
+        wrapper::page_render_cairo::<TestPlugin>(page, data, cairo, printing)
+    })
+}
+
+unsafe extern "C" fn page_search_text(
+    page: *mut zathura_page_t,
+    data: *mut c_void,
+    text: *const c_char,
+    error: *mut zathura_error_t,
+) -> *mut girara_list_t {
+    busy(|| wrapper::page_search_text::<TestPlugin>(page, data, text, error))
+}
+
+struct TestBackend;
+
+impl Backend for TestBackend {
+    const PATH: &'static str = "testplugin";
+
+    fn load() -> Option<zathura_plugin_functions_t> {
+        Some(zathura_plugin_functions_t {
+            page_render_cairo: Some(page_render_cairo),
+            page_search_text: Some(page_search_text),
+            ..wrapper::functions::<TestPlugin>()
+        })
+    }
+}
+
+fn corpus(name: &str) -> PathBuf {
+    Path::new(env!("CARGO_MANIFEST_DIR"))
+        .join("benches/corpus")
+        .join(name)
+}
+
+fn open(name: &str) -> Document {
+    unsafe { Document::open_raw(proxy::functions::<TestBackend>(), corpus(name)).unwrap() }
+}
+
+/// Renders page `index` and returns how the statistics changed.
+fn render(doc: &mut Document, index: usize) -> ProxyStats {
+    let before = proxy::stats();
+    doc.render_page(index).unwrap();
+    let after = proxy::stats();
+    ProxyStats {
+        render_hits: after.render_hits - before.render_hits,
+        render_misses: after.render_misses - before.render_misses,
+        ..after
+    }
+}
+
+#[test]
+fn caches() {
+    // Pages are rendered once, and painted from the cache afterwards.
+    let mut doc = open("medium.txt");
+    let first = render(&mut doc, 0);
+    assert_eq!((first.render_hits, first.render_misses), (0, 1));
+    let again = render(&mut doc, 0);
+    assert_eq!((again.render_hits, again.render_misses), (1, 0));
+    assert!(again.cached_pages >= 1);
+
+    // Search results are cached per page and query.
+    let before = proxy::stats();
+    let results = doc.search(0, "Section").unwrap();
+    assert!(!results.is_empty());
+    assert_eq!(doc.search(0, "Section").unwrap().len(), results.len());
+    let after = proxy::stats();
+    assert_eq!(after.search_misses - before.search_misses, 1);
+    assert_eq!(after.search_hits - before.search_hits, 1);
+
+    // With room for a single page, rendering another page evicts the
+    // previous one, so every render misses. Pages 0, 5 and 10 are never
+    // prefetched, since their neighbours are never rendered.
+    let page_bytes = proxy::stats().cached_bytes / proxy::stats().cached_pages;
+    proxy::set_cache_budget(page_bytes);
+    let stats = proxy::stats();
+    assert!(stats.cached_pages <= 1 && stats.cached_bytes <= page_bytes);
+    for &index in &[5, 10, 5, 0] {
+        let stats = render(&mut doc, index);
+        assert_eq!((stats.render_hits, stats.render_misses), (0, 1));
+        assert!(stats.cached_pages <= 1 && stats.cached_bytes <= page_bytes);
+    }
+
+    // Freeing a document drops its cached pages, including those that were
+    // being prefetched.
+    proxy::set_cache_budget(256 << 20);
+    render(&mut doc, 5);
+    render(&mut doc, 10);
+    drop(doc);
+    let stats = proxy::stats();
+    assert_eq!((stats.cached_pages, stats.cached_bytes), (0, 0));
+
+    // ... but only its own. Single page documents are never prefetched.
+    let mut one = open("short.txt");
+    let mut other = open("short.txt");
+    render(&mut one, 0);
+    render(&mut other, 0);
+    assert_eq!(proxy::stats().cached_pages, 2);
+    drop(one);
+    assert_eq!(proxy::stats().cached_pages, 1);
+    let stats = render(&mut other, 0);
+    assert_eq!((stats.render_hits, stats.render_misses), (1, 0));
+    drop(other);
+    let stats = proxy::stats();
+    assert_eq!((stats.cached_pages, stats.cached_bytes), (0, 0));
+
+    // Searching right after a render waits for the prefetch jobs it started,
+    // like every other call into the backend.
+    let mut doc = open("medium.txt");
+    for index in 1..4 {
+        render(&mut doc, index);
+        doc.search(index, "Section").unwrap();
+    }
+    drop(doc);
+    assert_eq!(OVERLAPS.load(Ordering::SeqCst), 0);
+}
@@ -1,28 +1,77 @@
-use {
-    bindgen, pkg_config,
-    std::{env, iter, path::PathBuf},
-};
+//! Build script for the FFI bindings.
+//!
+//! By default, the checked-in bindings in `src/bindings.rs` are used and this
+//! script does nothing. With the `generate-bindings` feature, the bindings are
+//! regenerated from the headers in `headers` using `bindgen`, which requires
+//! libclang and the cairo headers to be installed.
 
 fn main() {
-    let cairo = pkg_config::Config::new().probe("cairo").unwrap();
-    let include_paths = std::env::join_paths(cairo.include_paths).unwrap();
-    let include_paths = include_paths.to_string_lossy();
+    #[cfg(feature = "generate-bindings")]
+    generate::bindings();
+}
+
+#[cfg(feature = "generate-bindings")]
+mod generate {
+    use {
+        bindgen, pkg_config,
+        std::{env, iter, path::PathBuf},
+    };
+
+    /// Functions used by `zathura-plugin`. Keep this in sync with the wrapper.
+    const FUNCTIONS: &[&str] = &[
+        "zathura_document_get_path",
+        "zathura_document_get_uri",
+        "zathura_document_get_basename",
+        "zathura_document_get_page",
+        "zathura_document_get_number_of_pages",
+        "zathura_document_set_number_of_pages",
+        "zathura_document_get_current_page_number",
+        "zathura_document_get_zoom",
+        "zathura_document_get_scale",
+        "zathura_document_get_rotation",
+        "zathura_document_get_data",
+        "zathura_document_set_data",
+        "zathura_document_get_viewport_ppi",
+        "zathura_document_get_device_factors",
+        "zathura_document_get_cell_size",
+        "zathura_page_get_document",
+        "zathura_page_get_index",
+        "zathura_page_get_width",
+        "zathura_page_set_width",
+        "zathura_page_get_height",
+        "zathura_page_set_height",
+        "zathura_page_get_data",
+        "zathura_page_set_data",
+        "girara_list_new2",
+        "girara_list_append",
+        "girara_list_nth",
+        "girara_list_size",
+    ];
+
+    pub fn bindings() {
+        let cairo = pkg_config::Config::new().probe("cairo").unwrap();
+        let include_paths = env::join_paths(cairo.include_paths).unwrap();
+        let include_paths = include_paths.to_string_lossy();
 
-    let include_paths = include_paths
-        .split(':')
-        .chain(iter::once("headers"))
-        .map(|s| format!("-I{}", s));
+        let include_paths = include_paths
+            .split(':')
+            .chain(iter::once("headers"))
+            .map(|s| format!("-I{}", s));
 
-    let bindings = bindgen::Builder::default()
-        .clang_args(include_paths)
-        .whitelist_type("zathura_.*")
-        .whitelist_function("zathura_.*")
-        .header("wrapper.h")
-        .generate()
-        .expect("Unable to generate bindings");
+        let builder = bindgen::Builder::default()
+            .clang_args(include_paths)
+            .allowlist_type("zathura_plugin_definition_t")
+            .allowlist_type("zathura_device_factors_t")
+            .allowlist_var("ZATHURA_(VERSION_.*|API_VERSION|ABI_VERSION)")
+            .header("wrapper.h");
+        let builder = FUNCTIONS
+            .iter()
+            .fold(builder, |builder, f| builder.allowlist_function(f));
+        let bindings = builder.generate().expect("Unable to generate bindings");
 
-    let out_path = PathBuf::from(env::var("OUT_DIR").unwrap());
-    bindings
-        .write_to_file(out_path.join("bindings.rs"))
-        .expect("Couldn't write bindings!");
+        let out_path = PathBuf::from(env::var("OUT_DIR").unwrap());
+        bindings
+            .write_to_file(out_path.join("bindings.rs"))
+            .expect("Couldn't write bindings!");
+    }
 }
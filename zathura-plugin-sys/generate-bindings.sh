@@ -0,0 +1,17 @@
+#!/bin/sh
+# Regenerates `src/bindings.rs` from the headers in `headers`.
+#
+# This builds the crate with the `generate-bindings` feature, which runs
+# bindgen in the build script, and copies the result over the checked-in file.
+# Needs libclang and the cairo development headers.
+
+set -e
+cd "$(dirname "$0")"
+
+out_dir=$(
+    cargo build --features generate-bindings --message-format=json |
+        grep '"reason":"build-script-executed"' |
+        grep '"package_id":"[^"]*zathura-plugin-sys' |
+        sed 's/.*"out_dir":"\([^"]*\)".*/\1/'
+)
+cp "$out_dir/bindings.rs" src/bindings.rs
@@ -0,0 +1,853 @@
+// Bindings for the headers in `headers/` (zathura 0.4.3, girara 0.3.2), for
+// Zathura plugin API version 3, ABI version 4.
+//
+// This file was written by hand in the layout bindgen produces, and checked
+// against the headers with libclang (signatures, constants, and struct sizes,
+// alignments and field offsets). It is not bindgen output yet: replace it by
+// running `generate-bindings.sh` on a machine with libclang and the cairo
+// headers.
+
+pub const ZATHURA_VERSION_MAJOR: u32 = 0;
+pub const ZATHURA_VERSION_MINOR: u32 = 4;
+pub const ZATHURA_VERSION_REV: u32 = 3;
+pub const ZATHURA_API_VERSION: u32 = 3;
+pub const ZATHURA_ABI_VERSION: u32 = 4;
+#[repr(C)]
+#[derive(Debug, Copy, Clone)]
+pub struct _cairo {
+    _unused: [u8; 0],
+}
+pub type cairo_t = _cairo;
+#[repr(C)]
+#[derive(Debug, Copy, Clone)]
+pub struct _cairo_surface {
+    _unused: [u8; 0],
+}
+pub type cairo_surface_t = _cairo_surface;
+#[repr(C)]
+#[derive(Debug, Copy, Clone)]
+pub struct girara_tree_node_s {
+    _unused: [u8; 0],
+}
+pub type girara_tree_node_t = girara_tree_node_s;
+#[repr(C)]
+#[derive(Debug, Copy, Clone)]
+pub struct girara_list_s {
+    _unused: [u8; 0],
+}
+pub type girara_list_t = girara_list_s;
+#[repr(C)]
+#[derive(Debug, Copy, Clone)]
+pub struct zathura_document_s {
+    _unused: [u8; 0],
+}
+pub type zathura_document_t = zathura_document_s;
+#[repr(C)]
+#[derive(Debug, Copy, Clone)]
+pub struct zathura_page_s {
+    _unused: [u8; 0],
+}
+pub type zathura_page_t = zathura_page_s;
+pub const zathura_plugin_error_e_ZATHURA_ERROR_OK: zathura_plugin_error_e = 0;
+pub const zathura_plugin_error_e_ZATHURA_ERROR_UNKNOWN: zathura_plugin_error_e = 1;
+pub const zathura_plugin_error_e_ZATHURA_ERROR_OUT_OF_MEMORY: zathura_plugin_error_e = 2;
+pub const zathura_plugin_error_e_ZATHURA_ERROR_NOT_IMPLEMENTED: zathura_plugin_error_e = 3;
+pub const zathura_plugin_error_e_ZATHURA_ERROR_INVALID_ARGUMENTS: zathura_plugin_error_e = 4;
+pub const zathura_plugin_error_e_ZATHURA_ERROR_INVALID_PASSWORD: zathura_plugin_error_e = 5;
+pub type zathura_plugin_error_e = u32;
+pub use self::zathura_plugin_error_e as zathura_error_t;
+#[repr(C)]
+#[derive(Debug, Copy, Clone)]
+pub struct zathura_image_buffer_s {
+    pub data: *mut ::std::os::raw::c_uchar,
+    pub height: ::std::os::raw::c_uint,
+    pub width: ::std::os::raw::c_uint,
+    pub rowstride: ::std::os::raw::c_uint,
+}
+#[test]
+fn bindgen_test_layout_zathura_image_buffer_s() {
+    const UNINIT: ::std::mem::MaybeUninit<zathura_image_buffer_s> =
+        ::std::mem::MaybeUninit::uninit();
+    let ptr = UNINIT.as_ptr();
+    assert_eq!(
+        ::std::mem::size_of::<zathura_image_buffer_s>(),
+        24usize,
+        concat!("Size of: ", stringify!(zathura_image_buffer_s))
+    );
+    assert_eq!(
+        ::std::mem::align_of::<zathura_image_buffer_s>(),
+        8usize,
+        concat!("Alignment of ", stringify!(zathura_image_buffer_s))
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).data) as usize - ptr as usize },
+        0usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(zathura_image_buffer_s),
+            "::",
+            stringify!(data)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).height) as usize - ptr as usize },
+        8usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(zathura_image_buffer_s),
+            "::",
+            stringify!(height)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).width) as usize - ptr as usize },
+        12usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(zathura_image_buffer_s),
+            "::",
+            stringify!(width)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).rowstride) as usize - ptr as usize },
+        16usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(zathura_image_buffer_s),
+            "::",
+            stringify!(rowstride)
+        )
+    );
+}
+pub type zathura_image_buffer_t = zathura_image_buffer_s;
+#[repr(C)]
+#[derive(Debug, Copy, Clone)]
+pub struct zathura_rectangle_s {
+    pub x1: f64,
+    pub y1: f64,
+    pub x2: f64,
+    pub y2: f64,
+}
+#[test]
+fn bindgen_test_layout_zathura_rectangle_s() {
+    const UNINIT: ::std::mem::MaybeUninit<zathura_rectangle_s> = ::std::mem::MaybeUninit::uninit();
+    let ptr = UNINIT.as_ptr();
+    assert_eq!(
+        ::std::mem::size_of::<zathura_rectangle_s>(),
+        32usize,
+        concat!("Size of: ", stringify!(zathura_rectangle_s))
+    );
+    assert_eq!(
+        ::std::mem::align_of::<zathura_rectangle_s>(),
+        8usize,
+        concat!("Alignment of ", stringify!(zathura_rectangle_s))
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).x1) as usize - ptr as usize },
+        0usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(zathura_rectangle_s),
+            "::",
+            stringify!(x1)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).y1) as usize - ptr as usize },
+        8usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(zathura_rectangle_s),
+            "::",
+            stringify!(y1)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).x2) as usize - ptr as usize },
+        16usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(zathura_rectangle_s),
+            "::",
+            stringify!(x2)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).y2) as usize - ptr as usize },
+        24usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(zathura_rectangle_s),
+            "::",
+            stringify!(y2)
+        )
+    );
+}
+pub type zathura_rectangle_t = zathura_rectangle_s;
+#[repr(C)]
+#[derive(Debug, Copy, Clone)]
+pub struct zathura_image_s {
+    pub position: zathura_rectangle_t,
+    pub data: *mut ::std::os::raw::c_void,
+}
+#[test]
+fn bindgen_test_layout_zathura_image_s() {
+    const UNINIT: ::std::mem::MaybeUninit<zathura_image_s> = ::std::mem::MaybeUninit::uninit();
+    let ptr = UNINIT.as_ptr();
+    assert_eq!(
+        ::std::mem::size_of::<zathura_image_s>(),
+        40usize,
+        concat!("Size of: ", stringify!(zathura_image_s))
+    );
+    assert_eq!(
+        ::std::mem::align_of::<zathura_image_s>(),
+        8usize,
+        concat!("Alignment of ", stringify!(zathura_image_s))
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).position) as usize - ptr as usize },
+        0usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(zathura_image_s),
+            "::",
+            stringify!(position)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).data) as usize - ptr as usize },
+        32usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(zathura_image_s),
+            "::",
+            stringify!(data)
+        )
+    );
+}
+pub type zathura_image_t = zathura_image_s;
+#[repr(C)]
+#[derive(Debug, Copy, Clone)]
+pub struct zathura_device_factors_s {
+    pub x: f64,
+    pub y: f64,
+}
+#[test]
+fn bindgen_test_layout_zathura_device_factors_s() {
+    const UNINIT: ::std::mem::MaybeUninit<zathura_device_factors_s> =
+        ::std::mem::MaybeUninit::uninit();
+    let ptr = UNINIT.as_ptr();
+    assert_eq!(
+        ::std::mem::size_of::<zathura_device_factors_s>(),
+        16usize,
+        concat!("Size of: ", stringify!(zathura_device_factors_s))
+    );
+    assert_eq!(
+        ::std::mem::align_of::<zathura_device_factors_s>(),
+        8usize,
+        concat!("Alignment of ", stringify!(zathura_device_factors_s))
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).x) as usize - ptr as usize },
+        0usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(zathura_device_factors_s),
+            "::",
+            stringify!(x)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).y) as usize - ptr as usize },
+        8usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(zathura_device_factors_s),
+            "::",
+            stringify!(y)
+        )
+    );
+}
+pub type zathura_device_factors_t = zathura_device_factors_s;
+extern "C" {
+    pub fn zathura_document_get_path(
+        document: *mut zathura_document_t,
+    ) -> *const ::std::os::raw::c_char;
+}
+extern "C" {
+    pub fn zathura_document_get_uri(
+        document: *mut zathura_document_t,
+    ) -> *const ::std::os::raw::c_char;
+}
+extern "C" {
+    pub fn zathura_document_get_basename(
+        document: *mut zathura_document_t,
+    ) -> *const ::std::os::raw::c_char;
+}
+extern "C" {
+    pub fn zathura_document_get_page(
+        document: *mut zathura_document_t,
+        index: ::std::os::raw::c_uint,
+    ) -> *mut zathura_page_t;
+}
+extern "C" {
+    pub fn zathura_document_get_number_of_pages(
+        document: *mut zathura_document_t,
+    ) -> ::std::os::raw::c_uint;
+}
+extern "C" {
+    pub fn zathura_document_set_number_of_pages(
+        document: *mut zathura_document_t,
+        number_of_pages: ::std::os::raw::c_uint,
+    );
+}
+extern "C" {
+    pub fn zathura_document_get_current_page_number(
+        document: *mut zathura_document_t,
+    ) -> ::std::os::raw::c_uint;
+}
+extern "C" {
+    pub fn zathura_document_get_zoom(document: *mut zathura_document_t) -> f64;
+}
+extern "C" {
+    pub fn zathura_document_get_scale(document: *mut zathura_document_t) -> f64;
+}
+extern "C" {
+    pub fn zathura_document_get_rotation(
+        document: *mut zathura_document_t,
+    ) -> ::std::os::raw::c_uint;
+}
+extern "C" {
+    pub fn zathura_document_get_data(
+        document: *mut zathura_document_t,
+    ) -> *mut ::std::os::raw::c_void;
+}
+extern "C" {
+    pub fn zathura_document_set_data(
+        document: *mut zathura_document_t,
+        data: *mut ::std::os::raw::c_void,
+    );
+}
+extern "C" {
+    pub fn zathura_document_get_viewport_ppi(document: *mut zathura_document_t) -> f64;
+}
+extern "C" {
+    pub fn zathura_document_get_device_factors(
+        document: *mut zathura_document_t,
+    ) -> zathura_device_factors_t;
+}
+extern "C" {
+    pub fn zathura_document_get_cell_size(
+        document: *mut zathura_document_t,
+        height: *mut ::std::os::raw::c_uint,
+        width: *mut ::std::os::raw::c_uint,
+    );
+}
+extern "C" {
+    pub fn zathura_page_get_document(page: *mut zathura_page_t) -> *mut zathura_document_t;
+}
+extern "C" {
+    pub fn zathura_page_get_index(page: *mut zathura_page_t) -> ::std::os::raw::c_uint;
+}
+extern "C" {
+    pub fn zathura_page_get_width(page: *mut zathura_page_t) -> f64;
+}
+extern "C" {
+    pub fn zathura_page_set_width(page: *mut zathura_page_t, width: f64);
+}
+extern "C" {
+    pub fn zathura_page_get_height(page: *mut zathura_page_t) -> f64;
+}
+extern "C" {
+    pub fn zathura_page_set_height(page: *mut zathura_page_t, height: f64);
+}
+extern "C" {
+    pub fn zathura_page_get_data(page: *mut zathura_page_t) -> *mut ::std::os::raw::c_void;
+}
+extern "C" {
+    pub fn zathura_page_set_data(page: *mut zathura_page_t, data: *mut ::std::os::raw::c_void);
+}
+pub type girara_free_function_t =
+    ::std::option::Option<unsafe extern "C" fn(data: *mut ::std::os::raw::c_void)>;
+extern "C" {
+    pub fn girara_list_new2(gfree: girara_free_function_t) -> *mut girara_list_t;
+}
+extern "C" {
+    pub fn girara_list_append(list: *mut girara_list_t, data: *mut ::std::os::raw::c_void);
+}
+extern "C" {
+    pub fn girara_list_nth(list: *mut girara_list_t, n: usize) -> *mut ::std::os::raw::c_void;
+}
+extern "C" {
+    pub fn girara_list_size(list: *mut girara_list_t) -> usize;
+}
+pub type zathura_plugin_functions_t = zathura_plugin_functions_s;
+pub type zathura_plugin_document_open_t = ::std::option::Option<
+    unsafe extern "C" fn(document: *mut zathura_document_t) -> zathura_error_t,
+>;
+pub type zathura_plugin_document_free_t = ::std::option::Option<
+    unsafe extern "C" fn(
+        document: *mut zathura_document_t,
+        data: *mut ::std::os::raw::c_void,
+    ) -> zathura_error_t,
+>;
+pub type zathura_plugin_document_index_generate_t = ::std::option::Option<
+    unsafe extern "C" fn(
+        document: *mut zathura_document_t,
+        data: *mut ::std::os::raw::c_void,
+        error: *mut zathura_error_t,
+    ) -> *mut girara_tree_node_t,
+>;
+pub type zathura_plugin_document_save_as_t = ::std::option::Option<
+    unsafe extern "C" fn(
+        document: *mut zathura_document_t,
+        data: *mut ::std::os::raw::c_void,
+        path: *const ::std::os::raw::c_char,
+    ) -> zathura_error_t,
+>;
+pub type zathura_plugin_document_attachments_get_t = ::std::option::Option<
+    unsafe extern "C" fn(
+        document: *mut zathura_document_t,
+        data: *mut ::std::os::raw::c_void,
+        error: *mut zathura_error_t,
+    ) -> *mut girara_list_t,
+>;
+pub type zathura_plugin_document_attachment_save_t = ::std::option::Option<
+    unsafe extern "C" fn(
+        document: *mut zathura_document_t,
+        data: *mut ::std::os::raw::c_void,
+        attachment: *const ::std::os::raw::c_char,
+        file: *const ::std::os::raw::c_char,
+    ) -> zathura_error_t,
+>;
+pub type zathura_plugin_document_get_information_t = ::std::option::Option<
+    unsafe extern "C" fn(
+        document: *mut zathura_document_t,
+        data: *mut ::std::os::raw::c_void,
+        error: *mut zathura_error_t,
+    ) -> *mut girara_list_t,
+>;
+pub type zathura_plugin_page_init_t =
+    ::std::option::Option<unsafe extern "C" fn(page: *mut zathura_page_t) -> zathura_error_t>;
+pub type zathura_plugin_page_clear_t = ::std::option::Option<
+    unsafe extern "C" fn(
+        page: *mut zathura_page_t,
+        data: *mut ::std::os::raw::c_void,
+    ) -> zathura_error_t,
+>;
+pub type zathura_plugin_page_search_text_t = ::std::option::Option<
+    unsafe extern "C" fn(
+        page: *mut zathura_page_t,
+        data: *mut ::std::os::raw::c_void,
+        text: *const ::std::os::raw::c_char,
+        error: *mut zathura_error_t,
+    ) -> *mut girara_list_t,
+>;
+pub type zathura_plugin_page_links_get_t = ::std::option::Option<
+    unsafe extern "C" fn(
+        page: *mut zathura_page_t,
+        data: *mut ::std::os::raw::c_void,
+        error: *mut zathura_error_t,
+    ) -> *mut girara_list_t,
+>;
+pub type zathura_plugin_page_form_fields_get_t = ::std::option::Option<
+    unsafe extern "C" fn(
+        page: *mut zathura_page_t,
+        data: *mut ::std::os::raw::c_void,
+        error: *mut zathura_error_t,
+    ) -> *mut girara_list_t,
+>;
+pub type zathura_plugin_page_images_get_t = ::std::option::Option<
+    unsafe extern "C" fn(
+        page: *mut zathura_page_t,
+        data: *mut ::std::os::raw::c_void,
+        error: *mut zathura_error_t,
+    ) -> *mut girara_list_t,
+>;
+pub type zathura_plugin_page_image_get_cairo_t = ::std::option::Option<
+    unsafe extern "C" fn(
+        page: *mut zathura_page_t,
+        data: *mut ::std::os::raw::c_void,
+        image: *mut zathura_image_t,
+        error: *mut zathura_error_t,
+    ) -> *mut cairo_surface_t,
+>;
+pub type zathura_plugin_page_get_text_t = ::std::option::Option<
+    unsafe extern "C" fn(
+        page: *mut zathura_page_t,
+        data: *mut ::std::os::raw::c_void,
+        rectangle: zathura_rectangle_t,
+        error: *mut zathura_error_t,
+    ) -> *mut ::std::os::raw::c_char,
+>;
+pub type zathura_plugin_page_render_t = ::std::option::Option<
+    unsafe extern "C" fn(
+        page: *mut zathura_page_t,
+        data: *mut ::std::os::raw::c_void,
+        error: *mut zathura_error_t,
+    ) -> *mut zathura_image_buffer_t,
+>;
+pub type zathura_plugin_page_render_cairo_t = ::std::option::Option<
+    unsafe extern "C" fn(
+        page: *mut zathura_page_t,
+        data: *mut ::std::os::raw::c_void,
+        cairo: *mut cairo_t,
+        printing: bool,
+    ) -> zathura_error_t,
+>;
+pub type zathura_plugin_page_get_label_t = ::std::option::Option<
+    unsafe extern "C" fn(
+        page: *mut zathura_page_t,
+        data: *mut ::std::os::raw::c_void,
+        label: *mut *mut ::std::os::raw::c_char,
+    ) -> zathura_error_t,
+>;
+#[repr(C)]
+#[derive(Debug, Copy, Clone)]
+pub struct zathura_plugin_functions_s {
+    pub document_open: zathura_plugin_document_open_t,
+    pub document_free: zathura_plugin_document_free_t,
+    pub document_index_generate: zathura_plugin_document_index_generate_t,
+    pub document_save_as: zathura_plugin_document_save_as_t,
+    pub document_attachments_get: zathura_plugin_document_attachments_get_t,
+    pub document_attachment_save: zathura_plugin_document_attachment_save_t,
+    pub document_get_information: zathura_plugin_document_get_information_t,
+    pub page_init: zathura_plugin_page_init_t,
+    pub page_clear: zathura_plugin_page_clear_t,
+    pub page_search_text: zathura_plugin_page_search_text_t,
+    pub page_links_get: zathura_plugin_page_links_get_t,
+    pub page_form_fields_get: zathura_plugin_page_form_fields_get_t,
+    pub page_images_get: zathura_plugin_page_images_get_t,
+    pub page_image_get_cairo: zathura_plugin_page_image_get_cairo_t,
+    pub page_get_text: zathura_plugin_page_get_text_t,
+    pub page_render: zathura_plugin_page_render_t,
+    pub page_render_cairo: zathura_plugin_page_render_cairo_t,
+    pub page_get_label: zathura_plugin_page_get_label_t,
+}
+#[test]
+fn bindgen_test_layout_zathura_plugin_functions_s() {
+    const UNINIT: ::std::mem::MaybeUninit<zathura_plugin_functions_s> =
+        ::std::mem::MaybeUninit::uninit();
+    let ptr = UNINIT.as_ptr();
+    assert_eq!(
+        ::std::mem::size_of::<zathura_plugin_functions_s>(),
+        144usize,
+        concat!("Size of: ", stringify!(zathura_plugin_functions_s))
+    );
+    assert_eq!(
+        ::std::mem::align_of::<zathura_plugin_functions_s>(),
+        8usize,
+        concat!("Alignment of ", stringify!(zathura_plugin_functions_s))
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).document_open) as usize - ptr as usize },
+        0usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(zathura_plugin_functions_s),
+            "::",
+            stringify!(document_open)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).document_free) as usize - ptr as usize },
+        8usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(zathura_plugin_functions_s),
+            "::",
+            stringify!(document_free)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).document_index_generate) as usize - ptr as usize },
+        16usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(zathura_plugin_functions_s),
+            "::",
+            stringify!(document_index_generate)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).document_save_as) as usize - ptr as usize },
+        24usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(zathura_plugin_functions_s),
+            "::",
+            stringify!(document_save_as)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).document_attachments_get) as usize - ptr as usize },
+        32usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(zathura_plugin_functions_s),
+            "::",
+            stringify!(document_attachments_get)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).document_attachment_save) as usize - ptr as usize },
+        40usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(zathura_plugin_functions_s),
+            "::",
+            stringify!(document_attachment_save)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).document_get_information) as usize - ptr as usize },
+        48usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(zathura_plugin_functions_s),
+            "::",
+            stringify!(document_get_information)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).page_init) as usize - ptr as usize },
+        56usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(zathura_plugin_functions_s),
+            "::",
+            stringify!(page_init)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).page_clear) as usize - ptr as usize },
+        64usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(zathura_plugin_functions_s),
+            "::",
+            stringify!(page_clear)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).page_search_text) as usize - ptr as usize },
+        72usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(zathura_plugin_functions_s),
+            "::",
+            stringify!(page_search_text)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).page_links_get) as usize - ptr as usize },
+        80usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(zathura_plugin_functions_s),
+            "::",
+            stringify!(page_links_get)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).page_form_fields_get) as usize - ptr as usize },
+        88usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(zathura_plugin_functions_s),
+            "::",
+            stringify!(page_form_fields_get)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).page_images_get) as usize - ptr as usize },
+        96usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(zathura_plugin_functions_s),
+            "::",
+            stringify!(page_images_get)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).page_image_get_cairo) as usize - ptr as usize },
+        104usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(zathura_plugin_functions_s),
+            "::",
+            stringify!(page_image_get_cairo)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).page_get_text) as usize - ptr as usize },
+        112usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(zathura_plugin_functions_s),
+            "::",
+            stringify!(page_get_text)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).page_render) as usize - ptr as usize },
+        120usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(zathura_plugin_functions_s),
+            "::",
+            stringify!(page_render)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).page_render_cairo) as usize - ptr as usize },
+        128usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(zathura_plugin_functions_s),
+            "::",
+            stringify!(page_render_cairo)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).page_get_label) as usize - ptr as usize },
+        136usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(zathura_plugin_functions_s),
+            "::",
+            stringify!(page_get_label)
+        )
+    );
+}
+#[repr(C)]
+#[derive(Debug, Copy, Clone)]
+pub struct zathura_plugin_version_s {
+    pub major: ::std::os::raw::c_uint,
+    pub minor: ::std::os::raw::c_uint,
+    pub rev: ::std::os::raw::c_uint,
+}
+#[test]
+fn bindgen_test_layout_zathura_plugin_version_s() {
+    const UNINIT: ::std::mem::MaybeUninit<zathura_plugin_version_s> =
+        ::std::mem::MaybeUninit::uninit();
+    let ptr = UNINIT.as_ptr();
+    assert_eq!(
+        ::std::mem::size_of::<zathura_plugin_version_s>(),
+        12usize,
+        concat!("Size of: ", stringify!(zathura_plugin_version_s))
+    );
+    assert_eq!(
+        ::std::mem::align_of::<zathura_plugin_version_s>(),
+        4usize,
+        concat!("Alignment of ", stringify!(zathura_plugin_version_s))
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).major) as usize - ptr as usize },
+        0usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(zathura_plugin_version_s),
+            "::",
+            stringify!(major)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).minor) as usize - ptr as usize },
+        4usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(zathura_plugin_version_s),
+            "::",
+            stringify!(minor)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).rev) as usize - ptr as usize },
+        8usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(zathura_plugin_version_s),
+            "::",
+            stringify!(rev)
+        )
+    );
+}
+pub type zathura_plugin_version_t = zathura_plugin_version_s;
+#[repr(C)]
+#[derive(Debug, Copy, Clone)]
+pub struct zathura_plugin_definition_s {
+    pub name: *const ::std::os::raw::c_char,
+    pub version: zathura_plugin_version_t,
+    pub functions: zathura_plugin_functions_t,
+    pub mime_types_size: usize,
+    pub mime_types: *mut *const ::std::os::raw::c_char,
+}
+#[test]
+fn bindgen_test_layout_zathura_plugin_definition_s() {
+    const UNINIT: ::std::mem::MaybeUninit<zathura_plugin_definition_s> =
+        ::std::mem::MaybeUninit::uninit();
+    let ptr = UNINIT.as_ptr();
+    assert_eq!(
+        ::std::mem::size_of::<zathura_plugin_definition_s>(),
+        184usize,
+        concat!("Size of: ", stringify!(zathura_plugin_definition_s))
+    );
+    assert_eq!(
+        ::std::mem::align_of::<zathura_plugin_definition_s>(),
+        8usize,
+        concat!("Alignment of ", stringify!(zathura_plugin_definition_s))
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).name) as usize - ptr as usize },
+        0usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(zathura_plugin_definition_s),
+            "::",
+            stringify!(name)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).version) as usize - ptr as usize },
+        8usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(zathura_plugin_definition_s),
+            "::",
+            stringify!(version)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).functions) as usize - ptr as usize },
+        24usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(zathura_plugin_definition_s),
+            "::",
+            stringify!(functions)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).mime_types_size) as usize - ptr as usize },
+        168usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(zathura_plugin_definition_s),
+            "::",
+            stringify!(mime_types_size)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).mime_types) as usize - ptr as usize },
+        176usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(zathura_plugin_definition_s),
+            "::",
+            stringify!(mime_types)
+        )
+    );
+}
+pub type zathura_plugin_definition_t = zathura_plugin_definition_s;
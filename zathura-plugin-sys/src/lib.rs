@@ -3,9 +3,18 @@
 //! For more high-level bindings that allow writing plugins in type-safe Rust,
 //! see [`zathura-plugin`].
 //!
+//! The bindings only cover the parts of the API used by `zathura-plugin`. They
+//! are checked in for the headers in the `headers` directory, so building this
+//! crate doesn't require libclang. Enable the `generate-bindings` feature to
+//! generate them from the headers at build time instead.
+//!
 //! [Zathura's]: https://pwmt.org/projects/zathura/
 //! [`zathura-plugin`]: https://docs.rs/zathura-plugin/
 
 #![allow(nonstandard_style)]
 
+#[cfg(not(feature = "generate-bindings"))]
+include!("bindings.rs");
+
+#[cfg(feature = "generate-bindings")]
 include!(concat!(env!("OUT_DIR"), "/bindings.rs"));